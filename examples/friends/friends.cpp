@@ -45,6 +45,15 @@ class datasource : mapreduce::detail::noncopyable
         return key < 8;
     }
 
+    size_t const setup_keys(typename MapTask::key_type *keys, size_t const count)
+    {
+        unsigned const first = sequence_.fetch_add(unsigned(count));
+        size_t loop = 0;
+        for (; loop<count  &&  first + loop < 8; ++loop)
+            keys[loop] = unsigned(first + loop);
+        return loop;
+    }
+
     bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value)
     {
         for (unsigned loop=0; loop<8; ++loop)
@@ -54,7 +63,7 @@ class datasource : mapreduce::detail::noncopyable
     }
 
   private:
-    unsigned sequence_;
+    std::atomic<unsigned> sequence_;
 };
 
 struct map_task : public mapreduce::map_task<unsigned, std::vector<unsigned> >
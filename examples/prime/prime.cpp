@@ -56,6 +56,17 @@ class number_source : mapreduce::detail::noncopyable
         return (key * step_ <= last_);
     }
 
+    // claim a batch of keys with one atomic increment, so map tasks
+    // do not need to serialise access to the datasource
+    size_t const setup_keys(typename MapTask::key_type *keys, size_t const count)
+    {
+        long const first = sequence_.fetch_add(long(count));
+        size_t loop = 0;
+        for (; loop<count  &&  (first + long(loop)) * step_ <= last_; ++loop)
+            keys[loop] = first + long(loop);
+        return loop;
+    }
+
     bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value)
     {
         typename MapTask::value_type val;
@@ -68,10 +79,10 @@ class number_source : mapreduce::detail::noncopyable
     }
 
   private:
-    long       sequence_;
-    long const step_;
-    long const last_;
-    long const first_;
+    std::atomic<long> sequence_;
+    long const        step_;
+    long const        last_;
+    long const        first_;
 };
 
 struct map_task : public mapreduce::map_task<long, std::pair<long, long> >
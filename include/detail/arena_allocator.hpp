@@ -0,0 +1,237 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace mapreduce {
+
+namespace detail {
+
+// slabs of memory released by arenas, kept to be reused by other arenas.
+// the pool is split into shards, chosen by the thread that takes or returns
+// a slab, so that the threads of a thread pool, each filling the stores of
+// its own map tasks, mostly take back the slabs that they released, and do
+// not contend for a lock to do so
+class slab_pool : noncopyable
+{
+  public:
+    enum { slab_size = 64 * 1024 };
+
+    ~slab_pool()
+    {
+        for (auto &shard : shards_)
+        {
+            for (auto slab : shard.slabs)
+                ::operator delete(slab);
+        }
+    }
+
+    // arenas hold the pool, so that it is destroyed after the last of them
+    static std::shared_ptr<slab_pool> shared_pool(void)
+    {
+        static std::shared_ptr<slab_pool> pool(std::make_shared<slab_pool>());
+        return pool;
+    }
+
+    char *acquire(void)
+    {
+        shard_t &shard = this_shard();
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (!shard.slabs.empty())
+            {
+                char *slab = shard.slabs.back();
+                shard.slabs.pop_back();
+                return slab;
+            }
+        }
+        return static_cast<char *>(::operator new(slab_size));
+    }
+
+    void release(char *slab)
+    {
+        shard_t &shard = this_shard();
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (shard.slabs.size() < max_slabs_per_shard)
+            {
+                shard.slabs.push_back(slab);
+                return;
+            }
+        }
+        ::operator delete(slab);
+    }
+
+  private:
+    enum { num_shards = 16, max_slabs_per_shard = 64 };
+
+    struct shard_t
+    {
+        std::mutex          mutex;
+        std::vector<char *> slabs;
+    };
+
+    shard_t &this_shard(void)
+    {
+        return shards_[std::hash<std::thread::id>()(std::this_thread::get_id()) % num_shards];
+    }
+
+  private:
+    shard_t shards_[num_shards];
+};
+
+// a monotonic arena. memory is handed out from slabs in sequence and is not
+// reused when it is deallocated; the slabs are returned to the slab pool,
+// all at once, when the arena is destroyed. allocations of more than a
+// quarter of a slab are made and freed individually, so that the buffers of
+// large vectors, which are replaced as they grow, are not kept
+class arena : noncopyable
+{
+  public:
+    arena()
+      : pool_(slab_pool::shared_pool()),
+        current_(0),
+        used_(slab_pool::slab_size)
+    {
+    }
+
+    ~arena()
+    {
+        for (auto slab : slabs_)
+            pool_->release(slab);
+    }
+
+    void *allocate(size_t const size, size_t const alignment)
+    {
+        if (size > large_allocation)
+            return ::operator new(size);
+
+        size_t offset = (used_ + alignment - 1) / alignment * alignment;
+        if (offset + size > slab_pool::slab_size)
+        {
+            current_ = pool_->acquire();
+            slabs_.push_back(current_);
+            offset = 0;
+        }
+        used_ = offset + size;
+        return current_ + offset;
+    }
+
+    void deallocate(void *p, size_t const size)
+    {
+        if (size > large_allocation)
+            ::operator delete(p);
+    }
+
+  private:
+    enum { large_allocation = slab_pool::slab_size / 4 };
+
+    std::shared_ptr<slab_pool> pool_;
+    std::vector<char *>        slabs_;
+    char                      *current_;    // slab that is being filled
+    size_t                     used_;       // bytes used of the current slab
+};
+
+}   // namespace detail
+
+// an allocator for intermediate stores, such as in_memory's Allocator,
+// that allocates from a monotonic arena. a default constructed allocator
+// creates an arena, which is shared by its copies and by the containers
+// that use them, and is destroyed with the last of them; in_memory creates
+// an arena for each partition, so the store of a map task is freed slab by
+// slab rather than node by node. an arena is not thread safe, so like the
+// containers that use it, it must be used by one thread at a time
+template<typename T>
+class arena_allocator
+{
+  public:
+    typedef T                 value_type;
+    typedef T                *pointer;
+    typedef T const          *const_pointer;
+    typedef T                &reference;
+    typedef T const          &const_reference;
+    typedef size_t            size_type;
+    typedef std::ptrdiff_t    difference_type;
+    typedef std::true_type    propagate_on_container_copy_assignment;
+    typedef std::true_type    propagate_on_container_move_assignment;
+    typedef std::true_type    propagate_on_container_swap;
+
+    template<typename U>
+    struct rebind
+    {
+        typedef arena_allocator<U> other;
+    };
+
+    arena_allocator()
+      : arena_(std::make_shared<detail::arena>())
+    {
+    }
+
+    // a copy is declared, and so there is no move constructor; a container
+    // that is moved from keeps its arena, and can still be used
+    arena_allocator(arena_allocator const &other)
+      : arena_(other.arena_)
+    {
+    }
+
+    template<typename U>
+    arena_allocator(arena_allocator<U> const &other)
+      : arena_(other.arena_)
+    {
+    }
+
+    T *allocate(size_t const n)
+    {
+        return static_cast<T *>(arena_->allocate(n * sizeof(T), std::alignment_of<T>::value));
+    }
+
+    void deallocate(T *p, size_t const n)
+    {
+        arena_->deallocate(p, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool const operator==(arena_allocator<U> const &other) const
+    {
+        return arena_ == other.arena_;
+    }
+
+    template<typename U>
+    bool const operator!=(arena_allocator<U> const &other) const
+    {
+        return arena_ != other.arena_;
+    }
+
+  private:
+    std::shared_ptr<detail::arena> arena_;
+
+    template<typename U>
+    friend class arena_allocator;
+};
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,382 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <cstring>
+#include <ostream>
+#include <type_traits>
+#include <boost/iterator/iterator_facade.hpp>
+
+namespace mapreduce {
+
+namespace detail {
+
+inline size_t const align_to(size_t const offset, size_t const alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+// records are aligned by their offset from the start of the block of records
+// that holds them. blocks are at least as aligned as any value, so a pointer
+// into a block is aligned by its address
+inline char const *align_to(char const *data, size_t const alignment)
+{
+    return reinterpret_cast<char const *>(align_to(reinterpret_cast<std::uintptr_t>(data), alignment));
+}
+
+// the binary encoding of intermediate keys and values. values are used in
+// place by the reduce tasks, so they must be trivially copyable; keys are
+// decoded, and std::string keys are supported. a Writer provides
+//     void write(void const *data, size_t const size);
+//     void align(size_t const alignment);
+template<typename T>
+struct binary_codec
+{
+    static_assert(std::is_trivially_copyable<T>::value, "binary records require trivially copyable intermediate keys and values");
+
+    template<typename Writer>
+    static void write(Writer &writer, T const &value)
+    {
+        writer.write(&value, sizeof(T));
+    }
+
+    static char const *read(char const *data, T &value)
+    {
+        std::memcpy(&value, data, sizeof(T));
+        return data + sizeof(T);
+    }
+
+    // read a value that may not have been written in full, returning null
+    // if it runs past 'end'
+    static char const *read(char const *data, char const *end, T &value)
+    {
+        if (size_t(end - data) < sizeof(T))
+            return 0;
+        return read(data, value);
+    }
+};
+
+template<>
+struct binary_codec<std::string>
+{
+    template<typename Writer>
+    static void write(Writer &writer, std::string const &value)
+    {
+        std::uint64_t const length = value.length();
+        writer.write(&length, sizeof(length));
+        writer.write(value.data(), value.length());
+    }
+
+    static char const *read(char const *data, std::string &value)
+    {
+        std::uint64_t length;
+        std::memcpy(&length, data, sizeof(length));
+        data += sizeof(length);
+        value.assign(data, size_t(length));
+        return data + length;
+    }
+
+    static char const *read(char const *data, char const *end, std::string &value)
+    {
+        std::uint64_t length;
+        if (size_t(end - data) < sizeof(length))
+            return 0;
+        std::memcpy(&length, data, sizeof(length));
+        if (std::uint64_t(end - data - sizeof(length)) < length)
+            return 0;
+        return read(data, value);
+    }
+};
+
+// the types that binary_codec encodes
+template<typename T>
+struct has_binary_codec
+  : std::integral_constant<bool, std::is_trivially_copyable<T>::value  ||  std::is_same<T, std::string>::value>
+{
+};
+
+// the callback of an intermediate store's reduce() that writes each key and
+// its values as a record; the key, the number of values and the values,
+// aligned so that the values can be used where they lie
+template<typename Job, typename Writer>
+class record_writer : noncopyable
+{
+  public:
+    typedef typename Job::reduce_task_type::key_type   key_type;
+    typedef typename Job::reduce_task_type::value_type value_type;
+
+    explicit record_writer(Writer &writer)
+      : writer_(writer)
+    {
+    }
+
+    template<typename It>
+    void operator()(key_type const &key, It it, It ite)
+    {
+        binary_codec<key_type>::write(writer_, key);
+        writer_.align(sizeof(std::uint64_t));
+        std::uint64_t const count = std::uint64_t(std::distance(it, ite));
+        writer_.write(&count, sizeof(count));
+        writer_.align(std::alignment_of<value_type>::value);
+        for (; it!=ite; ++it)
+            binary_codec<value_type>::write(writer_, *it);
+    }
+
+  private:
+    Writer &writer_;
+};
+
+// iterates the values of a key that are held in more than one block of records
+template<typename T>
+class value_ranges_iterator
+  : public boost::iterator_facade<
+        value_ranges_iterator<T>,
+        T const,
+        boost::forward_traversal_tag>
+{
+    friend class boost::iterator_core_access;
+
+  public:
+    typedef std::vector<std::pair<T const *, T const *> > ranges_t;
+
+    value_ranges_iterator(ranges_t const &ranges, size_t const range)
+      : ranges_(&ranges),
+        range_(range),
+        current_(0)
+    {
+        skip_empty_ranges();
+    }
+
+  private:
+    void skip_empty_ranges(void)
+    {
+        while (range_ < ranges_->size()  &&  (*ranges_)[range_].first == (*ranges_)[range_].second)
+            ++range_;
+        current_ = (range_ < ranges_->size())? (*ranges_)[range_].first : 0;
+    }
+
+    void increment(void)
+    {
+        if (++current_ == (*ranges_)[range_].second)
+        {
+            ++range_;
+            skip_empty_ranges();
+        }
+    }
+
+    bool const equal(value_ranges_iterator const &other) const
+    {
+        return range_ == other.range_  &&  current_ == other.current_;
+    }
+
+    T const &dereference(void) const
+    {
+        return *current_;
+    }
+
+  private:
+    ranges_t const *ranges_;
+    size_t          range_;
+    T const        *current_;
+};
+
+// writes records to a buffer in memory
+class buffer_writer : noncopyable
+{
+  public:
+    explicit buffer_writer(std::vector<char> &buffer)
+      : buffer_(buffer)
+    {
+    }
+
+    void write(void const *data, size_t const size)
+    {
+        char const *bytes = static_cast<char const *>(data);
+        buffer_.insert(buffer_.end(), bytes, bytes + size);
+    }
+
+    void align(size_t const alignment)
+    {
+        buffer_.resize(align_to(buffer_.size(), alignment), 0);
+    }
+
+  private:
+    std::vector<char> &buffer_;
+};
+
+// writes records to a stream, such as a file
+class stream_writer : noncopyable
+{
+  public:
+    explicit stream_writer(std::ostream &stream)
+      : stream_(stream),
+        offset_(0)
+    {
+    }
+
+    void write(void const *data, size_t const size)
+    {
+        stream_.write(static_cast<char const *>(data), size);
+        offset_ += size;
+    }
+
+    void align(size_t const alignment)
+    {
+        for (size_t const offset=align_to(offset_, alignment); offset_<offset; ++offset_)
+            stream_.put(0);
+    }
+
+  private:
+    std::ostream &stream_;
+    size_t        offset_;
+};
+
+// reduce blocks of records, each sorted by key, by merging them. the values
+// of each key are passed to the callback where they lie, so the blocks must
+// be aligned as they were when they were written
+template<typename Job, typename KeyCompare>
+class record_merger : noncopyable
+{
+  public:
+    typedef typename Job::reduce_task_type::key_type   key_type;
+    typedef typename Job::reduce_task_type::value_type value_type;
+    typedef std::pair<char const *, char const *>      block_t;
+
+    template<typename Callback>
+    static void reduce(std::vector<block_t> const &blocks, Callback &callback)
+    {
+        std::vector<cursor> cursors;
+        for (auto const &block : blocks)
+        {
+            cursor c(block);
+            if (c.read())
+                cursors.push_back(c);
+        }
+
+        KeyCompare compare;
+        typename value_ranges_iterator<value_type>::ranges_t ranges;
+        while (!cursors.empty())
+        {
+            auto first = cursors.begin();
+            for (auto it=cursors.begin()+1; it!=cursors.end(); ++it)
+            {
+                if (compare(it->key, first->key))
+                    first = it;
+            }
+            key_type const key = first->key;
+
+            // gather the values of the key from every block that holds it
+            ranges.clear();
+            for (auto &c : cursors)
+            {
+                if (!compare(key, c.key)  &&  !compare(c.key, key))
+                {
+                    ranges.push_back(std::make_pair(c.first, c.last));
+                    c.valid = c.read();
+                }
+            }
+
+            if (ranges.size() == 1)
+                callback(key, ranges[0].first, ranges[0].second);
+            else
+            {
+                callback(
+                    key,
+                    value_ranges_iterator<value_type>(ranges, 0),
+                    value_ranges_iterator<value_type>(ranges, ranges.size()));
+            }
+
+            cursors.erase(
+                std::remove_if(cursors.begin(), cursors.end(), [](cursor const &c) { return !c.valid; }),
+                cursors.end());
+        }
+    }
+
+    // a block of records that was received from elsewhere holds whole
+    // records, none of which run past its end
+    static bool const valid(block_t const &block)
+    {
+        key_type      key;
+        std::uint64_t count;
+        for (char const *data=block.first; data!=block.second;)
+        {
+            data = binary_codec<key_type>::read(data, block.second, key);
+            data = data? align_within(data, block.second, sizeof(std::uint64_t)) : 0;
+            data = data? binary_codec<std::uint64_t>::read(data, block.second, count) : 0;
+            data = data? align_within(data, block.second, std::alignment_of<value_type>::value) : 0;
+            if (!data  ||  count > std::uint64_t(block.second - data) / sizeof(value_type))
+                return false;
+            data += count * sizeof(value_type);
+        }
+        return true;
+    }
+
+  private:
+    // align a position in a block, returning null if it passes 'end'
+    static char const *align_within(char const *data, char const *end, size_t const alignment)
+    {
+        size_t const padding = size_t(align_to(data, alignment) - data);
+        return (padding > size_t(end - data))? 0 : data + padding;
+    }
+
+    // the current record of a block
+    struct cursor
+    {
+        explicit cursor(block_t const &block)
+          : position(block.first),
+            end(block.second),
+            first(0),
+            last(0),
+            valid(true)
+        {
+        }
+
+        bool const read(void)
+        {
+            if (position == end)
+                return false;
+
+            char const *data = binary_codec<key_type>::read(position, key);
+            data = align_to(data, sizeof(std::uint64_t));
+
+            std::uint64_t count;
+            std::memcpy(&count, data, sizeof(count));
+            data = align_to(data + sizeof(count), std::alignment_of<value_type>::value);
+
+            first    = reinterpret_cast<value_type const *>(data);
+            last     = first + count;
+            position = reinterpret_cast<char const *>(last);
+            return true;
+        }
+
+        char const       *position;
+        char const       *end;
+        key_type          key;
+        value_type const *first;
+        value_type const *last;
+        bool              valid;
+    };
+};
+
+}   // namespace detail
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,623 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <mutex>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+namespace mapreduce {
+
+namespace detail {
+
+// the identity of a map key's input, so that a checkpointed map key whose
+// input has changed is run again. a key that names a file is identified by
+// the file's size and modification time; other keys are identified by the
+// key alone
+template<typename Key>
+inline std::string const map_key_fingerprint(Key const &/*key*/)
+{
+    return std::string();
+}
+
+inline std::string const map_key_fingerprint(std::string const &key)
+{
+    boost::system::error_code ec;
+    if (!boost::filesystem::is_regular_file(key, ec))
+        return std::string();
+
+    std::ostringstream fingerprint;
+    fingerprint << boost::filesystem::file_size(key, ec) << ":" << boost::filesystem::last_write_time(key, ec);
+    return fingerprint.str();
+}
+
+// map tasks emit keys that the intermediate store converts to its own key
+// type, which is the type that is checkpointed
+template<typename Key>
+inline Key const &to_intermediate_key(Key const &key, std::true_type)
+{
+    return key;
+}
+
+template<typename Key, typename T>
+inline Key to_intermediate_key(T const &key, std::false_type)
+{
+    return intermediates::make_intermediate_key<Key>(key);
+}
+
+// the fingerprint of the input named by a map key that was written to the
+// manifest. only keys that name files have fingerprints
+template<typename MapKey>
+inline std::string const current_fingerprint(std::string const &/*key*/, std::string const &fingerprint, std::false_type)
+{
+    return fingerprint;
+}
+
+template<typename MapKey>
+inline std::string const current_fingerprint(std::string const &key, std::string const &/*fingerprint*/, std::true_type)
+{
+    return map_key_fingerprint(key);
+}
+
+// map keys are written to the manifest as text
+template<typename T>
+class is_ostreamable
+{
+    template<typename U>
+    static auto test(int) -> decltype(std::declval<std::ostream &>() << std::declval<U const &>(), std::true_type());
+
+    template<typename>
+    static std::false_type test(...);
+
+  public:
+    static bool const value = decltype(test<T>(0))::value;
+};
+
+// a map key is the last field of a line of the manifest, so only line breaks,
+// and the escape character itself, are escaped
+inline std::string const escape_map_key(std::string const &key)
+{
+    std::string escaped;
+    escaped.reserve(key.length());
+    for (char const ch : key)
+    {
+        if (ch == '\\')
+            escaped += "\\\\";
+        else if (ch == '\n')
+            escaped += "\\n";
+        else if (ch == '\r')
+            escaped += "\\r";
+        else
+            escaped += ch;
+    }
+    return escaped;
+}
+
+inline std::string const unescape_map_key(std::string const &escaped)
+{
+    std::string key;
+    key.reserve(escaped.length());
+    for (std::string::const_iterator it=escaped.begin(); it!=escaped.end(); ++it)
+    {
+        if (*it != '\\'  ||  it+1 == escaped.end())
+            key += *it;
+        else if (*++it == 'n')
+            key += '\n';
+        else if (*it == 'r')
+            key += '\r';
+        else
+            key += *it;
+    }
+    return key;
+}
+
+// keeps the intermediate output of each completed map key in a directory,
+// so that a job that is run again, after a crash say, restores the output
+// of map keys that have already been run rather than running them again.
+//
+// each map key's output is written to a file of its own, a record of the
+// key and value of each intermediate value in the binary encoding of
+// binary_codec, so the intermediate keys and values must be trivially
+// copyable or std::string. once the map task is complete the file is renamed
+// into place and a line is appended to the manifest:
+//     fingerprint <tab> filename <tab> offset <tab> length <tab> map key
+// the manifest is read when the job is constructed; a map key is restored
+// if it is in the manifest with the fingerprint of its current input.
+// the map key must identify its data, as directory_iterator's std::string
+// keys do. a datasource that hands out a key more than once, for each
+// segment of a memory mapped file, provides map_key_segment() and the key is
+// checkpointed by key, offset and length; both are zero for other
+// datasources. a segment that starts where a checkpointed one did but has a
+// different length, because the job is run with a different segment size,
+// is not restored, and the stale output is removed
+//
+// an incremental checkpoint also keeps the combined intermediate results
+// of every map key that has been run, one file per partition. at the end
+// of a job the output of the keys that were run is combined with them and
+// the keys are recorded in the manifest with a filename of "-", so the
+// next job maps only the keys that are new, and reduces the combination of
+// their output with the kept results. the first line of the manifest is
+//     #generation <tab> n <tab> segment size
+// naming the files of the kept results, and the manifest is replaced in one
+// rename once the files of a new generation have been written. if the input
+// of a key that has been combined changes or is removed, or the job is run
+// with a different segment size, so that its segments would overlap the
+// ones that were combined, the kept results are discarded and every key is
+// run again
+template<typename MapKey, typename IntermediateKey, typename Value>
+class map_checkpoint : noncopyable
+{
+    // a map key, as text, and the segment of its input
+    typedef std::pair<std::string, datasource::segment_t> entry_key;
+
+  public:
+    // 'segment_size' is the largest segment of a map key's input that the
+    // datasource hands out, or zero if map keys are not segmented
+    map_checkpoint(std::string const &directory, bool const incremental, std::uintmax_t const segment_size)
+      : directory_(directory),
+        incremental_(incremental),
+        segment_size_(segment_size),
+        generation_(0),
+        use_combined_(true)
+    {
+        boost::filesystem::create_directories(directory_);
+
+        bool combined_valid = true;
+        std::ifstream manifest(manifest_path().c_str(), std::ios_base::binary);
+        std::string line;
+        while (std::getline(manifest, line))
+        {
+            // a line that was being written when the job stopped is incomplete
+            std::string::size_type const tab1 = line.find('\t');
+            if (line.compare(0, tab1, "#generation") == 0)
+            {
+                char *segment_size = 0;
+                generation_ = std::strtoul(line.c_str() + tab1 + 1, &segment_size, 10);
+                if (std::strtoull(segment_size, 0, 10) != segment_size_)
+                    combined_valid = false;
+                continue;
+            }
+
+            std::string::size_type const tab2 = (tab1 == std::string::npos)? tab1 : line.find('\t', tab1+1);
+            std::string::size_type const tab3 = (tab2 == std::string::npos)? tab2 : line.find('\t', tab2+1);
+            std::string::size_type const tab4 = (tab3 == std::string::npos)? tab3 : line.find('\t', tab3+1);
+            if (tab4 == std::string::npos)
+                continue;
+
+            std::string const key = unescape_map_key(line.substr(tab4+1));
+            datasource::segment_t const segment(std::strtoull(line.c_str() + tab2 + 1, 0, 10), std::strtoull(line.c_str() + tab3 + 1, 0, 10));
+            entry &e      = entries_[entry_key(key, segment)];
+            e.fingerprint = line.substr(0, tab1);
+            e.filename    = line.substr(tab1+1, tab2-tab1-1);
+
+            if (e.filename == combined
+            &&  e.fingerprint != current_fingerprint<MapKey>(key, e.fingerprint, std::is_same<MapKey, std::string>()))
+            {
+                combined_valid = false;
+            }
+        }
+
+        // the combined results cannot be used if they include the output of
+        // input that has changed or was segmented differently, nor if the
+        // job is not incremental
+        if (!combined_valid  ||  !incremental_)
+        {
+            for (auto it=entries_.begin(); it!=entries_.end();)
+            {
+                if (it->second.filename == combined)
+                    it = entries_.erase(it);
+                else
+                    ++it;
+            }
+            if (!combined_valid)
+                use_combined_ = false;
+        }
+
+        manifest_.open(manifest_path().c_str(), std::ios_base::binary | std::ios_base::app);
+        if (!manifest_.is_open())
+            BOOST_THROW_EXCEPTION(std::runtime_error("Failed to open checkpoint manifest in " + directory));
+    }
+
+    // the output of a map task, written as the task runs
+    class writer : noncopyable
+    {
+      public:
+        writer(map_checkpoint &checkpoint, MapKey const &key, datasource::segment_t const &segment)
+          : checkpoint_(checkpoint),
+            key_(key_string(key), segment),
+            fingerprint_(map_key_fingerprint(key)),
+            filename_(boost::filesystem::unique_path("map_%%%%-%%%%-%%%%-%%%%").string()),
+            writer_(file_),
+            committed_(false)
+        {
+            file_.open(temporary_path().c_str(), std::ios_base::binary);
+        }
+
+        ~writer()
+        {
+            if (!committed_)
+            {
+                file_.close();
+                boost::system::error_code ec;
+                boost::filesystem::remove(temporary_path(), ec);
+            }
+        }
+
+        template<typename T>
+        void write(T const &key, Value const &value)
+        {
+            write_record(writer_, to_intermediate_key<IntermediateKey>(key, std::is_same<T, IntermediateKey>()), value);
+        }
+
+        // the map task is complete. the key is not checkpointed if its
+        // output could not be written
+        void commit(void)
+        {
+            file_.close();
+            if (file_.fail())
+                return;
+
+            boost::system::error_code ec;
+            boost::filesystem::rename(temporary_path(), checkpoint_.directory_ / filename_, ec);
+            if (ec)
+                return;
+
+            committed_ = true;
+            checkpoint_.record(fingerprint_, filename_, key_);
+        }
+
+      private:
+        std::string const temporary_path(void) const
+        {
+            return (checkpoint_.directory_ / (filename_ + ".tmp")).string();
+        }
+
+      private:
+        map_checkpoint    &checkpoint_;
+        entry_key const    key_;
+        std::string const  fingerprint_;
+        std::string const  filename_;
+        std::ofstream      file_;
+        stream_writer      writer_;
+        bool               committed_;
+    };
+
+    // insert the checkpointed output of a segment of a map key's input into
+    // 'store', returning false if it has not been checkpointed or the input
+    // has changed. the output of a key that has been combined is already in
+    // the store, from load_combined()
+    template<typename Store>
+    bool const restore(MapKey const &key, datasource::segment_t const &segment, Store &store)
+    {
+        entry found;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            entry_key const k(key_string(key), segment);
+            auto it = entries_.find(k);
+            if (it == entries_.end())
+            {
+                remove_stale(k);
+                return false;
+            }
+            found = it->second;
+        }
+
+        if (found.fingerprint != map_key_fingerprint(key))
+            return false;
+        else if (found.filename == combined)
+            return true;
+
+        return read_file(found.filename, store);
+    }
+
+    // insert the combined results kept by the last incremental job
+    template<typename Store>
+    void load_combined(Store &store, size_t const num_partitions) const
+    {
+        if (!use_combined_  ||  generation_ == 0)
+            return;
+
+        for (size_t partition=0; partition<num_partitions; ++partition)
+            read_file(combined_filename(generation_, partition), store);
+    }
+
+    // combine the output of the map keys that have been run with the kept
+    // results, and keep the combination for the next job. 'store' is empty,
+    // and 'combine' runs the job's combiner on it
+    template<typename Store, typename Combine>
+    void save_combined(Store &store, size_t const num_partitions, Combine combine)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (committed_.empty()  &&  use_combined_  &&  generation_ > 0)
+            return;
+
+        // a key that was run again replaces its earlier output
+        boost::system::error_code ec;
+        for (auto const &c : committed_)
+        {
+            entry &e = entries_[c.first];
+            if (!e.filename.empty()  &&  e.filename != combined)
+                boost::filesystem::remove(directory_ / e.filename, ec);
+            e = c.second;
+        }
+        committed_.clear();
+
+        load_combined(store, num_partitions);
+        for (auto const &e : entries_)
+        {
+            if (e.second.filename != combined)
+                read_file(e.second.filename, store);
+        }
+        combine(store);
+
+        size_t const generation = generation_ + 1;
+        for (size_t partition=0; partition<num_partitions; ++partition)
+        {
+            std::ofstream file((directory_ / combined_filename(generation, partition)).string().c_str(), std::ios_base::binary);
+            combined_writer writer(file);
+            store.reduce(partition, writer);
+            file.close();
+            if (file.fail())
+                BOOST_THROW_EXCEPTION(std::runtime_error("Failed to write combined results in " + directory_.string()));
+        }
+
+        // the new generation is used once the manifest naming it replaces
+        // the old one
+        std::string const temporary = manifest_path() + ".tmp";
+        {
+            std::ofstream manifest(temporary.c_str(), std::ios_base::binary);
+            manifest << "#generation\t" << generation << "\t" << segment_size_ << "\n";
+            for (auto const &e : entries_)
+                write_manifest_line(manifest, e.second.fingerprint, combined, e.first);
+            manifest.close();
+            if (manifest.fail())
+                BOOST_THROW_EXCEPTION(std::runtime_error("Failed to write checkpoint manifest in " + directory_.string()));
+        }
+        manifest_.close();
+        boost::filesystem::rename(temporary, manifest_path());
+        manifest_.open(manifest_path().c_str(), std::ios_base::binary | std::ios_base::app);
+
+        // the files that have been combined are no longer needed
+        for (auto &e : entries_)
+        {
+            if (e.second.filename != combined)
+                boost::filesystem::remove(directory_ / e.second.filename, ec);
+            e.second.filename = combined;
+        }
+        for (size_t partition=0; generation_ > 0  &&  partition<num_partitions; ++partition)
+            boost::filesystem::remove(directory_ / combined_filename(generation_, partition), ec);
+        generation_   = generation;
+        use_combined_ = true;
+    }
+
+  private:
+    struct entry
+    {
+        std::string fingerprint;
+        std::string filename;
+    };
+
+    // writes the intermediate results of a partition, as the callback of
+    // an intermediate store's reduce()
+    class combined_writer : noncopyable
+    {
+      public:
+        explicit combined_writer(std::ostream &file)
+          : writer_(file)
+        {
+        }
+
+        template<typename It>
+        void operator()(IntermediateKey const &key, It it, It ite)
+        {
+            for (; it!=ite; ++it)
+                write_record(writer_, key, *it);
+        }
+
+      private:
+        stream_writer writer_;
+    };
+
+    static char const * const combined;
+
+    static std::string const key_string(MapKey const &key)
+    {
+        std::ostringstream stream;
+        stream << key;
+        return stream.str();
+    }
+
+    static std::string const combined_filename(size_t const generation, size_t const partition)
+    {
+        std::ostringstream filename;
+        filename << "combined_" << generation << "_" << partition;
+        return filename.str();
+    }
+
+    static void write_record(stream_writer &writer, IntermediateKey const &key, Value const &value)
+    {
+        binary_codec<IntermediateKey>::write(writer, key);
+        binary_codec<Value>::write(writer, value);
+    }
+
+    static void write_manifest_line(std::ostream &manifest, std::string const &fingerprint, std::string const &filename, entry_key const &key)
+    {
+        manifest << fingerprint << "\t" << filename << "\t" << key.second.first << "\t" << key.second.second << "\t" << escape_map_key(key.first) << "\n";
+    }
+
+    // called with the mutex held. the output of a segment that starts where
+    // 'key' does, with a different length, was written when the job was run
+    // with a different segment size. it is removed, as it covers part of
+    // the input of 'key' and of the segments that follow it
+    void remove_stale(entry_key const &key)
+    {
+        boost::system::error_code ec;
+        auto it = entries_.lower_bound(entry_key(key.first, datasource::segment_t(key.second.first, 0)));
+        while (it != entries_.end()  &&  it->first.first == key.first  &&  it->first.second.first == key.second.first)
+        {
+            if (it->second.filename == combined)
+                ++it;
+            else
+            {
+                boost::filesystem::remove(directory_ / it->second.filename, ec);
+                it = entries_.erase(it);
+            }
+        }
+    }
+
+    std::string const manifest_path(void) const
+    {
+        return (directory_ / "manifest").string();
+    }
+
+    // nothing is inserted from a file that does not hold whole records
+    template<typename Store>
+    bool const read_file(std::string const &filename, Store &store) const
+    {
+        std::ifstream file((directory_ / filename).string().c_str(), std::ios_base::binary);
+        if (!file.is_open())
+            return false;
+
+        std::vector<char> const buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        char const *const end = buffer.data() + buffer.size();
+
+        IntermediateKey key;
+        Value           value;
+        for (char const *data=buffer.data(); data!=end;)
+        {
+            data = binary_codec<IntermediateKey>::read(data, end, key);
+            data = data? binary_codec<Value>::read(data, end, value) : 0;
+            if (!data)
+                return false;
+        }
+
+        for (char const *data=buffer.data(); data!=end;)
+        {
+            data = binary_codec<IntermediateKey>::read(data, key);
+            data = binary_codec<Value>::read(data, value);
+            store.insert(key, value);
+        }
+        return true;
+    }
+
+    // the manifest is flushed after each line, so that the keys completed
+    // before a crash are known when the job is run again. the keys of an
+    // incremental job are combined at the end of the job
+    void record(std::string const &fingerprint, std::string const &filename, entry_key const &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        write_manifest_line(manifest_, fingerprint, filename, key);
+        manifest_.flush();
+
+        if (incremental_)
+        {
+            entry e;
+            e.fingerprint = fingerprint;
+            e.filename    = filename;
+            committed_.push_back(std::make_pair(key, e));
+        }
+    }
+
+  private:
+    boost::filesystem::path const  directory_;
+    bool const                     incremental_;
+    std::uintmax_t const           segment_size_;
+    size_t                         generation_;     // of the combined results, zero for none
+    bool                           use_combined_;   // the combined results are valid
+    std::map<entry_key, entry>     entries_;        // keys that were checkpointed when the job was constructed
+    std::vector<std::pair<entry_key, entry> > committed_;  // keys of an incremental job that have been run
+    std::ofstream                  manifest_;
+    std::mutex                     mutex_;
+};
+
+template<typename MapKey, typename IntermediateKey, typename Value>
+char const * const map_checkpoint<MapKey, IntermediateKey, Value>::combined = "-";
+
+// the checkpoint of a job whose map keys cannot be written as text, or whose
+// intermediate keys or values have no binary encoding. the job is compiled,
+// but cannot be given a checkpoint_directory
+template<typename MapKey, typename IntermediateKey, typename Value>
+class unsupported_checkpoint : noncopyable
+{
+  public:
+    unsupported_checkpoint(std::string const &directory, bool const /*incremental*/, std::uintmax_t const /*segment_size*/)
+    {
+        BOOST_THROW_EXCEPTION(std::runtime_error(
+            "Failed to checkpoint in " + directory + ": map keys must be written by operator<< "
+            "and intermediate keys and values must be trivially copyable or std::string"));
+    }
+
+    class writer : noncopyable
+    {
+      public:
+        writer(unsupported_checkpoint &/*checkpoint*/, MapKey const &/*key*/, datasource::segment_t const &/*segment*/)
+        {
+        }
+
+        template<typename T>
+        void write(T const &/*key*/, Value const &/*value*/)
+        {
+        }
+
+        void commit(void)
+        {
+        }
+    };
+
+    template<typename Store>
+    bool const restore(MapKey const &/*key*/, datasource::segment_t const &/*segment*/, Store &/*store*/) const
+    {
+        return false;
+    }
+
+    template<typename Store>
+    void load_combined(Store &/*store*/, size_t const /*num_partitions*/) const
+    {
+    }
+
+    template<typename Store, typename Combine>
+    void save_combined(Store &/*store*/, size_t const /*num_partitions*/, Combine /*combine*/)
+    {
+    }
+};
+
+template<typename MapKey, typename IntermediateKey, typename Value>
+struct checkpoint_type
+{
+    typedef
+    typename std::conditional<
+        is_ostreamable<MapKey>::value
+            &&  has_binary_codec<IntermediateKey>::value
+            &&  has_binary_codec<Value>::value,
+        map_checkpoint<MapKey, IntermediateKey, Value>,
+        unsupported_checkpoint<MapKey, IntermediateKey, Value> >::type
+    type;
+};
+
+}   // namespace detail
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
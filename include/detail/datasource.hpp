@@ -3,12 +3,19 @@
 
 #pragma once
 
+#include <algorithm>
+#include <list>
+#include <type_traits>
 #include <boost/iostreams/device/mapped_file.hpp>
 
 namespace mapreduce {
 
 namespace datasource {
 
+// a part of a map key's input that a datasource hands out; its offset and
+// length in the input
+typedef std::pair<std::uintmax_t, std::uintmax_t> segment_t;
+
 namespace detail {
 
 template<typename Key, typename Value>
@@ -20,6 +27,10 @@ class file_handler : ::mapreduce::detail::noncopyable
     bool const get_data(Key const &key, Value &value)   const;
     bool const setup_key(Key &/*key*/)                  const { return false; }
 
+    // the offset and length in its file of a segment that was returned by
+    // get_data()
+    segment_t const segment(Key const &/*key*/, Value const &/*value*/) const { return segment_t(); }
+
   private:
     mapreduce::specification const &specification_;
 
@@ -73,9 +84,9 @@ struct file_handler<
     std::map<std::string, std::shared_ptr<detail> >
     maps_t;
 
-    maps_t      maps;
-    std::mutex  mutex;
-    std::string current_file;
+    maps_t                 maps;
+    std::mutex             mutex;
+    std::list<std::string> open_files;  // mapped files that have segments left to process
 };
 
 template<>
@@ -101,10 +112,9 @@ file_handler<
 {
     // we need to hold the lock for the duration of this function
     std::lock_guard<std::mutex> l(data_->mutex);
-    data::maps_t::const_iterator it;
-    if (data_->current_file.empty())
+    data::maps_t::const_iterator it = data_->maps.find(key);
+    if (it == data_->maps.end())
     {
-        data_->current_file = key;
         it = data_->maps.insert(std::make_pair(key, std::make_shared<data::detail>())).first;
         auto &detail = it->second;
         auto &mmf = detail->mmf;
@@ -119,14 +129,14 @@ file_handler<
         detail->offset = std::min(specification_.max_file_segment_size, detail->size);
         value.first    = mmf.const_data();
         value.second   = detail->offset;
+        data_->open_files.push_back(key);
     }
     else
     {
-        assert(key == data_->current_file);
-        it = data_->maps.find(key);
-        assert(it != data_->maps.end());
+        // the key can be handed out by setup_key() to more than one map
+        // task before the segments are taken here, so the file may already
+        // have been exhausted, in which case the segment is empty
         auto &detail = it->second;
-
         std::uintmax_t const new_offset = std::min(detail->offset+specification_.max_file_segment_size, detail->size); 
         value.first  = detail->mmf.const_data() + detail->offset;
         value.second = new_offset - detail->offset;
@@ -135,7 +145,7 @@ file_handler<
 
     auto &detail = it->second;
     if (detail->offset == detail->size)
-        data_->current_file.clear();
+        data_->open_files.remove(key);
     else
     {
         // break on a line boundary
@@ -146,6 +156,8 @@ file_handler<
             ++value.second;
             ++detail->offset;
         }
+        if (detail->offset == detail->size)
+            data_->open_files.remove(key);
     }
 
     return true;
@@ -160,12 +172,98 @@ file_handler<
         std::uintmax_t> >::setup_key(std::string &key) const
 {
     std::lock_guard<std::mutex> l(data_->mutex);
-    if (data_->current_file.empty())
+    if (data_->open_files.empty())
         return false;
-    key = data_->current_file;
+    key = data_->open_files.front();
     return true;
 }
 
+template<>
+segment_t const
+file_handler<
+    std::string,
+    std::pair<
+        char const *,
+        std::uintmax_t> >::segment(
+            std::string const &key,
+            std::pair<char const *, std::uintmax_t> const &value) const
+{
+    std::lock_guard<std::mutex> l(data_->mutex);
+    data::maps_t::const_iterator it = data_->maps.find(key);
+    if (it == data_->maps.end())
+        return segment_t();
+    return segment_t(std::uintmax_t(value.first - it->second->mmf.const_data()), value.second);
+}
+
+// a datasource can optionally provide
+//     size_t const setup_keys(key_type *keys, size_t const count);
+// to claim up to 'count' map keys at once, typically with a single atomic
+// operation. the function must be safe to call concurrently without a lock,
+// and returns the number of keys written to 'keys', or zero when there are
+// no more keys
+template<typename Datasource, typename Key>
+class has_setup_keys
+{
+    template<typename T>
+    static auto test(int) -> decltype(std::declval<T &>().setup_keys(static_cast<Key *>(0), size_t()), std::true_type());
+
+    template<typename>
+    static std::false_type test(...);
+
+  public:
+    static bool const value = decltype(test<Datasource>(0))::value;
+};
+
+// a datasource can optionally provide
+//     segment_t const map_key_segment(key_type const &key, value_type const &value) const;
+// if it hands out the same map key more than once, with a different part of
+// the key's input each time, as directory_iterator does with the segments of
+// a memory mapped file. the part is identified by the value that get_data()
+// returned, so that a checkpoint can tell the parts apart. the length is
+// part of the identity, as a job that is run again with a different
+// max_file_segment_size has segments that start at the same offsets as
+// before but cover different input
+template<typename Datasource, typename MapTask>
+class has_map_key_segment
+{
+    template<typename T>
+    static auto test(int) -> decltype(
+        std::declval<T const &>().map_key_segment(
+            std::declval<typename MapTask::key_type const &>(),
+            std::declval<typename MapTask::value_type const &>()),
+        std::true_type());
+
+    template<typename>
+    static std::false_type test(...);
+
+  public:
+    static bool const value = decltype(test<Datasource>(0))::value;
+};
+
+// bring the data of a map key into memory before the map task that processes
+// it runs, so that the task does not wait for I/O. the default does nothing
+template<typename Value>
+inline void prefetch(Value &/*value*/)
+{
+}
+
+// open streams fill their buffer
+inline void prefetch(std::ifstream &value)
+{
+    if (value.is_open())
+        value.peek();
+}
+
+// memory mapped segments are faulted in by reading one byte of each page
+inline void prefetch(std::pair<char const *, std::uintmax_t> &value)
+{
+    std::uintmax_t const page_size = 4096;
+
+    char volatile touched = 0;
+    for (std::uintmax_t offset=0; offset<value.second; offset+=page_size)
+        touched += value.first[offset];
+}
+
 }   // namespace detail
 
 template<
@@ -207,6 +305,11 @@ class directory_iterator : mapreduce::detail::noncopyable
         return file_handler_.get_data(key, value);
     }
 
+    segment_t const map_key_segment(typename MapTask::key_type const &key, typename MapTask::value_type const &value) const
+    {
+        return file_handler_.segment(key, value);
+    }
+
   private:
     typedef boost::filesystem::path path_t;
     typedef boost::filesystem::directory_iterator it_dir_t;
@@ -217,6 +320,199 @@ class directory_iterator : mapreduce::detail::noncopyable
     FileHandler                     file_handler_;
 };
 
+// the map input of an iterative_job. the results of each iteration are
+// assigned to the datasource as the map keys and values of the next, and
+// are held in memory sorted by key; a key has one value, and input that gives
+// a key more than one is rejected when it is sorted. side data that is
+// the same for every iteration, such as the edges of a graph, is held in
+// the datasource rather than passed through the map and reduce tasks, and
+// map tasks reach it with runner.datasource().side_data()
+struct no_side_data
+{
+};
+
+template<typename MapTask, typename SideData=no_side_data>
+class iterative : mapreduce::detail::noncopyable
+{
+  public:
+    typedef typename MapTask::key_type   key_type;
+    typedef typename MapTask::value_type value_type;
+    typedef std::pair<key_type, value_type> record_t;
+    typedef typename std::vector<record_t>::const_iterator const_iterator;
+
+    iterative()
+      : next_(0)
+    {
+    }
+
+    explicit iterative(SideData const &side_data)
+      : side_data_(side_data),
+        next_(0)
+    {
+    }
+
+    // replace the map input with key/value pairs, such as the results of a
+    // job. the storage of the previous input is reused. throws if a key is
+    // given more than one value
+    template<typename It>
+    void assign(It first, It last)
+    {
+        records_.clear();
+        for (; first!=last; ++first)
+            records_.emplace_back(first->first, first->second);
+        rewind();
+    }
+
+    // add to the map input. the input is sorted by rewind(), which must be
+    // called before a job is run, as iterative_job does
+    void insert(key_type const &key, value_type const &value)
+    {
+        records_.emplace_back(key, value);
+    }
+
+    // start handing out the map keys again from the first. a map task is
+    // given the value of its key, so a key that has been given more than one
+    // value is an error
+    void rewind(void)
+    {
+        if (!std::is_sorted(records_.cbegin(), records_.cend(), key_less()))
+            std::stable_sort(records_.begin(), records_.end(), key_less());
+
+        auto const duplicate = std::adjacent_find(
+            records_.cbegin(),
+            records_.cend(),
+            [](record_t const &first, record_t const &second)
+            {
+                return !(first.first < second.first);
+            });
+        if (duplicate != records_.cend())
+            BOOST_THROW_EXCEPTION(std::runtime_error("iterative datasource has more than one value for a key"));
+
+        next_ = 0;
+    }
+
+    bool const setup_key(key_type &key)
+    {
+        size_t const index = next_++;
+        if (index >= records_.size())
+            return false;
+        key = records_[index].first;
+        return true;
+    }
+
+    size_t const setup_keys(key_type *keys, size_t const count)
+    {
+        size_t const first = next_.fetch_add(count);
+        size_t loop = 0;
+        for (; loop<count  &&  first + loop < records_.size(); ++loop)
+            keys[loop] = records_[first + loop].first;
+        return loop;
+    }
+
+    bool const get_data(key_type const &key, value_type &value) const
+    {
+        auto it = std::lower_bound(records_.cbegin(), records_.cend(), key, key_less());
+        if (it == records_.cend()  ||  it->first != key)
+            return false;
+        value = it->second;
+        return true;
+    }
+
+    // the current map input, in key order
+    const_iterator begin(void) const
+    {
+        return records_.cbegin();
+    }
+
+    const_iterator end(void) const
+    {
+        return records_.cend();
+    }
+
+    size_t const size(void) const
+    {
+        return records_.size();
+    }
+
+    SideData &side_data(void)
+    {
+        return side_data_;
+    }
+
+    SideData const &side_data(void) const
+    {
+        return side_data_;
+    }
+
+  private:
+    struct key_less
+    {
+        bool const operator()(record_t const &first, record_t const &second) const
+        {
+            return first.first < second.first;
+        }
+
+        bool const operator()(record_t const &record, key_type const &key) const
+        {
+            return record.first < key;
+        }
+    };
+
+  private:
+    std::vector<record_t> records_;
+    SideData              side_data_;
+    std::atomic<size_t>   next_;
+};
+
+// the map input of a job from the results of another job that has run,
+// passed in memory rather than written to files and read back. each map
+// key is a partition of the first job's results, and its value is the
+// key/value pairs of the partition, in key order, so the map task is a
+//     mapreduce::map_task<size_t, std::vector<Job::keyvalue_t> >
+// where the jobs have the same number of partitions and the map task
+// emits the keys that it is given, its output falls in the partition
+// that it came from, so merging the map tasks' stores moves no records
+// between partitions. the first job's results must not be changed while
+// the datasource is in use
+template<typename MapTask, typename Job>
+class job_results : mapreduce::detail::noncopyable
+{
+  public:
+    explicit job_results(Job const &job)
+      : job_(job),
+        next_(0)
+    {
+    }
+
+    bool const setup_key(typename MapTask::key_type &key)
+    {
+        return setup_keys(&key, 1) == 1;
+    }
+
+    size_t const setup_keys(typename MapTask::key_type *keys, size_t const count)
+    {
+        size_t const first = next_.fetch_add(count);
+        size_t loop = 0;
+        for (; loop<count  &&  first + loop < job_.number_of_partitions(); ++loop)
+            keys[loop] = first + loop;
+        return loop;
+    }
+
+    bool const get_data(typename MapTask::key_type const &partition, typename MapTask::value_type &value) const
+    {
+        if (partition >= job_.number_of_partitions())
+            return false;
+
+        value.clear();
+        job_.copy_results(partition, std::back_inserter(value));
+        return true;
+    }
+
+  private:
+    Job const           &job_;
+    std::atomic<size_t>  next_;
+};
+
 }   // namespace datasource
 
 }   // namespace mapreduce 
@@ -2,7 +2,15 @@
 // https://github.com/cdmh/mapreduce
 
 #include "hash_partitioner.hpp"
+#include "arena_allocator.hpp"
+#include "intermediates/value_list.hpp"
+#include "intermediates/store_helpers.hpp"
 #include "intermediates/in_memory.hpp"
+#include "intermediates/hashed_in_memory.hpp"
+#include "intermediates/aggregating_in_memory.hpp"
+#include "intermediates/hybrid.hpp"
+#include "intermediates/flat_buffer.hpp"
+#include "intermediates/concurrent_in_memory.hpp"
 #include "intermediates/local_disk.hpp"
 
 // Permission is hereby granted, free of charge, to any person obtaining a copy
@@ -0,0 +1,243 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+
+namespace mapreduce {
+
+namespace intermediates {
+
+// an in memory intermediate store for jobs whose reduce task folds the
+// values of a key with an associative operation, such as wordcount's sum.
+// each key holds a single value, and FoldFn(value, other) is applied as a
+// value is inserted, and again when the stores of two map tasks are merged,
+// so a store holds a value for each distinct key rather than for each emit,
+// and no combiner is needed. a reduce task is given the folded value of a
+// key as a range of one value. the final results are folded in the same
+// way, so a reduce task must not emit a key more than once
+template<
+    typename MapTask,
+    typename ReduceTask,
+    typename FoldFn          = std::plus<typename ReduceTask::value_type>,
+    typename KeyType         = typename ReduceTask::key_type,
+    typename PartitionFn     = mapreduce::hash_partitioner,
+    typename KeyCompare      = std::less<typename ReduceTask::key_type>,
+    typename StoreResultType = reduce_null_output<MapTask, ReduceTask>
+>
+class aggregating_in_memory : detail::noncopyable
+{
+  public:
+    typedef KeyType                         key_type;
+    typedef typename ReduceTask::value_type value_type;
+    typedef MapTask                         map_task_type;
+    typedef ReduceTask                      reduce_task_type;
+    typedef StoreResultType                 store_result_type;
+
+  private:
+    typedef detail::intermediate_key_compare<KeyCompare>  key_compare_t;
+    typedef std::map<KeyType, value_type, key_compare_t>  map_t;
+    typedef std::vector<map_t>                            intermediates_t;
+    typedef detail::intermediate_key_partitioner<KeyType, PartitionFn> partitioner_t;
+
+  public:
+    typedef
+    std::pair<KeyType, value_type>
+    keyvalue_t;
+
+    // each partition's map holds one folded value for each of its keys; the
+    // partitions are iterated together by sorting a copy of their results
+    typedef
+    detail::sorted_result_iterator<keyvalue_t, KeyCompare>
+    const_result_iterator;
+
+    explicit aggregating_in_memory(size_t const num_partitions=1)
+      : num_partitions_(num_partitions),
+        partitioner_(num_partitions)
+    {
+        intermediates_.resize(num_partitions_);
+    }
+
+    const_result_iterator begin_results(void) const
+    {
+        return const_result_iterator(*this, num_partitions_);
+    }
+
+    const_result_iterator end_results(void) const
+    {
+        return const_result_iterator();
+    }
+
+    void swap(aggregating_in_memory &other)
+    {
+        using std::swap;
+        swap(intermediates_, other.intermediates_);
+    }
+
+    void run_intermediate_results_shuffle(size_t const /*partition*/)
+    {
+    }
+
+    // append the final results of a partition that has been reduced to
+    // 'out', in key order
+    template<typename OutputIterator>
+    void copy_results(size_t const partition, OutputIterator out) const
+    {
+        std::copy(intermediates_[partition].begin(), intermediates_[partition].end(), out);
+    }
+
+    // discard all of the intermediate and final results
+    void clear(void)
+    {
+        for (auto &map : intermediates_)
+            map.clear();
+    }
+
+    // the number of keys in a partition; its reduce is called once for each
+    // of them with a single, folded, value
+    std::uintmax_t const partition_size(size_t const partition) const
+    {
+        return intermediates_[partition].size();
+    }
+
+    template<typename Callback>
+    void reduce(size_t const partition, Callback &callback)
+    {
+        map_t map;
+        using std::swap;
+        swap(map, intermediates_[partition]);
+
+        for (auto const &result : map)
+            callback(result.first, &result.second, &result.second + 1);
+    }
+
+    // the values are moved out of the other store, so merging the same
+    // store again has no effect
+    void merge_from(size_t partition, aggregating_in_memory &other)
+    {
+        map_t &map       = intermediates_[partition];
+        map_t &other_map = other.intermediates_[partition];
+
+        if (map.empty())
+        {
+            using std::swap;
+            swap(map, other_map);
+            return;
+        }
+
+        for (auto const &result : other_map)
+            fold(map, result.first, result.second);
+        other_map.clear();
+    }
+
+    void merge_from(aggregating_in_memory &other)
+    {
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+            merge_from(partition, other);
+    }
+
+    // receive intermediate result. the value of a key emitted as a pointer
+    // and a length is folded into that of the key in the map without the
+    // key being converted, which happens only when a new key is inserted
+    template<typename T>
+    bool const insert(T const &key, value_type const &value)
+    {
+        return insert_key(key, value, std::integral_constant<bool, key_compare_t::template compares<T>::value>());
+    }
+
+    bool const insert(key_type const &key, value_type const &value)
+    {
+        fold(intermediates_[partitioner_(key)], key, value);
+        return true;
+    }
+
+    // receive final result
+    template<typename StoreResult>
+    bool const insert(typename reduce_task_type::key_type const &key,
+                      value_type                          const &value,
+                      StoreResult                               &store_result)
+    {
+        return store_result(key, value)  &&  insert(key, value);
+    }
+
+    // the values are folded as they are inserted, so a combiner has only
+    // the folded value of each key to combine
+    template<typename FnObj>
+    void combine(FnObj &fn_obj)
+    {
+        intermediates_t intermediates;
+        intermediates.resize(num_partitions_);
+        using std::swap;
+        swap(intermediates_, intermediates);
+
+        for (auto const &map : intermediates)
+        {
+            for (auto const &kv : map)
+            {
+                fn_obj.start(kv.first);
+                fn_obj(kv.second);
+                fn_obj.finish(kv.first, *this);
+            }
+        }
+    }
+
+    void combine(null_combiner &)
+    {
+    }
+
+  private:
+    template<typename T>
+    bool const insert_key(T const &key, value_type const &value, std::true_type)
+    {
+        fold(intermediates_[partitioner_(key)], key, value);
+        return true;
+    }
+
+    template<typename T>
+    bool const insert_key(T const &key, value_type const &value, std::false_type)
+    {
+        return insert(make_intermediate_key<key_type>(key), value);
+    }
+
+    // fold 'value' into the value of a key, which is inserted with 'value'
+    // if it is not in the map
+    template<typename T>
+    void fold(map_t &map, T const &key, value_type const &value)
+    {
+        auto it = map.lower_bound(key);
+        if (it == map.end()  ||  map.key_comp()(key, it->first))
+            map.insert(it, std::make_pair(detail::intermediate_key_maker<key_type>()(key), value));
+        else
+            it->second = fold_(it->second, value);
+    }
+
+  private:
+    size_t const    num_partitions_;
+    intermediates_t intermediates_;
+    partitioner_t   partitioner_;
+    FoldFn          fold_;
+};
+
+}   // namespace intermediates
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
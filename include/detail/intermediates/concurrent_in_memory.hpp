@@ -0,0 +1,399 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+namespace mapreduce {
+
+namespace intermediates {
+
+// an in memory intermediate store that the map tasks of a job insert into
+// directly, from all of their threads, rather than each filling a store of
+// its own to be merged into the job's. each partition is split into
+// stripes by the hash of the key, and each stripe is an open addressing
+// hash table, as in hashed_in_memory, with a lock of its own, so threads
+// only contend when they insert keys of the same stripe at the same time.
+// the job gives its map tasks stores from map_task_store(), which share
+// its tables, so there is nothing to merge when a map task finishes, and
+// no combiner is run on them. if FoldFn is not void, each key holds a
+// single value, and FoldFn(value, other) is applied as a value is
+// inserted, under the stripe's lock, as aggregating_in_memory does; a
+// reduce task is then given the folded value of a key as a range of one
+// value, and must not emit a key more than once. keys are sorted with
+// KeyCompare when a partition is reduced, unless OrderedReduce is false.
+// a job whose map tasks emit the same few keys, such as prime, is better
+// served by a store per map task, as its threads would all contend for
+// the same stripes
+template<
+    typename MapTask,
+    typename ReduceTask,
+    typename KeyType         = typename ReduceTask::key_type,
+    typename PartitionFn     = mapreduce::hash_partitioner,
+    typename KeyCompare      = std::less<typename ReduceTask::key_type>,
+    typename StoreResultType = reduce_null_output<MapTask, ReduceTask>,
+    bool     OrderedReduce   = true,
+    typename FoldFn          = void
+>
+class concurrent_in_memory : detail::noncopyable
+{
+  public:
+    typedef KeyType                         key_type;
+    typedef typename ReduceTask::value_type value_type;
+    typedef MapTask                         map_task_type;
+    typedef ReduceTask                      reduce_task_type;
+    typedef StoreResultType                 store_result_type;
+
+  private:
+    typedef
+    typename std::conditional<
+        std::is_void<FoldFn>::value,
+        detail::value_list<value_type>,
+        value_type>::type
+    values_t;
+
+    typedef detail::flat_hash_table<KeyType, value_type, values_t> table_t;
+    typedef typename table_t::entry                                entry_t;
+    typedef detail::intermediate_key_partitioner<KeyType, PartitionFn> partitioner_t;
+
+    enum { stripes_per_partition = 64 };
+
+    struct stripe_t
+    {
+        std::mutex mutex;
+        table_t    table;
+    };
+
+    // the stripes of every partition, shared by the job's store and the
+    // stores that it gives to its map tasks
+    struct tables_t : detail::noncopyable
+    {
+        explicit tables_t(size_t const num_partitions)
+          : stripes(new stripe_t[num_partitions * stripes_per_partition])
+        {
+        }
+
+        std::unique_ptr<stripe_t[]> stripes;
+    };
+
+  public:
+    typedef
+    std::pair<KeyType, value_type>
+    keyvalue_t;
+
+    // the results are spread over the stripes of each partition, so they
+    // are gathered, each partition in key order, and sorted to be iterated
+    typedef
+    detail::sorted_result_iterator<keyvalue_t, KeyCompare>
+    const_result_iterator;
+
+    explicit concurrent_in_memory(size_t const num_partitions=1)
+      : num_partitions_(num_partitions),
+        tables_(std::make_shared<tables_t>(num_partitions)),
+        map_task_(false),
+        partitioner_(num_partitions)
+    {
+    }
+
+    // a store for a map task, which inserts into this store's tables
+    std::unique_ptr<concurrent_in_memory> map_task_store(void)
+    {
+        return std::unique_ptr<concurrent_in_memory>(new concurrent_in_memory(num_partitions_, tables_));
+    }
+
+    const_result_iterator begin_results(void) const
+    {
+        return const_result_iterator(*this, num_partitions_);
+    }
+
+    const_result_iterator end_results(void) const
+    {
+        return const_result_iterator();
+    }
+
+    void swap(concurrent_in_memory &other)
+    {
+        using std::swap;
+        swap(tables_, other.tables_);
+    }
+
+    void run_intermediate_results_shuffle(size_t const /*partition*/)
+    {
+    }
+
+    // append the final results of a partition that has been reduced to
+    // 'out', in key order
+    template<typename OutputIterator>
+    void copy_results(size_t const partition, OutputIterator out) const
+    {
+        for (auto const *e : ordered_entries(partition, std::true_type()))
+        {
+            for (auto it=first_value(e->values); it!=last_value(e->values); ++it)
+                *out++ = keyvalue_t(e->key, *it);
+        }
+    }
+
+    // discard all of the intermediate and final results
+    void clear(void)
+    {
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+        {
+            for (size_t loop=0; loop<stripes_per_partition; ++loop)
+            {
+                stripe_t &s = stripe(partition, loop);
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.table.clear();
+            }
+        }
+    }
+
+    // the number of values held by the stripes of a partition, counting a
+    // folded value as one; each stripe is locked while it is counted
+    std::uintmax_t const partition_size(size_t const partition) const
+    {
+        std::uintmax_t size = 0;
+        for (size_t loop=0; loop<stripes_per_partition; ++loop)
+        {
+            stripe_t &s = stripe(partition, loop);
+            std::lock_guard<std::mutex> lock(s.mutex);
+            for (auto const &e : s.table)
+                size += count_values(e.values);
+        }
+        return size;
+    }
+
+    template<typename Callback>
+    void reduce(size_t const partition, Callback &callback)
+    {
+        std::vector<table_t> tables(stripes_per_partition);
+        for (size_t loop=0; loop<stripes_per_partition; ++loop)
+        {
+            stripe_t &s = stripe(partition, loop);
+            std::lock_guard<std::mutex> lock(s.mutex);
+            tables[loop].swap(s.table);
+        }
+
+        std::vector<entry_t const *> entries;
+        for (auto const &table : tables)
+        {
+            for (auto const &e : table)
+                entries.push_back(&e);
+        }
+        detail::order_entries<KeyCompare>(entries, std::integral_constant<bool, OrderedReduce>());
+
+        for (auto const *e : entries)
+            callback(e->key, first_value(e->values), last_value(e->values));
+    }
+
+    // the values are moved out of the other store, so merging the same
+    // store again has no effect. a map task's store shares this store's
+    // tables, so there is nothing to merge from it
+    void merge_from(size_t partition, concurrent_in_memory &other)
+    {
+        if (other.tables_ == tables_)
+            return;
+
+        for (size_t loop=0; loop<stripes_per_partition; ++loop)
+        {
+            table_t table;
+            {
+                stripe_t &s = other.stripe(partition, loop);
+                std::lock_guard<std::mutex> lock(s.mutex);
+                table.swap(s.table);
+            }
+
+            // a key is in the same stripe of both stores, as it has the same hash
+            stripe_t &s = stripe(partition, loop);
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (s.table.empty())
+            {
+                s.table.swap(table);
+                continue;
+            }
+
+            for (auto &e : table)
+            {
+                size_t const size = s.table.size();
+                auto &to = s.table.find_or_insert(e.hash, e.key, detail::intermediate_key_maker<key_type>());
+                merge_values(to.values, e.values, s.table.size() != size);
+            }
+        }
+    }
+
+    void merge_from(concurrent_in_memory &other)
+    {
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+            merge_from(partition, other);
+    }
+
+    // receive intermediate result, from any thread. only the stripe that the
+    // key hashes to is locked while the value is added, or folded into the
+    // value of the key
+    template<typename T>
+    bool const insert(T const &key, typename reduce_task_type::value_type const &value)
+    {
+        std::size_t   const hash  = detail::intermediate_key_hash(key);
+        std::uint64_t const mixed = detail::mix_hash(hash);
+
+        stripe_t &s = stripe(partitioner_(hash, key), stripe_of(mixed));
+        std::lock_guard<std::mutex> lock(s.mutex);
+        size_t const size = s.table.size();
+        auto &e = s.table.find_or_insert(mixed, key, detail::intermediate_key_maker<key_type>());
+        add_value(e.values, value, s.table.size() != size);
+        return true;
+    }
+
+    // receive final result
+    template<typename StoreResult>
+    bool const insert(typename reduce_task_type::key_type   const &key,
+                      typename reduce_task_type::value_type const &value,
+                      StoreResult &store_result)
+    {
+        return store_result(key, value)  &&  insert(key, value);
+    }
+
+    // the values of a map task's store are already in the job's tables,
+    // alongside those of every other map task, so they are not combined
+    template<typename FnObj>
+    void combine(FnObj &fn_obj)
+    {
+        if (map_task_)
+            return;
+
+        std::shared_ptr<tables_t> tables(std::make_shared<tables_t>(num_partitions_));
+        using std::swap;
+        swap(tables_, tables);
+
+        for (size_t loop=0; loop<num_partitions_ * stripes_per_partition; ++loop)
+        {
+            for (auto const &e : tables->stripes[loop].table)
+            {
+                fn_obj.start(e.key);
+                for (auto it=first_value(e.values); it!=last_value(e.values); ++it)
+                    fn_obj(*it);
+                fn_obj.finish(e.key, *this);
+            }
+        }
+    }
+
+    void combine(null_combiner &)
+    {
+    }
+
+  private:
+    concurrent_in_memory(size_t const num_partitions, std::shared_ptr<tables_t> const &tables)
+      : num_partitions_(num_partitions),
+        tables_(tables),
+        map_task_(true),
+        partitioner_(num_partitions)
+    {
+    }
+
+    stripe_t &stripe(size_t const partition, size_t const index) const
+    {
+        return tables_->stripes[partition * stripes_per_partition + index];
+    }
+
+    // the stripe of a key is taken from bits of the mixed hash that the
+    // table of the stripe does not use for its slots or its tags
+    static size_t const stripe_of(std::uint64_t const mixed)
+    {
+        return size_t(mixed >> 50) % stripes_per_partition;
+    }
+
+    // the values of a key are a list of values, or a single folded value
+    static void add_value(detail::value_list<value_type> &values, value_type const &value, bool const /*inserted*/)
+    {
+        values.push_back(value);
+    }
+
+    static void add_value(value_type &folded, value_type const &value, bool const inserted)
+    {
+        folded = inserted? value : FoldFn()(folded, value);
+    }
+
+    static void merge_values(detail::value_list<value_type> &values, detail::value_list<value_type> &other, bool const /*inserted*/)
+    {
+        values.splice(other);
+    }
+
+    static void merge_values(value_type &folded, value_type &other, bool const inserted)
+    {
+        add_value(folded, other, inserted);
+    }
+
+    static typename detail::value_list<value_type>::const_iterator first_value(detail::value_list<value_type> const &values)
+    {
+        return values.cbegin();
+    }
+
+    static typename detail::value_list<value_type>::const_iterator last_value(detail::value_list<value_type> const &values)
+    {
+        return values.cend();
+    }
+
+    static value_type const *first_value(value_type const &folded)
+    {
+        return &folded;
+    }
+
+    static value_type const *last_value(value_type const &folded)
+    {
+        return &folded + 1;
+    }
+
+    static std::uintmax_t const count_values(detail::value_list<value_type> const &values)
+    {
+        return values.size();
+    }
+
+    static std::uintmax_t const count_values(value_type const &/*folded*/)
+    {
+        return 1;
+    }
+
+    std::vector<entry_t const *> ordered_entries(size_t const partition, std::true_type) const
+    {
+        std::vector<entry_t const *> entries;
+        for (size_t loop=0; loop<stripes_per_partition; ++loop)
+        {
+            for (auto const &e : stripe(partition, loop).table)
+                entries.push_back(&e);
+        }
+        detail::order_entries<KeyCompare>(entries, std::true_type());
+        return entries;
+    }
+
+  private:
+    size_t const              num_partitions_;
+    std::shared_ptr<tables_t> tables_;
+    bool const                map_task_;    // the store was given to a map task, and shares the job's tables
+    partitioner_t             partitioner_;
+};
+
+}   // namespace intermediates
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,464 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+namespace mapreduce {
+
+namespace detail {
+
+// a range of records is sorted if it is small enough to be sorted by
+// comparison, or if its records share a hash
+template<typename Record>
+bool const sort_by_hash_without_radix(Record *first, size_t const size)
+{
+    if (size <= 64)
+    {
+        std::stable_sort(first, first + size, [](Record const &a, Record const &b) { return a.hash < b.hash; });
+        return true;
+    }
+
+    std::uint32_t const hash = first->hash;
+    return std::all_of(first, first + size, [hash](Record const &record) { return record.hash == hash; });
+}
+
+// a pass of a most significant digit radix sort of 'size' records, moving
+// them from 'from' to 'to' by the byte of their hash at 'shift', and sorting
+// each bucket by the next byte, so that the sorted records are left in
+// 'from', or in 'to' if 'into' is true
+template<typename Record>
+void radix_sort_by_hash(Record *from, Record *to, size_t const size, bool const into, unsigned const shift)
+{
+    size_t counts[256] = {};
+    for (auto it=from; it!=from+size; ++it)
+        ++counts[(it->hash >> shift) & 0xff];
+
+    size_t offsets[256];
+    size_t offset = 0;
+    for (unsigned bucket=0; bucket<256; ++bucket)
+    {
+        offsets[bucket] = offset;
+        offset += counts[bucket];
+    }
+
+    for (auto it=from; it!=from+size; ++it)
+        to[offsets[(it->hash >> shift) & 0xff]++] = std::move(*it);
+
+    offset = 0;
+    for (unsigned bucket=0; bucket<256; ++bucket)
+    {
+        size_t const count = counts[bucket];
+        if (shift != 0  &&  !sort_by_hash_without_radix(to + offset, count))
+            radix_sort_by_hash(to + offset, from + offset, count, !into, shift - 8);
+        else if (!into)
+            std::move(to + offset, to + offset + count, from + offset);
+        offset += count;
+    }
+}
+
+// stable sort records by their 32 bit hash. a radix sort, a byte at a time
+// from the most significant, that stops dividing a range once its records
+// share a hash, so that the records of few keys, such as those of prime's
+// partitions, are sorted in one or two passes. the records are moved to
+// and from 'scratch' with each pass
+template<typename Record>
+void radix_sort_by_hash(std::vector<Record> &records, std::vector<Record> &scratch)
+{
+    if (!sort_by_hash_without_radix(records.data(), records.size()))
+    {
+        scratch.resize(records.size());
+        radix_sort_by_hash(records.data(), scratch.data(), records.size(), false, 24);
+    }
+}
+
+}   // namespace detail
+
+namespace intermediates {
+
+// an in memory intermediate store that groups keys by sorting rather than
+// by looking them up. an emitted value is appended, with its key and 32
+// bits of the key's hash, to a flat buffer of the map task's store; merging
+// a map task's store into the job's moves its buffers across whole. the
+// shuffle of a partition radix sorts its records by their hash, and copies
+// the values of each key together, so that a reduce task is given the
+// values of a key where they lie. keys that share a hash are ordered with
+// KeyCompare. the keys of a partition are reduced in
+// KeyCompare order, or in the order of their hashes if OrderedReduce is
+// false. final results are appended to the groups of their partition as
+// they are emitted.
+//
+// this suits jobs with many distinct keys that are cheap to copy, where a
+// lookup for every emit costs more than a sort of the partition. a job with
+// few keys, such as prime, is faster with in_memory or hashed_in_memory,
+// which group its values as they are emitted; the shuffle here makes another
+// pass over every value. a key emitted as a pointer and a length is
+// converted to key_type for every value
+template<
+    typename MapTask,
+    typename ReduceTask,
+    typename KeyType         = typename ReduceTask::key_type,
+    typename PartitionFn     = mapreduce::hash_partitioner,
+    typename KeyCompare      = std::less<typename ReduceTask::key_type>,
+    typename StoreResultType = reduce_null_output<MapTask, ReduceTask>,
+    bool     OrderedReduce   = true
+>
+class flat_buffer : detail::noncopyable
+{
+  public:
+    typedef KeyType                         key_type;
+    typedef typename ReduceTask::value_type value_type;
+    typedef MapTask                         map_task_type;
+    typedef ReduceTask                      reduce_task_type;
+    typedef StoreResultType                 store_result_type;
+
+  private:
+    struct record
+    {
+        record()
+          : hash(0)
+        {
+        }
+
+        record(std::uint32_t const h, key_type k, value_type const &v)
+          : hash(h),
+            key(std::move(k)),
+            value(v)
+        {
+        }
+
+        std::uint32_t hash;     // high bits of the mixed hash of the key
+        key_type      key;
+        value_type    value;
+    };
+    typedef std::vector<record> buffer_t;
+
+    // the values of a key, which are values[first, last) of its partition
+    struct group
+    {
+        key_type key;
+        size_t   first;
+        size_t   last;
+    };
+
+    struct partition_t
+    {
+        std::vector<buffer_t>   buffers;    // records emitted and merged since the shuffle; the first is appended to
+        std::vector<group>      groups;     // keys grouped by the shuffle
+        std::vector<value_type> values;     // values of the grouped keys
+    };
+    typedef std::vector<partition_t> intermediates_t;
+    typedef detail::intermediate_key_partitioner<KeyType, PartitionFn> partitioner_t;
+
+  public:
+    typedef
+    std::pair<KeyType, value_type>
+    keyvalue_t;
+
+    // the final results of a partition are records in its buffers, in the
+    // order that they were inserted, so they are sorted to be iterated
+    typedef
+    detail::sorted_result_iterator<keyvalue_t, KeyCompare>
+    const_result_iterator;
+
+    explicit flat_buffer(size_t const num_partitions=1)
+      : num_partitions_(num_partitions),
+        partitioner_(num_partitions)
+    {
+        intermediates_.resize(num_partitions_);
+    }
+
+    const_result_iterator begin_results(void) const
+    {
+        return const_result_iterator(*this, num_partitions_);
+    }
+
+    const_result_iterator end_results(void) const
+    {
+        return const_result_iterator();
+    }
+
+    void swap(flat_buffer &other)
+    {
+        using std::swap;
+        swap(intermediates_, other.intermediates_);
+    }
+
+    void run_intermediate_results_shuffle(size_t const partition)
+    {
+        group_records(intermediates_[partition]);
+    }
+
+    // append the final results of a partition that has been reduced to
+    // 'out', in key order
+    template<typename OutputIterator>
+    void copy_results(size_t const partition, OutputIterator out) const
+    {
+        partition_t const &p = intermediates_[partition];
+        if (p.buffers.empty())
+        {
+            // the groups of final results are copied out in key order,
+            // which is the order they were emitted in unless a reduce task
+            // emitted a key other than its own
+            KeyCompare compare;
+            std::vector<group const *> groups;
+            for (auto const &g : p.groups)
+                groups.push_back(&g);
+            std::stable_sort(groups.begin(), groups.end(), [&compare](group const *a, group const *b) { return compare(a->key, b->key); });
+
+            for (auto const g : groups)
+            {
+                for (size_t loop=g->first; loop<g->last; ++loop)
+                    *out++ = keyvalue_t(g->key, p.values[loop]);
+            }
+            return;
+        }
+
+        std::vector<keyvalue_t> results;
+        append_results(p, results);
+        sort_results(results);
+        std::copy(results.begin(), results.end(), out);
+    }
+
+    // discard all of the intermediate and final results
+    void clear(void)
+    {
+        for (auto &p : intermediates_)
+            p = partition_t();
+    }
+
+    // the number of values that a partition has grouped by key, and of the
+    // records in its buffers that are yet to be grouped
+    std::uintmax_t const partition_size(size_t const partition) const
+    {
+        partition_t const &p = intermediates_[partition];
+        std::uintmax_t size = p.values.size();
+        for (auto const &buffer : p.buffers)
+            size += buffer.size();
+        return size;
+    }
+
+    // a partition that has not been shuffled, as by a schedule policy that
+    // reduces without a shuffle, is grouped first
+    template<typename Callback>
+    void reduce(size_t const partition, Callback &callback)
+    {
+        partition_t p;
+        using std::swap;
+        swap(p, intermediates_[partition]);
+        group_records(p);
+
+        for (auto const &g : p.groups)
+            callback(g.key, p.values.data() + g.first, p.values.data() + g.last);
+    }
+
+    // the buffers are moved out of the other store, so merging the same
+    // store again has no effect
+    void merge_from(size_t partition, flat_buffer &other)
+    {
+        auto &buffers       = intermediates_[partition].buffers;
+        auto &other_buffers = other.intermediates_[partition].buffers;
+        for (auto &buffer : other_buffers)
+        {
+            if (!buffer.empty())
+                buffers.push_back(std::move(buffer));
+        }
+        other_buffers.clear();
+    }
+
+    void merge_from(flat_buffer &other)
+    {
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+            merge_from(partition, other);
+    }
+
+    // receive intermediate result
+    template<typename T>
+    bool const insert(T const &key, value_type const &value)
+    {
+        std::size_t const hash = detail::intermediate_key_hash(key);
+        auto &buffers = intermediates_[partitioner_(hash, key)].buffers;
+        if (buffers.empty())
+            buffers.resize(1);
+        buffers.front().push_back(record(std::uint32_t(detail::mix_hash(hash) >> 32), detail::intermediate_key_maker<key_type>()(key), value));
+        return true;
+    }
+
+    // receive final result. a value is appended to the group of the last
+    // result of its partition if it has the same key, as it does when a
+    // reduce task emits more than one value for its key
+    template<typename StoreResult>
+    bool const insert(typename reduce_task_type::key_type const &key,
+                      value_type                          const &value,
+                      StoreResult                               &store_result)
+    {
+        if (!store_result(key, value))
+            return false;
+
+        partition_t &p = intermediates_[partitioner_(key)];
+        if (p.groups.empty()  ||  p.groups.back().last != p.values.size()  ||  !equivalent(p.groups.back().key, key))
+        {
+            group g;
+            g.key   = key;
+            g.first = p.values.size();
+            p.groups.push_back(std::move(g));
+        }
+        p.values.push_back(value);
+        p.groups.back().last = p.values.size();
+        return true;
+    }
+
+    template<typename FnObj>
+    void combine(FnObj &fn_obj)
+    {
+        intermediates_t intermediates;
+        intermediates.resize(num_partitions_);
+        using std::swap;
+        swap(intermediates_, intermediates);
+
+        for (auto &p : intermediates)
+        {
+            group_records(p);
+            for (auto const &g : p.groups)
+            {
+                fn_obj.start(g.key);
+                for (size_t loop=g.first; loop<g.last; ++loop)
+                    fn_obj(p.values[loop]);
+                fn_obj.finish(g.key, *this);
+            }
+        }
+    }
+
+    void combine(null_combiner &)
+    {
+    }
+
+  private:
+    // group the records of a partition's buffers by key, appending the
+    // keys to its groups and their values to its values
+    static void group_records(partition_t &p)
+    {
+        buffer_t records;
+        if (p.buffers.size() == 1)
+            records.swap(p.buffers.front());
+        else
+        {
+            size_t size = 0;
+            for (auto const &buffer : p.buffers)
+                size += buffer.size();
+            records.reserve(size);
+            for (auto &buffer : p.buffers)
+                std::move(buffer.begin(), buffer.end(), std::back_inserter(records));
+        }
+        p.buffers.clear();
+        if (records.empty())
+            return;
+
+        {
+            buffer_t scratch;
+            detail::radix_sort_by_hash(records, scratch);
+        }
+
+        KeyCompare compare;
+
+        size_t const first_group = p.groups.size();
+        p.values.reserve(p.values.size() + records.size());
+        for (auto first=records.begin(); first!=records.end(); )
+        {
+            auto last = first + 1;
+            bool same = true;
+            for (; last!=records.end()  &&  last->hash == first->hash; ++last)
+                same = same  &&  equivalent(first->key, last->key);
+
+            // different keys that share a hash are ordered by key, which
+            // keeps the values of each key in order
+            if (!same)
+                std::stable_sort(first, last, [&compare](record const &a, record const &b) { return compare(a.key, b.key); });
+
+            while (first != last)
+            {
+                key_type &key = first->key;
+                group g;
+                g.first = p.values.size();
+                for (; first!=last  &&  (same  ||  equivalent(key, first->key)); ++first)
+                    p.values.push_back(first->value);
+                g.last = p.values.size();
+                g.key  = std::move(key);
+                p.groups.push_back(std::move(g));
+            }
+        }
+
+        order_groups(p.groups.begin() + first_group, p.groups.end(), std::integral_constant<bool, OrderedReduce>());
+    }
+
+    static bool const equivalent(key_type const &first, key_type const &second)
+    {
+        KeyCompare compare;
+        return !compare(first, second)  &&  !compare(second, first);
+    }
+
+    template<typename It>
+    static void order_groups(It first, It last, std::true_type)
+    {
+        KeyCompare compare;
+        std::sort(first, last, [&compare](group const &a, group const &b) { return compare(a.key, b.key); });
+    }
+
+    template<typename It>
+    static void order_groups(It, It, std::false_type)
+    {
+    }
+
+    // the keys and values of a partition, grouped or not
+    static void append_results(partition_t const &p, std::vector<keyvalue_t> &results)
+    {
+        for (auto const &g : p.groups)
+        {
+            for (size_t loop=g.first; loop<g.last; ++loop)
+                results.push_back(keyvalue_t(g.key, p.values[loop]));
+        }
+        for (auto const &buffer : p.buffers)
+        {
+            for (auto const &r : buffer)
+                results.push_back(keyvalue_t(r.key, r.value));
+        }
+    }
+
+    static void sort_results(std::vector<keyvalue_t> &results)
+    {
+        KeyCompare compare;
+        std::stable_sort(
+            results.begin(),
+            results.end(),
+            [&compare](keyvalue_t const &first, keyvalue_t const &second) { return compare(first.first, second.first); });
+    }
+
+  private:
+    size_t const    num_partitions_;
+    intermediates_t intermediates_;
+    partitioner_t   partitioner_;
+};
+
+}   // namespace intermediates
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
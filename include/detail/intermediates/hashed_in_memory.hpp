@@ -0,0 +1,388 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <boost/functional/hash.hpp>
+
+namespace mapreduce {
+
+namespace detail {
+
+// spread the bits of a hash, as a hash that is also used to partition keys
+// is the same modulo the number of partitions for every key in a partition
+inline std::uint64_t const mix_hash(std::uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// an open addressing hash table of keys, each with a list of values, or
+// with a Values of another type, such as a single folded value. the
+// entries are held contiguously in the order that they were inserted, and
+// the table is an array of one byte tags, seven bits of the hash of the key
+// in each slot that is in use, with an array of indices into the entries.
+// a lookup probes the tags in sequence from the slot given by the hash,
+// comparing a key only where the tag matches. entries are never removed
+// individually, so there are no tombstones
+template<typename Key, typename Value, typename Values=value_list<Value> >
+class flat_hash_table
+{
+  public:
+    struct entry
+    {
+        entry(std::uint64_t const h, Key const &k)
+          : hash(h),
+            key(k),
+            values()
+        {
+        }
+
+        std::uint64_t hash;     // mixed hash of the key
+        Key           key;
+        Values        values;
+    };
+
+    typedef typename std::vector<entry>::iterator       iterator;
+    typedef typename std::vector<entry>::const_iterator const_iterator;
+
+    flat_hash_table()
+      : mask_(0)
+    {
+    }
+
+    // the entry of a key that hashes to 'hash', inserted if it is not in
+    // the table. the key is converted to Key by 'make_key' only when it is
+    // inserted
+    template<typename T, typename MakeKey>
+    entry &find_or_insert(std::uint64_t const hash, T const &key, MakeKey make_key)
+    {
+        if ((entries_.size() + 1) * 8 > tags_.size() * 7)
+            grow();
+
+        std::int8_t const tag = std::int8_t(hash >> 57);
+        for (std::size_t slot=std::size_t(hash) & mask_; ; slot=(slot + 1) & mask_)
+        {
+            if (tags_[slot] == empty_slot)
+            {
+                tags_[slot]    = tag;
+                indices_[slot] = std::uint32_t(entries_.size());
+                entries_.emplace_back(hash, make_key(key));
+                return entries_.back();
+            }
+            else if (tags_[slot] == tag  &&  intermediate_key_equal(entries_[indices_[slot]].key, key))
+                return entries_[indices_[slot]];
+        }
+    }
+
+    iterator       begin(void)        { return entries_.begin(); }
+    iterator       end(void)          { return entries_.end();   }
+    const_iterator begin(void) const  { return entries_.cbegin(); }
+    const_iterator end(void)   const  { return entries_.cend();   }
+
+    std::size_t const size(void) const
+    {
+        return entries_.size();
+    }
+
+    bool const empty(void) const
+    {
+        return entries_.empty();
+    }
+
+    // the table keeps its capacity, so it can be filled again without
+    // growing
+    void clear(void)
+    {
+        entries_.clear();
+        std::fill(tags_.begin(), tags_.end(), empty_slot);
+    }
+
+    void swap(flat_hash_table &other)
+    {
+        using std::swap;
+        swap(tags_,    other.tags_);
+        swap(indices_, other.indices_);
+        swap(entries_, other.entries_);
+        swap(mask_,    other.mask_);
+    }
+
+  private:
+    void grow(void)
+    {
+        std::size_t const capacity = std::max<std::size_t>(16, tags_.size() * 2);
+        tags_.assign(capacity, empty_slot);
+        indices_.resize(capacity);
+        mask_ = capacity - 1;
+
+        for (std::size_t index=0; index<entries_.size(); ++index)
+        {
+            std::size_t slot = std::size_t(entries_[index].hash) & mask_;
+            while (tags_[slot] != empty_slot)
+                slot = (slot + 1) & mask_;
+            tags_[slot]    = std::int8_t(entries_[index].hash >> 57);
+            indices_[slot] = std::uint32_t(index);
+        }
+        entries_.reserve(capacity * 7 / 8);
+    }
+
+  private:
+    static std::int8_t const empty_slot = -128;
+
+    std::vector<std::int8_t>   tags_;       // seven bits of the hash of the key in the slot, or empty_slot
+    std::vector<std::uint32_t> indices_;    // index of the slot's entry
+    std::vector<entry>         entries_;
+    std::size_t                mask_;       // number of slots less one; a power of two
+};
+
+template<typename Key, typename Value, typename Values>
+std::int8_t const flat_hash_table<Key, Value, Values>::empty_slot;
+
+// sort pointers to the entries of flat_hash_tables by key, for a reduce
+// task that is given its keys in order, or leave them in the order of the
+// tables, which is the order in which the keys were first inserted
+template<typename KeyCompare, typename Entry>
+inline void order_entries(std::vector<Entry const *> &entries, std::true_type)
+{
+    KeyCompare compare;
+    std::sort(
+        entries.begin(),
+        entries.end(),
+        [&compare](Entry const *first, Entry const *second) { return compare(first->key, second->key); });
+}
+
+template<typename KeyCompare, typename Entry>
+inline void order_entries(std::vector<Entry const *> &/*entries*/, std::false_type)
+{
+}
+
+}   // namespace detail
+
+namespace intermediates {
+
+// an in memory intermediate store that keeps each partition in an open
+// addressing hash table, rather than a std::map, so that inserting an
+// intermediate value is a hash and a short probe of contiguous memory
+// rather than a walk of a tree and the allocation of a node. keys are
+// ordered once, when a partition is reduced, by sorting its entries with
+// KeyCompare; a job whose reduce task does not need its keys in order can
+// set OrderedReduce to false to reduce them in the order of the table.
+// the results are sorted by key when they are iterated
+template<
+    typename MapTask,
+    typename ReduceTask,
+    typename KeyType         = typename ReduceTask::key_type,
+    typename PartitionFn     = mapreduce::hash_partitioner,
+    typename KeyCompare      = std::less<typename ReduceTask::key_type>,
+    typename StoreResultType = reduce_null_output<MapTask, ReduceTask>,
+    bool     OrderedReduce   = true
+>
+class hashed_in_memory : detail::noncopyable
+{
+  public:
+    typedef KeyType                         key_type;
+    typedef typename ReduceTask::value_type value_type;
+    typedef MapTask                         map_task_type;
+    typedef ReduceTask                      reduce_task_type;
+    typedef StoreResultType                 store_result_type;
+
+  private:
+    typedef detail::flat_hash_table<KeyType, value_type> table_t;
+    typedef typename table_t::entry                      entry_t;
+    typedef std::vector<table_t>                         intermediates_t;
+    typedef detail::intermediate_key_partitioner<KeyType, PartitionFn> partitioner_t;
+
+  public:
+    typedef
+    std::pair<KeyType, value_type>
+    keyvalue_t;
+
+    // the keys of a table are in the order that they were inserted, so the
+    // results are sorted by key to be iterated
+    typedef
+    detail::sorted_result_iterator<keyvalue_t, KeyCompare>
+    const_result_iterator;
+
+    explicit hashed_in_memory(size_t const num_partitions=1)
+      : num_partitions_(num_partitions),
+        partitioner_(num_partitions)
+    {
+        intermediates_.resize(num_partitions_);
+    }
+
+    const_result_iterator begin_results(void) const
+    {
+        return const_result_iterator(*this, num_partitions_);
+    }
+
+    const_result_iterator end_results(void) const
+    {
+        return const_result_iterator();
+    }
+
+    void swap(hashed_in_memory &other)
+    {
+        using std::swap;
+        swap(intermediates_, other.intermediates_);
+    }
+
+    void run_intermediate_results_shuffle(size_t const /*partition*/)
+    {
+    }
+
+    // append the final results of a partition that has been reduced to
+    // 'out', in key order
+    template<typename OutputIterator>
+    void copy_results(size_t const partition, OutputIterator out) const
+    {
+        for (auto const *e : ordered_entries(intermediates_[partition], std::true_type()))
+        {
+            for (auto const &value : e->values)
+                *out++ = keyvalue_t(e->key, value);
+        }
+    }
+
+    // discard all of the intermediate and final results
+    void clear(void)
+    {
+        for (auto &table : intermediates_)
+            table.clear();
+    }
+
+    // the number of values in the entries of a partition's table, which is
+    // the number of values that its reduce will be given
+    std::uintmax_t const partition_size(size_t const partition) const
+    {
+        std::uintmax_t size = 0;
+        for (auto const &e : intermediates_[partition])
+            size += e.values.size();
+        return size;
+    }
+
+    template<typename Callback>
+    void reduce(size_t const partition, Callback &callback)
+    {
+        table_t table;
+        table.swap(intermediates_[partition]);
+
+        for (auto const *e : ordered_entries(table, std::integral_constant<bool, OrderedReduce>()))
+            callback(e->key, e->values.cbegin(), e->values.cend());
+    }
+
+    // the values are moved out of the other store, so merging the same
+    // store again has no effect
+    void merge_from(size_t partition, hashed_in_memory &other)
+    {
+        table_t &table       = intermediates_[partition];
+        table_t &other_table = other.intermediates_[partition];
+
+        if (table.empty())
+        {
+            table.swap(other_table);
+            return;
+        }
+
+        for (auto &e : other_table)
+        {
+            table.find_or_insert(e.hash, e.key, detail::intermediate_key_maker<key_type>()).values.splice(e.values);
+        }
+        other_table.clear();
+    }
+
+    void merge_from(hashed_in_memory &other)
+    {
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+            merge_from(partition, other);
+    }
+
+    // receive intermediate result. the key is hashed once, for both its
+    // partition and its slot in the partition's table; a key emitted as a
+    // pointer and a length is converted only when its entry is created
+    template<typename T>
+    bool const insert(T const &key, typename reduce_task_type::value_type const &value)
+    {
+        std::size_t const hash = detail::intermediate_key_hash(key);
+        table_t &table = intermediates_[partitioner_(hash, key)];
+        table.find_or_insert(detail::mix_hash(hash), key, detail::intermediate_key_maker<key_type>()).values.push_back(value);
+        return true;
+    }
+
+    // receive final result
+    template<typename StoreResult>
+    bool const insert(typename reduce_task_type::key_type   const &key,
+                      typename reduce_task_type::value_type const &value,
+                      StoreResult &store_result)
+    {
+        return store_result(key, value)  &&  insert(key, value);
+    }
+
+    template<typename FnObj>
+    void combine(FnObj &fn_obj)
+    {
+        intermediates_t intermediates;
+        intermediates.resize(num_partitions_);
+        using std::swap;
+        swap(intermediates_, intermediates);
+
+        for (auto const &table : intermediates)
+        {
+            for (auto const &e : table)
+            {
+                fn_obj.start(e.key);
+                for (auto const &value : e.values)
+                    fn_obj(value);
+                fn_obj.finish(e.key, *this);
+            }
+        }
+    }
+
+    void combine(null_combiner &)
+    {
+    }
+
+  private:
+    template<typename Ordered>
+    static std::vector<entry_t const *> ordered_entries(table_t const &table, Ordered ordered)
+    {
+        std::vector<entry_t const *> entries;
+        entries.reserve(table.size());
+        for (auto const &e : table)
+            entries.push_back(&e);
+        detail::order_entries<KeyCompare>(entries, ordered);
+        return entries;
+    }
+
+  private:
+    size_t const    num_partitions_;
+    intermediates_t intermediates_;
+    partitioner_t   partitioner_;
+};
+
+}   // namespace intermediates
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,536 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+namespace mapreduce {
+
+namespace detail {
+
+// the memory that a key holds outside of itself
+template<typename T>
+inline std::uintmax_t const key_heap_size(T const &/*key*/)
+{
+    return 0;
+}
+
+inline std::uintmax_t const key_heap_size(std::string const &key)
+{
+    // short strings are held within the string itself
+    return (key.capacity() < sizeof(std::string))? 0 : key.capacity() + 1;
+}
+
+}   // namespace detail
+
+namespace intermediates {
+
+// an in memory intermediate store that is given a budget of memory, as
+// specification::memory_budget. partitions are kept in memory, as they are
+// by in_memory, until the intermediate results that have been merged into
+// the store exceed the budget; the largest partitions are then written to
+// temporary files as runs of binary records, sorted by key, and emptied. a
+// partition that has not been written out is reduced from memory, as it
+// would be by in_memory; one that has is reduced by merging its runs, which
+// are memory mapped, with what remains of it in memory. the final results
+// are held in memory. as for multi_process, the values must be trivially
+// copyable, and the keys trivially copyable or std::string. the memory held
+// by map tasks' own stores is counted against the same budget; a map task's
+// store that finds the job over its budget writes out its own largest
+// partitions, and its runs are handed to the job's store when it is merged.
+// a store counts the memory of the values inserted into it by its map task
+// without synchronisation, and adds it to the shared count once every
+// publish_interval values
+template<
+    typename MapTask,
+    typename ReduceTask,
+    typename KeyType         = typename ReduceTask::key_type,
+    typename PartitionFn     = mapreduce::hash_partitioner,
+    typename KeyCompare      = std::less<typename ReduceTask::key_type>,
+    typename StoreResultType = reduce_null_output<MapTask, ReduceTask>
+>
+class hybrid : detail::noncopyable
+{
+  public:
+    typedef KeyType                         key_type;
+    typedef typename ReduceTask::value_type value_type;
+    typedef MapTask                         map_task_type;
+    typedef ReduceTask                      reduce_task_type;
+    typedef StoreResultType                 store_result_type;
+
+  private:
+    typedef detail::intermediate_key_compare<KeyCompare>      key_compare_t;
+    typedef detail::value_list<value_type>                    values_t;
+    typedef std::map<KeyType, values_t, key_compare_t>        map_t;
+    typedef std::vector<map_t>                                intermediates_t;
+    typedef detail::record_merger<hybrid, KeyCompare>         record_merger_t;
+    typedef detail::intermediate_key_partitioner<KeyType, PartitionFn> partitioner_t;
+
+    // a partition that has been written to a temporary file
+    struct run
+    {
+        std::string    filename;
+        std::uintmax_t values;      // number of values written
+    };
+    typedef std::vector<std::vector<run> > runs_t;
+
+    // an estimate of the memory used by a key in a map, other than its values
+    enum { node_size = sizeof(typename map_t::value_type) + 4 * sizeof(void *) };
+
+  public:
+    typedef
+    std::pair<KeyType, value_type>
+    keyvalue_t;
+
+    // the final results are held in a std::map for each partition, so are
+    // copied out of them all and sorted to be iterated in key order
+    typedef
+    detail::sorted_result_iterator<keyvalue_t, KeyCompare>
+    const_result_iterator;
+
+    explicit hybrid(size_t const num_partitions=1)
+      : num_partitions_(num_partitions),
+        runs_(num_partitions),
+        locks_(new std::mutex[num_partitions]),
+        bytes_(new std::atomic<std::uintmax_t>[num_partitions]),
+        unpublished_(num_partitions, 0),
+        unpublished_values_(0),
+        total_bytes_(std::make_shared<std::atomic<std::uintmax_t> >(0)),
+        budget_(0),
+        partitioner_(num_partitions)
+    {
+        intermediates_.resize(num_partitions_);
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+            bytes_[partition] = 0;
+    }
+
+    ~hybrid()
+    {
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+        {
+            remove_runs(runs_[partition]);
+            *total_bytes_ -= bytes_[partition];
+        }
+    }
+
+    // the number of bytes of intermediate results that are kept in memory
+    // before partitions are written out, or zero for no limit
+    void memory_budget(std::uintmax_t const budget)
+    {
+        budget_ = budget;
+    }
+
+    // count the memory of this store, which is a map task's, against the
+    // budget of the job's store
+    void share_memory_budget(hybrid const &intermediate_store)
+    {
+        total_bytes_ = intermediate_store.total_bytes_;
+        budget_      = intermediate_store.budget_;
+    }
+
+    // the bytes of intermediate results held in memory by the job's store
+    // and the map tasks' stores that share its budget
+    std::uintmax_t const memory_in_use(void) const
+    {
+        return *total_bytes_;
+    }
+
+    const_result_iterator begin_results(void) const
+    {
+        return const_result_iterator(*this, num_partitions_);
+    }
+
+    const_result_iterator end_results(void) const
+    {
+        return const_result_iterator();
+    }
+
+    void run_intermediate_results_shuffle(size_t const /*partition*/)
+    {
+    }
+
+    // append the final results of a partition that has been reduced to
+    // 'out', in key order
+    template<typename OutputIterator>
+    void copy_results(size_t const partition, OutputIterator out) const
+    {
+        for (auto const &result : intermediates_[partition])
+        {
+            for (auto const &value : result.second)
+                *out++ = keyvalue_t(result.first, value);
+        }
+    }
+
+    // discard all of the intermediate and final results
+    void clear(void)
+    {
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+        {
+            intermediates_[partition].clear();
+            remove_runs(runs_[partition]);
+            runs_[partition].clear();
+            *total_bytes_ -= bytes_[partition].exchange(0);
+            unpublished_[partition] = 0;
+        }
+    }
+
+    // the number of values of a partition in memory and in the runs that have
+    // been written out, which are all merged for its reduce
+    std::uintmax_t const partition_size(size_t const partition) const
+    {
+        std::uintmax_t size = 0;
+        for (auto const &result : intermediates_[partition])
+            size += result.second.size();
+        for (auto const &r : runs_[partition])
+            size += r.values;
+        return size;
+    }
+
+    template<typename Callback>
+    void reduce(size_t const partition, Callback &callback)
+    {
+        map_t map;
+        std::vector<run> runs;
+        {
+            std::lock_guard<std::mutex> lock(locks_[partition]);
+            using std::swap;
+            swap(map, intermediates_[partition]);
+            swap(runs, runs_[partition]);
+            *total_bytes_ -= bytes_[partition].exchange(0);
+            unpublished_[partition] = 0;
+        }
+
+        if (runs.empty())
+        {
+            for (auto const &result : map)
+                callback(result.first, result.second.cbegin(), result.second.cend());
+            return;
+        }
+
+        try
+        {
+            // the rest of the partition is written to memory in the same
+            // format as the runs, and merged with them
+            std::vector<char> buffer;
+            detail::buffer_writer writer(buffer);
+            write_records(map, writer);
+            map.clear();
+
+            std::vector<boost::iostreams::mapped_file_source> files(runs.size());
+            std::vector<typename record_merger_t::block_t> blocks;
+            for (size_t loop=0; loop<runs.size(); ++loop)
+            {
+                files[loop].open(runs[loop].filename);
+                blocks.push_back(std::make_pair(files[loop].data(), files[loop].data() + files[loop].size()));
+            }
+            if (!buffer.empty())
+                blocks.push_back(std::make_pair(buffer.data(), buffer.data() + buffer.size()));
+
+            record_merger_t::reduce(blocks, callback);
+        }
+        catch (...)
+        {
+            remove_runs(runs);
+            throw;
+        }
+        remove_runs(runs);
+    }
+
+    // the values and runs are moved out of the other store, so merging the
+    // same store again has no effect. partitions that are merged concurrently
+    // are written out by whichever merge finds the store over its budget
+    void merge_from(size_t partition, hybrid &other)
+    {
+        std::lock_guard<std::mutex> lock(locks_[partition]);
+
+        std::vector<run> &other_runs = other.runs_[partition];
+        runs_[partition].insert(runs_[partition].end(), other_runs.begin(), other_runs.end());
+        other_runs.clear();
+
+        map_t &map       = intermediates_[partition];
+        map_t &other_map = other.intermediates_[partition];
+
+        std::uintmax_t bytes = 0;
+        if (map.empty())
+        {
+            using std::swap;
+            swap(map, other_map);
+            if (budget_ != 0)
+            {
+                for (auto const &result : map)
+                    bytes += size_of(result);
+            }
+        }
+        else
+        {
+            for (auto &result : other_map)
+            {
+                auto it = map.lower_bound(result.first);
+                if (it == map.end()  ||  map.key_comp()(result.first, it->first))
+                {
+                    it = map.insert(it, std::make_pair(result.first, values_t()));
+                    bytes += node_size + detail::key_heap_size(it->first);
+                }
+                bytes += result.second.size() * sizeof(value_type);
+                it->second.splice(result.second);
+            }
+            other_map.clear();
+        }
+
+        *other.total_bytes_ -= other.bytes_[partition].exchange(0);
+        other.unpublished_[partition] = 0;
+        add_bytes(partition, bytes);
+    }
+
+    void merge_from(hybrid &other)
+    {
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+            merge_from(partition, other);
+    }
+
+    // receive intermediate result. a key emitted as a pointer and a length
+    // is looked up in its partition's map as it is; it is converted, and the
+    // memory of the new key counted against the budget, only if it is new
+    template<typename T>
+    bool const insert(T const &key, value_type const &value)
+    {
+        return insert_key(key, value, std::integral_constant<bool, key_compare_t::template compares<T>::value>());
+    }
+
+    bool const insert(key_type const &key, value_type const &value)
+    {
+        return insert_key(key, value, std::true_type());
+    }
+
+    // receive final result, which is held in memory
+    template<typename StoreResult>
+    bool const insert(typename reduce_task_type::key_type const &key,
+                      value_type                          const &value,
+                      StoreResult                               &store_result)
+    {
+        if (!store_result(key, value))
+            return false;
+
+        detail::values_of(intermediates_[partitioner_(key)], key).push_back(value);
+        return true;
+    }
+
+    template<typename FnObj>
+    void combine(FnObj &fn_obj)
+    {
+        intermediates_t intermediates;
+        intermediates.resize(num_partitions_);
+        using std::swap;
+        swap(intermediates_, intermediates);
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+        {
+            *total_bytes_ -= bytes_[partition].exchange(0);
+            unpublished_[partition] = 0;
+        }
+        unpublished_values_ = 0;
+
+        for (auto const &map : intermediates)
+        {
+            for (auto const &kv : map)
+            {
+                fn_obj.start(kv.first);
+                for (auto const &value : kv.second)
+                    fn_obj(value);
+                fn_obj.finish(kv.first, *this);
+            }
+        }
+    }
+
+    void combine(null_combiner &)
+    {
+    }
+
+  private:
+    template<typename T>
+    bool const insert_key(T const &key, value_type const &value, std::true_type)
+    {
+        size_t const partition = partitioner_(key);
+        map_t &map = intermediates_[partition];
+
+        if (budget_ == 0)
+        {
+            detail::values_of(map, key).push_back(value);
+            return true;
+        }
+
+        // a store is inserted into by one map task at a time, so its memory
+        // is counted here without a lock, and is published to the job's
+        // count in batches
+        auto it = map.lower_bound(key);
+        if (it == map.end()  ||  map.key_comp()(key, it->first))
+        {
+            it = map.insert(it, std::make_pair(detail::intermediate_key_maker<key_type>()(key), values_t()));
+            unpublished_[partition] += node_size + detail::key_heap_size(it->first);
+        }
+        it->second.push_back(value);
+        unpublished_[partition] += sizeof(value_type);
+
+        if (++unpublished_values_ == publish_interval)
+            publish();
+        return true;
+    }
+
+    template<typename T>
+    bool const insert_key(T const &key, value_type const &value, std::false_type)
+    {
+        return insert(make_intermediate_key<key_type>(key), value);
+    }
+
+    // count the memory of the values inserted since it was last published,
+    // and write out the largest partitions while the store is over its budget
+    void publish(void)
+    {
+        unpublished_values_ = 0;
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+        {
+            bytes_[partition] += unpublished_[partition];
+            *total_bytes_     += unpublished_[partition];
+            unpublished_[partition] = 0;
+        }
+
+        while (*total_bytes_ > budget_)
+        {
+            size_t largest = 0;
+            for (size_t loop=1; loop<num_partitions_; ++loop)
+            {
+                if (bytes_[loop] > bytes_[largest])
+                    largest = loop;
+            }
+
+            if (bytes_[largest] == 0)
+                break;
+
+            std::lock_guard<std::mutex> lock(locks_[largest]);
+            spill(largest);
+        }
+    }
+
+    // count the memory added to a partition, whose lock is held by the
+    // caller, and write out partitions while the store is over its budget.
+    // the largest partition is written out if its lock can be taken, and
+    // the caller's partition otherwise
+    void add_bytes(size_t const partition, std::uintmax_t const bytes)
+    {
+        bytes_[partition] += bytes;
+        *total_bytes_     += bytes;
+
+        while (budget_ != 0  &&  *total_bytes_ > budget_)
+        {
+            size_t largest = partition;
+            for (size_t loop=0; loop<num_partitions_; ++loop)
+            {
+                if (bytes_[loop] > bytes_[largest])
+                    largest = loop;
+            }
+
+            if (largest != partition)
+            {
+                std::unique_lock<std::mutex> lock(locks_[largest], std::try_to_lock);
+                if (lock.owns_lock())
+                {
+                    spill(largest);
+                    continue;
+                }
+            }
+
+            if (bytes_[partition] == 0)
+                break;
+            spill(partition);
+        }
+    }
+
+    // write a partition, whose lock is held, to a temporary file as a run of
+    // records sorted by key, and empty it
+    void spill(size_t const partition)
+    {
+        map_t &map = intermediates_[partition];
+
+        run r;
+        r.filename = platform::get_temporary_filename();
+        r.values   = 0;
+        for (auto const &result : map)
+            r.values += result.second.size();
+
+        {
+            std::ofstream file(r.filename.c_str(), std::ios_base::binary);
+            detail::stream_writer writer(file);
+            write_records(map, writer);
+            file.close();
+            if (!file)
+            {
+                detail::delete_file(r.filename);
+                BOOST_THROW_EXCEPTION(std::runtime_error("An error occurred writing a temporary file."));
+            }
+        }
+
+        runs_[partition].push_back(r);
+        map.clear();
+        *total_bytes_ -= bytes_[partition].exchange(0);
+        unpublished_[partition] = 0;
+    }
+
+    template<typename Writer>
+    static void write_records(map_t const &map, Writer &writer)
+    {
+        detail::record_writer<hybrid, Writer> record_writer(writer);
+        for (auto const &result : map)
+            record_writer(result.first, result.second.cbegin(), result.second.cend());
+    }
+
+    static void remove_runs(std::vector<run> const &runs)
+    {
+        for (auto const &r : runs)
+            detail::delete_file(r.filename);
+    }
+
+    static std::uintmax_t const size_of(typename map_t::value_type const &result)
+    {
+        return node_size + detail::key_heap_size(result.first) + result.second.size() * sizeof(value_type);
+    }
+
+  private:
+    static size_t const publish_interval = 1024;
+
+    size_t const                                      num_partitions_;
+    intermediates_t                                   intermediates_;
+    runs_t                                            runs_;
+    std::unique_ptr<std::mutex[]>                     locks_;       // held to merge into or write out a partition once there is a budget
+    std::unique_ptr<std::atomic<std::uintmax_t>[]>    bytes_;       // memory used by each partition's intermediate results
+    std::vector<std::uintmax_t>                       unpublished_; // memory inserted into each partition and not yet in bytes_
+    size_t                                            unpublished_values_;
+    std::shared_ptr<std::atomic<std::uintmax_t> >     total_bytes_; // shared with the stores of the job's map tasks
+    std::uintmax_t                                    budget_;
+    partitioner_t                                     partitioner_;
+};
+
+}   // namespace intermediates
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
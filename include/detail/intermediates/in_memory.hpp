@@ -49,7 +49,8 @@ template<
     typename KeyType     = typename ReduceTask::key_type,
     typename PartitionFn = mapreduce::hash_partitioner,
     typename KeyCompare  = std::less<typename ReduceTask::key_type>,
-    typename StoreResult = reduce_null_output<MapTask, ReduceTask>
+    typename StoreResult = reduce_null_output<MapTask, ReduceTask>,
+    typename Allocator   = std::allocator<char>
 >
 class in_memory : detail::noncopyable
 {
@@ -61,10 +62,23 @@ class in_memory : detail::noncopyable
     typedef StoreResult                     store_result_type;
 
   private:
+    typedef
+    detail::value_list<
+        value_type,
+        typename std::allocator_traits<Allocator>::template rebind_alloc<value_type> >
+    values_t;
+
+    typedef detail::intermediate_key_compare<KeyCompare> key_compare_t;
+
+    // each partition's map is default constructed, and so has an allocator
+    // of its own, which its values share
     typedef
     std::vector<
         std::map<
-            KeyType, std::list<value_type>,KeyCompare>>
+            KeyType,
+            values_t,
+            key_compare_t,
+            typename std::allocator_traits<Allocator>::template rebind_alloc<std::pair<KeyType const, values_t> > > >
     intermediates_t;
 
   public:
@@ -144,7 +158,7 @@ class in_memory : detail::noncopyable
             
             for (auto loop=current_.first+1; loop<outer_->num_partitions_; ++loop)
             {
-                if (iterators_[loop] != outer_->intermediates_[loop].end()  &&  *iterators_[current_.first] > *iterators_[loop])
+                if (iterators_[loop] != outer_->intermediates_[loop].end()  &&  KeyCompare()(iterators_[loop]->first, iterators_[current_.first]->first))
                     current_.first = loop;
             }
 
@@ -185,7 +199,8 @@ class in_memory : detail::noncopyable
     friend class const_result_iterator;
 
     explicit in_memory(size_t const num_partitions=1)
-      : num_partitions_(num_partitions)
+      : num_partitions_(num_partitions),
+        partitioner_(num_partitions)
     {
         intermediates_.resize(num_partitions_);
     }
@@ -209,6 +224,40 @@ class in_memory : detail::noncopyable
     {
     }
 
+    // append the final results of a partition that has been reduced to
+    // 'out', in key order
+    template<typename OutputIterator>
+    void copy_results(size_t const partition, OutputIterator out) const
+    {
+        for (auto const &result : intermediates_[partition])
+        {
+            for (auto const &value : result.second)
+                *out++ = keyvalue_t(result.first, value);
+        }
+    }
+
+    // discard all of the intermediate and final results. the maps are
+    // replaced rather than cleared, so that the arena of an arena_allocator,
+    // which does not reuse memory that is deallocated, is destroyed with the
+    // last of its containers and its slabs returned to the pool, and a job
+    // that is run again, by iterative_job say, does not grow
+    void clear(void)
+    {
+        intermediates_t intermediates(num_partitions_);
+        using std::swap;
+        swap(intermediates_, intermediates);
+    }
+
+    // the number of values in the lists of a partition's map, which is the
+    // number of values that its reduce will be given
+    std::uintmax_t const partition_size(size_t const partition) const
+    {
+        std::uintmax_t size = 0;
+        for (auto const &result : intermediates_[partition])
+            size += result.second.size();
+        return size;
+    }
+
     template<typename Callback>
     void reduce(size_t const partition, Callback &callback)
     {
@@ -220,6 +269,8 @@ class in_memory : detail::noncopyable
             callback(result.first, result.second.cbegin(), result.second.cend());
     }
 
+    // the values are moved out of the other store, so merging the same
+    // store again has no effect
     void merge_from(size_t partition, in_memory &other)
     {
         typedef typename intermediates_t::value_type map_type;
@@ -234,32 +285,24 @@ class in_memory : detail::noncopyable
             return;
         }
 
-        for (auto const &result : other_map)
-        {
-            auto iti =
-                map.insert(
-                    std::make_pair(
-                        result.first,
-                        typename map_type::mapped_type())).first;
-
-            std::copy(
-                result.second.cbegin(),
-                result.second.cend(),
-                std::back_inserter(iti->second));
-        }
+        for (auto &result : other_map)
+            detail::values_of(map, result.first).splice(result.second);
+        other_map.clear();
     }
 
     void merge_from(in_memory &other)
     {
         for (size_t partition=0; partition<num_partitions_; ++partition)
             merge_from(partition, other);
-        other.intermediates_.clear();
     }
 
+    // a key emitted as a pointer and a length, as wordcount's are, is found
+    // in the map as it is, if KeyCompare can compare it, and is converted to
+    // key_type only if it is not already in the store
     template<typename T>
     bool const insert(T const &key, typename reduce_task_type::value_type const &value)
     {
-        return insert(make_intermediate_key<key_type>(key), value);
+        return insert_key(key, value, std::integral_constant<bool, key_compare_t::template compares<T>::value>());
     }
 
     // receive final result
@@ -275,15 +318,7 @@ class in_memory : detail::noncopyable
     bool const insert(typename key_type                     const &key,
                       typename reduce_task_type::value_type const &value)
     {
-        size_t const  partition = (num_partitions_ == 1)? 0 : partitioner_(key, num_partitions_);
-        auto         &map       = intermediates_[partition];
-
-        typedef typename intermediates_t::value_type::mapped_type mapped_type;
-        map.insert(
-            std::make_pair(
-                key,
-                mapped_type())).first->second.push_back(value);
-
+        detail::values_of(intermediates_[partitioner_(key)], key).push_back(value);
         return true;
     }
 
@@ -311,10 +346,27 @@ class in_memory : detail::noncopyable
     {
     }
 
+  private:
+    template<typename T>
+    bool const insert_key(T const &key, typename reduce_task_type::value_type const &value, std::true_type)
+    {
+        detail::values_of(intermediates_[partitioner_(key)], key).push_back(value);
+        return true;
+    }
+
+    template<typename T>
+    bool const insert_key(T const &key, typename reduce_task_type::value_type const &value, std::false_type)
+    {
+        return insert(make_intermediate_key<key_type>(key), value);
+    }
+
+  private:
+    typedef detail::intermediate_key_partitioner<KeyType, PartitionFn> partitioner_t;
+
   private:
     size_t const    num_partitions_;
     intermediates_t intermediates_;
-    PartitionFn     partitioner_;
+    partitioner_t   partitioner_;
 };
 
 
@@ -27,6 +27,19 @@ struct file_lines_comp
 template<typename Record>
 struct file_merger
 {
+    file_merger()
+      : records(0),
+        has_stopped(false)
+    {
+    }
+
+    // the merge ends early, leaving an incomplete output file, once 'stop'
+    // returns true. it is checked once every stop_interval records
+    void stop_when(std::function<bool ()> const &stop)
+    {
+        stop_fn = stop;
+    }
+
     template<typename List>
     void operator()(List const &filenames, std::string const &dest)
     {
@@ -38,6 +51,8 @@ struct file_merger
         {
             open_files();
             merge_files(dest);
+            if (has_stopped)
+                return;
 
             assert(file_lines.size() == 0);
 
@@ -86,10 +101,17 @@ struct file_merger
         }
     }
 
+    bool const stopped(void)
+    {
+        if (!has_stopped  &&  stop_fn  &&  ++records % stop_interval == 0)
+            has_stopped = stop_fn();
+        return has_stopped;
+    }
+
     void merge_files(std::string const &dest)
     {
         // find the smallest record in the list
-        while (file_lines.size() > 0)
+        while (file_lines.size() > 0  &&  !stopped())
         {
             auto it = std::min_element(file_lines.begin(), file_lines.end(), file_lines_comp());
 
@@ -139,13 +161,33 @@ struct file_merger
     }
 
   private:
+    static size_t const stop_interval = 1024;
+
     typedef std::list<std::pair<std::shared_ptr<std::ifstream>, Record> > file_lines_t;
     file_lines_t           file_lines;
     std::list<std::string> files;
     std::ofstream          outfile;
     file_deleter           delete_files;
+    std::function<bool ()> stop_fn;
+    size_t                 records;
+    bool                   has_stopped;
 };
 
+// run a merge of sorted files. the supplied file_merger is stopped early
+// when the job is stopped; other merge functions run to completion
+template<typename MergeFn, typename List>
+inline void merge_sorted_files(MergeFn &merge_fn, List const &filenames, std::string const &dest, std::function<bool ()> const &/*stop*/)
+{
+    merge_fn(filenames, dest);
+}
+
+template<typename Record, typename List>
+inline void merge_sorted_files(file_merger<Record> &merge_fn, List const &filenames, std::string const &dest, std::function<bool ()> const &stop)
+{
+    merge_fn.stop_when(stop);
+    merge_fn(filenames, dest);
+}
+
 template<typename Record>
 struct file_key_combiner
 {
@@ -267,8 +309,11 @@ class local_disk : detail::noncopyable
             for (size_t loop=0; loop<outer_->num_partitions_; ++loop)
             {
                 auto intermediate = outer_->intermediate_files_.find(loop);
-                if (intermediate == outer_->intermediate_files_.end())
+                if (intermediate == outer_->intermediate_files_.end()
+                ||  intermediate->second->filename.empty())
+                {
                     return end();
+                }
 
                 kvlist_[loop] =
                     std::make_pair(
@@ -380,6 +425,12 @@ class local_disk : detail::noncopyable
                 if (use_cache_)
                 {
                     ++records_.insert(std::make_pair(std::make_pair(key,value),0U)).first->second;
+
+                    // a store that is used for many map keys would otherwise hold
+                    // all of its records in memory. once the cache is flushed the
+                    // file is no longer sorted, and is sorted when it is merged
+                    if (records_.size() >= max_cached_records)
+                        return flush_cache();
                     return true;
                 }
 
@@ -422,6 +473,8 @@ class local_disk : detail::noncopyable
             using record_t  = std::pair<key_type, value_type>;
             using records_t = std::map<record_t, size_t>;
 
+            static size_t const max_cached_records = 1048576;
+
             bool      sorted_    = true;
             bool      use_cache_ = true;
             records_t records_;
@@ -442,6 +495,15 @@ class local_disk : detail::noncopyable
     explicit local_disk(size_t const num_partitions)
       : num_partitions_(num_partitions)
     {
+        // create an entry for every partition up front so that partitions can
+        // be merged, shuffled and reduced concurrently without the map changing
+        for (size_t partition=0; partition<num_partitions_; ++partition)
+        {
+            intermediate_files_.insert(
+                std::make_pair(
+                    partition,
+                    std::make_shared<intermediate_file_info>()));
+        }
     }
 
     ~local_disk()
@@ -524,6 +586,9 @@ class local_disk : detail::noncopyable
         this->close_files();
         for (auto it=intermediate_files_.cbegin(); it!=intermediate_files_.cend(); ++it)
         {
+            if (it->second->filename.empty())
+                continue;
+
             std::string outfilename = platform::get_temporary_filename();
 
             // run the combine function to combine records with the same key
@@ -535,38 +600,61 @@ class local_disk : detail::noncopyable
         this->close_files();
     }
 
+    // the other store's file is handed over, so merging the same store
+    // again has no effect
+    void merge_from(size_t const partition, local_disk &other)
+    {
+        assert(num_partitions_ == other.num_partitions_);
+        auto ito = other.intermediate_files_.find(partition);
+        if (ito == other.intermediate_files_.cend()  ||  ito->second->filename.empty())
+            return;
+
+        auto it = intermediate_files_.find(partition);
+        assert(it != intermediate_files_.cend());
+
+        ito->second->write_stream.close();
+        if (ito->second->write_stream.sorted())
+        {
+            it->second->fragment_filenames.push_back(ito->second->filename);
+            ito->second->filename.clear();
+        }
+        else
+        {
+            std::string sorted = platform::get_temporary_filename();
+            combine_fn_(ito->second->filename, sorted);
+            it->second->fragment_filenames.push_back(sorted);
+            detail::delete_file(ito->second->filename);
+            ito->second->filename.clear();
+        }
+        assert(ito->second->fragment_filenames.empty());
+    }
+
+    // called by the job with a function that returns true once the job has
+    // been stopped, to end the merge and reduce loops early
+    void stop_when(std::function<bool ()> const &stop)
+    {
+        stop_ = stop;
+    }
+
     void merge_from(local_disk &other)
     {
         assert(num_partitions_ == other.num_partitions_);
         for (size_t partition=0; partition<num_partitions_; ++partition)
-        {
-            auto ito = other.intermediate_files_.find(partition);
-            if (ito != other.intermediate_files_.cend())
-            {
-                auto it = intermediate_files_.find(partition);
-                if (it == intermediate_files_.cend())
-                {
-                    it = intermediate_files_.insert(
-                            std::make_pair(
-                                partition,
-                                std::make_shared<intermediate_file_info>())).first;
-                }
+            merge_from(partition, other);
+    }
 
-                ito->second->write_stream.close();
-                if (ito->second->write_stream.sorted())
-                {
-                    it->second->fragment_filenames.push_back(ito->second->filename);
-                    ito->second->filename.clear();
-                }
-                else
-                {
-                    std::string sorted = platform::get_temporary_filename();
-                    combine_fn_(ito->second->filename, sorted);
-                    it->second->fragment_filenames.push_back(sorted);
-                }
-                assert(ito->second->fragment_filenames.empty());
-            }
-        }
+    // the bytes of a partition's intermediate file and the fragments that
+    // are still to be merged into it, all of which its reduce reads
+    std::uintmax_t const partition_size(size_t const partition) const
+    {
+        auto it = intermediate_files_.find(partition);
+        if (it == intermediate_files_.cend())
+            return 0;
+
+        std::uintmax_t size = file_size(it->second->filename);
+        for (auto const &fragment : it->second->fragment_filenames)
+            size += file_size(fragment);
+        return size;
     }
 
     void run_intermediate_results_shuffle(size_t const partition)
@@ -582,7 +670,7 @@ class local_disk : detail::noncopyable
         if (!it->second->fragment_filenames.empty())
         {
             it->second->filename = platform::get_temporary_filename();
-            merge_fn(it->second->fragment_filenames, it->second->filename);
+            detail::merge_sorted_files(merge_fn, it->second->fragment_filenames, it->second->filename, stop_);
         }
     }
 
@@ -596,10 +684,11 @@ class local_disk : detail::noncopyable
         auto it = intermediate_files_.find(partition);
         assert(it != intermediate_files_.cend());
 
+        // the partition entry is left in place, without a file, so that
+        // other partitions can be reduced concurrently
         std::string filename;
         swap(filename, it->second->filename);
         it->second->write_stream.close();
-        intermediate_files_.erase(it);
 
         std::pair<
             typename reduce_task_type::key_type,
@@ -613,6 +702,10 @@ class local_disk : detail::noncopyable
             {
                 if (length(last_key) > 0)
                 {
+                    // the job has been stopped between reduce keys
+                    if (stop_  &&  stop_())
+                        break;
+
                     callback(last_key, values.cbegin(), values.cend());
                     values.clear();
                 }
@@ -652,13 +745,24 @@ class local_disk : detail::noncopyable
             it->second->write_stream.close();
     }
 
+    static std::uintmax_t const file_size(std::string const &filename)
+    {
+        if (filename.empty())
+            return 0;
+
+        boost::system::error_code ec;
+        std::uintmax_t const size = boost::filesystem::file_size(filename, ec);
+        return ec? 0 : size;
+    }
+
   private:
     typedef enum { map_phase, reduce_phase } phase_t;
 
-    size_t const    num_partitions_;
-    intermediates_t intermediate_files_;
-    CombineFile     combine_fn_;
-    PartitionFn     partitioner_;
+    size_t const           num_partitions_;
+    intermediates_t        intermediate_files_;
+    CombineFile            combine_fn_;
+    PartitionFn            partitioner_;
+    std::function<bool ()> stop_;               // returns true once the job has been stopped
 };
 
 }   // namespace intermediates
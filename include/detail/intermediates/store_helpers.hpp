@@ -0,0 +1,284 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <boost/functional/hash.hpp>
+#include <boost/iterator/iterator_facade.hpp>
+
+namespace mapreduce {
+
+namespace intermediates {
+
+template<typename ReduceKeyType, typename MapValueType>
+inline ReduceKeyType make_intermediate_key(MapValueType const &value);
+
+}   // namespace intermediates
+
+namespace detail {
+
+// the hash of an intermediate key. keys emitted as a pointer and a length,
+// as wordcount's are, hash the same as the std::string that they become,
+// so that they can be found in a table without being converted
+template<typename T>
+inline std::size_t const intermediate_key_hash(T const &key)
+{
+    return boost::hash<T>()(key);
+}
+
+inline std::size_t const intermediate_key_hash(std::pair<char const *, std::uintmax_t> const &key)
+{
+    return boost::hash_range(key.first, key.first + key.second);
+}
+
+template<typename Key, typename T>
+inline bool const intermediate_key_equal(Key const &key, T const &other)
+{
+    return key == other;
+}
+
+inline bool const intermediate_key_equal(std::string const &key, std::pair<char const *, std::uintmax_t> const &other)
+{
+    return key.length() == other.second  &&  std::memcmp(key.data(), other.first, key.length()) == 0;
+}
+
+// KeyCompare, as the comparison of the keys of a std::map. the comparison
+// std::less<std::string> also compares a std::string with a key emitted as
+// a pointer and a length, character by character as std::string::compare
+// does, so that the map can find an emitted key without converting it
+template<typename KeyCompare>
+struct intermediate_key_compare : KeyCompare
+{
+    template<typename T>
+    struct compares : std::false_type
+    {
+    };
+};
+
+template<>
+struct intermediate_key_compare<std::less<std::string> > : std::less<std::string>
+{
+    typedef void                                    is_transparent;
+    typedef std::pair<char const *, std::uintmax_t> emitted_key_t;
+
+    template<typename T>
+    struct compares : std::is_same<T, emitted_key_t>
+    {
+    };
+
+    using std::less<std::string>::operator();
+
+    bool const operator()(std::string const &key, emitted_key_t const &other) const
+    {
+        return compare(key.data(), key.length(), other.first, other.second) < 0;
+    }
+
+    bool const operator()(emitted_key_t const &key, std::string const &other) const
+    {
+        return compare(other.data(), other.length(), key.first, key.second) > 0;
+    }
+
+  private:
+    // the sign of the comparison of 'first' with 'second'
+    static int const compare(char const *first, std::uintmax_t const first_length, char const *second, std::uintmax_t const second_length)
+    {
+        std::size_t const length = (std::size_t)std::min(first_length, second_length);
+        int const result = (length == 0)? 0 : std::memcmp(first, second, length);
+        if (result != 0)
+            return result;
+        return (first_length < second_length)? -1 : (first_length > second_length)? 1 : 0;
+    }
+};
+
+// converts a key emitted by a map task to the key type of a store. a key
+// that is already of the key type is passed on by reference, so a store
+// that calls this only where it keeps a new key copies nothing otherwise
+template<typename KeyType>
+struct intermediate_key_maker
+{
+    template<typename T>
+    KeyType const operator()(T const &key) const
+    {
+        return intermediates::make_intermediate_key<KeyType>(key);
+    }
+
+    KeyType const &operator()(KeyType const &key) const
+    {
+        return key;
+    }
+};
+
+// the partition of an intermediate key. hash_partitioner, the default,
+// hashes the characters of a key emitted as a pointer and a length as it
+// would those of the std::string that it becomes, so an emitted key is not
+// converted to find its partition, and a store that has hashed the key for
+// a table of its own passes in the hash. other partitioners are given the
+// key converted to KeyType
+template<typename KeyType, typename PartitionFn>
+class intermediate_key_partitioner
+{
+  public:
+    explicit intermediate_key_partitioner(size_t const num_partitions)
+      : num_partitions_(num_partitions)
+    {
+    }
+
+    template<typename T>
+    size_t const operator()(T const &key) const
+    {
+        if (num_partitions_ == 1)
+            return 0;
+        return partition(key, std::is_same<PartitionFn, mapreduce::hash_partitioner>());
+    }
+
+    // 'hash' is the intermediate_key_hash() of the key
+    template<typename T>
+    size_t const operator()(std::size_t const hash, T const &key) const
+    {
+        if (num_partitions_ == 1)
+            return 0;
+        return partition(hash, key, std::is_same<PartitionFn, mapreduce::hash_partitioner>());
+    }
+
+  private:
+    template<typename T>
+    size_t const partition(T const &key, std::true_type) const
+    {
+        return intermediate_key_hash(key) % num_partitions_;
+    }
+
+    template<typename T>
+    size_t const partition(T const &key, std::false_type) const
+    {
+        return partitioner_(intermediate_key_maker<KeyType>()(key), num_partitions_);
+    }
+
+    template<typename T>
+    size_t const partition(std::size_t const hash, T const &/*key*/, std::true_type) const
+    {
+        return hash % num_partitions_;
+    }
+
+    template<typename T>
+    size_t const partition(std::size_t const /*hash*/, T const &key, std::false_type) const
+    {
+        return partition(key, std::false_type());
+    }
+
+  private:
+    size_t const num_partitions_;
+    PartitionFn  partitioner_;
+};
+
+// the values of a key in a map of keys to value lists, inserted if the key
+// is not in the map. the key is converted, and the list is constructed with
+// the map's allocator, only when the key is inserted
+template<typename Map, typename T>
+inline typename Map::mapped_type &values_of(Map &map, T const &key)
+{
+    typedef typename Map::mapped_type values_t;
+
+    auto it = map.lower_bound(key);
+    if (it == map.end()  ||  map.key_comp()(key, it->first))
+    {
+        it = map.insert(
+            it,
+            std::make_pair(
+                intermediate_key_maker<typename Map::key_type>()(key),
+                values_t(typename values_t::allocator_type(map.get_allocator()))));
+    }
+    return it->second;
+}
+
+// the const_result_iterator of a store whose results cannot be iterated in
+// key order where they are held, such as in the tables of a hash based
+// store, or the partitions of a std::map based store, which are each in key
+// order but are not ordered with one another. when the iteration begins the
+// results are copied out of every partition with the store's copy_results()
+// and sorted by key; copies of the iterator share them. a default
+// constructed iterator is the end of the results
+template<typename KeyValue, typename KeyCompare>
+class sorted_result_iterator
+  : public boost::iterator_facade<
+        sorted_result_iterator<KeyValue, KeyCompare>,
+        KeyValue const,
+        boost::forward_traversal_tag>
+{
+    friend class boost::iterator_core_access;
+
+  public:
+    sorted_result_iterator()
+      : position_(0)
+    {
+    }
+
+    template<typename Store>
+    sorted_result_iterator(Store const &store, size_t const num_partitions)
+      : results_(std::make_shared<std::vector<KeyValue> >()),
+        position_(0)
+    {
+        for (size_t partition=0; partition<num_partitions; ++partition)
+            store.copy_results(partition, std::back_inserter(*results_));
+
+        KeyCompare compare;
+        std::stable_sort(
+            results_->begin(),
+            results_->end(),
+            [&compare](KeyValue const &first, KeyValue const &second) { return compare(first.first, second.first); });
+    }
+
+  private:
+    void increment(void)
+    {
+        ++position_;
+    }
+
+    bool const equal(sorted_result_iterator const &other) const
+    {
+        if (at_end()  ||  other.at_end())
+            return at_end() == other.at_end();
+        return results_ == other.results_  &&  position_ == other.position_;
+    }
+
+    KeyValue const &dereference(void) const
+    {
+        return (*results_)[position_];
+    }
+
+    bool const at_end(void) const
+    {
+        return !results_  ||  position_ == results_->size();
+    }
+
+  private:
+    std::shared_ptr<std::vector<KeyValue> > results_;
+    size_t                                  position_;
+};
+
+}   // namespace detail
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
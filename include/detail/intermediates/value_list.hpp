@@ -0,0 +1,375 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <boost/iterator/iterator_facade.hpp>
+
+namespace mapreduce {
+
+namespace detail {
+
+// the type in which value_list holds its values. std::vector<bool> packs its
+// values into bits, which cannot be referred to, so a bool is held in a
+// struct of its own
+template<typename T>
+struct value_list_storage
+{
+    typedef T type;
+
+    static T const &get(type const &value)
+    {
+        return value;
+    }
+};
+
+template<>
+struct value_list_storage<bool>
+{
+    struct type
+    {
+        type(bool const value) : value(value)
+        {
+        }
+
+        bool value;
+    };
+
+    static bool const &get(type const &value)
+    {
+        return value.value;
+    }
+};
+
+// the values of an intermediate key, held contiguously rather than in a
+// node per value. values are appended to a vector, and the values of
+// another list are spliced in by moving its vectors onto the end as further
+// chunks, so that merging intermediate stores does not copy values one at a
+// time; a chunk of only a few values is appended instead. the index of the
+// first value of each further chunk is kept, so the size is known in
+// constant time and an iterator finds a value with a binary search of the
+// chunks. the iterators are random access, so a reduce task can find the
+// number of values of a key in constant time. the values, and the vectors of
+// further chunks, are allocated with Allocator
+template<typename T, typename Allocator=std::allocator<T> >
+class value_list
+{
+  private:
+    typedef value_list_storage<T>        storage_t;
+    typedef typename storage_t::type     stored_t;
+    typedef std::allocator_traits<Allocator> allocator_traits_t;
+
+    typedef std::vector<stored_t, typename allocator_traits_t::template rebind_alloc<stored_t> > chunk_t;
+
+    // the chunks after the first, and the index in the list of the first
+    // value of each. only the last chunk grows, so the indices do not change
+    struct further_chunks
+    {
+        typedef std::vector<chunk_t, typename allocator_traits_t::template rebind_alloc<chunk_t> > chunks_t;
+        typedef std::vector<size_t, typename allocator_traits_t::template rebind_alloc<size_t> >   starts_t;
+
+        template<typename Alloc>
+        explicit further_chunks(Alloc const &allocator)
+          : chunks(allocator),
+            starts(allocator)
+        {
+        }
+
+        chunks_t chunks;
+        starts_t starts;
+    };
+
+    // chunks smaller than this are copied when they are spliced
+    enum { min_splice_chunk = 64 };
+
+  public:
+    typedef T         value_type;
+    typedef size_t    size_type;
+    typedef Allocator allocator_type;
+
+    class const_iterator
+      : public boost::iterator_facade<
+            const_iterator,
+            T const,
+            boost::random_access_traversal_tag>
+    {
+        friend class boost::iterator_core_access;
+
+      public:
+        const_iterator()
+          : list_(0),
+            chunk_(0),
+            current_(0),
+            chunk_begin_(0),
+            chunk_end_(0),
+            index_(0)
+        {
+        }
+
+      private:
+        const_iterator(value_list const *list, size_t const index)
+          : list_(list)
+        {
+            locate(index);
+        }
+
+        // position the iterator at the index'th value, or at the end
+        void locate(size_t const index)
+        {
+            index_ = index;
+            enter(list_->chunk_of(index));
+            if (current_)
+                current_ += index - list_->chunk_start(chunk_);
+        }
+
+        // position the iterator at the first value of a chunk, or at the end
+        void enter(size_t const chunk)
+        {
+            chunk_ = chunk;
+            if (chunk_ == list_->chunk_count())
+                current_ = chunk_begin_ = chunk_end_ = 0;
+            else
+            {
+                chunk_t const &values = list_->chunk(chunk_);
+                current_ = chunk_begin_ = values.data();
+                chunk_end_ = chunk_begin_ + values.size();
+            }
+        }
+
+        void increment(void)
+        {
+            ++index_;
+            if (++current_ == chunk_end_)
+            {
+                do
+                {
+                    enter(chunk_ + 1);
+                } while (current_  &&  current_ == chunk_end_);
+            }
+        }
+
+        void decrement(void)
+        {
+            if (current_ == chunk_begin_)
+                locate(index_ - 1);
+            else
+            {
+                --index_;
+                --current_;
+            }
+        }
+
+        void advance(std::ptrdiff_t const n)
+        {
+            locate(size_t(std::ptrdiff_t(index_) + n));
+        }
+
+        std::ptrdiff_t const distance_to(const_iterator const &other) const
+        {
+            return std::ptrdiff_t(other.index_) - std::ptrdiff_t(index_);
+        }
+
+        bool const equal(const_iterator const &other) const
+        {
+            return index_ == other.index_;
+        }
+
+        T const &dereference(void) const
+        {
+            return storage_t::get(*current_);
+        }
+
+      private:
+        value_list const *list_;
+        size_t            chunk_;       // index of the current chunk
+        stored_t const   *current_;     // current value within the chunk
+        stored_t const   *chunk_begin_; // start of the current chunk
+        stored_t const   *chunk_end_;   // end of the current chunk
+        size_t            index_;       // index of the current value in the list
+
+        friend class value_list;
+    };
+    typedef const_iterator iterator;
+
+    explicit value_list(Allocator const &allocator=Allocator())
+      : values_(allocator)
+    {
+    }
+
+    value_list(value_list const &other)
+      : values_(other.values_),
+        chunks_(other.chunks_? new further_chunks(*other.chunks_) : 0)
+    {
+    }
+
+    value_list(value_list &&other)
+      : values_(std::move(other.values_)),
+        chunks_(std::move(other.chunks_))
+    {
+    }
+
+    value_list &operator=(value_list other)
+    {
+        swap(other);
+        return *this;
+    }
+
+    const_iterator begin(void) const
+    {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end(void) const
+    {
+        return const_iterator(this, size());
+    }
+
+    const_iterator cbegin(void) const
+    {
+        return begin();
+    }
+
+    const_iterator cend(void) const
+    {
+        return end();
+    }
+
+    size_type const size(void) const
+    {
+        if (!chunks_  ||  chunks_->chunks.empty())
+            return values_.size();
+        return chunks_->starts.back() + chunks_->chunks.back().size();
+    }
+
+    bool const empty(void) const
+    {
+        return values_.empty();
+    }
+
+    void push_back(T const &value)
+    {
+        back().push_back(value);
+    }
+
+    // move the values of 'other' onto the end of the list, leaving 'other'
+    // empty
+    void splice(value_list &other)
+    {
+        if (other.empty())
+            return;
+        else if (empty())
+        {
+            swap(other);
+            return;
+        }
+
+        if (other.values_.size() < min_splice_chunk)
+            std::move(other.values_.begin(), other.values_.end(), std::back_inserter(back()));
+        else
+            append_chunk(std::move(other.values_));
+
+        if (other.chunks_)
+        {
+            for (auto &chunk : other.chunks_->chunks)
+                append_chunk(std::move(chunk));
+        }
+        other.clear();
+    }
+
+    void clear(void)
+    {
+        values_.clear();
+        chunks_.reset();
+    }
+
+    void swap(value_list &other)
+    {
+        using std::swap;
+        swap(values_, other.values_);
+        swap(chunks_, other.chunks_);
+    }
+
+  private:
+    size_t const chunk_count(void) const
+    {
+        return 1 + (chunks_? chunks_->chunks.size() : 0);
+    }
+
+    chunk_t const &chunk(size_t const index) const
+    {
+        return (index == 0)? values_ : chunks_->chunks[index-1];
+    }
+
+    // the index in the list of the first value of a chunk
+    size_t const chunk_start(size_t const index) const
+    {
+        return (index == 0)? 0 : chunks_->starts[index-1];
+    }
+
+    // the chunk that holds the index'th value, or chunk_count() if the index
+    // is past the end
+    size_t const chunk_of(size_t const index) const
+    {
+        if (index < values_.size())
+            return 0;
+        else if (index >= size())
+            return chunk_count();
+
+        auto const &starts = chunks_->starts;
+        return size_t(std::upper_bound(starts.cbegin(), starts.cend(), index) - starts.cbegin());
+    }
+
+    // the chunk that values are appended to. a chunk that was spliced from a
+    // list with another allocator, such as the arena of a map task's store,
+    // is not grown; a chunk of the list's own is started instead, so a list
+    // allocates only from its own allocator, and an arena is only used by
+    // the store that it belongs to
+    chunk_t &back(void)
+    {
+        if (!chunks_  ||  chunks_->chunks.empty())
+            return values_;
+        else if (chunks_->chunks.back().get_allocator() != values_.get_allocator())
+            append_chunk(chunk_t(values_.get_allocator()));
+        return chunks_->chunks.back();
+    }
+
+    void append_chunk(chunk_t &&chunk)
+    {
+        if (!chunks_)
+            chunks_.reset(new further_chunks(values_.get_allocator()));
+        chunks_->starts.push_back(size());
+        chunks_->chunks.push_back(std::move(chunk));
+    }
+
+  private:
+    // the list is empty if, and only if, the first chunk is empty. further
+    // chunks are allocated only when a list is spliced, or appended to past
+    // a chunk with another allocator
+    chunk_t                         values_;
+    std::unique_ptr<further_chunks> chunks_;
+};
+
+}   // namespace detail
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
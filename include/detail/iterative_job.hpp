@@ -0,0 +1,118 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+namespace mapreduce {
+
+// runs a job repeatedly, the results of each iteration being the map input
+// of the next, until a convergence predicate is satisfied. the job, its
+// intermediate store and the schedule policy, with its thread pool, are
+// created once and reused for every iteration, and the results are passed
+// to the next iteration in memory rather than through a new datasource.
+//
+// the job's datasource is a datasource::iterative, and the job's map key
+// and value types are the reduce key and value types. the first iteration
+// maps the records that have been inserted into the datasource. after each
+// iteration, 'converged(datasource, job)' is called with the iteration's
+// input, which is still in the datasource, and the job, whose results are
+// the iteration's output; the iterations stop when it returns true, or
+// after 'max_iterations'
+template<typename Job, typename SchedulePolicy=schedule_policy::cpu_parallel<Job> >
+class iterative_job : detail::noncopyable
+{
+  public:
+    typedef Job                                    job_type;
+    typedef typename Job::datasource_type          datasource_type;
+    typedef typename Job::const_result_iterator    const_result_iterator;
+
+    iterative_job(datasource_type &datasource, specification const &spec)
+      : datasource_(datasource),
+        job_(datasource, spec),
+        resume_(false)
+    {
+    }
+
+    // the schedule policy runs on 'pool', as with job_executor
+    iterative_job(datasource_type &datasource, specification const &spec, std::shared_ptr<thread_pool> const &pool)
+      : datasource_(datasource),
+        job_(datasource, spec),
+        schedule_(pool),
+        resume_(false)
+    {
+    }
+
+    // returns the number of iterations run. 'result' holds the counters and
+    // times of the last iteration, with the total job_runtime of them all.
+    // calling run() again continues from the results of the last iteration
+    template<typename Converged>
+    size_t const run(Converged converged, results &result, size_t const max_iterations=std::numeric_limits<size_t>::max())
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        datasource_.rewind();
+        size_t iteration = 0;
+        while (iteration < max_iterations)
+        {
+            if (resume_)
+            {
+                // the results of the last iteration are the next one's input
+                datasource_.assign(job_.begin_results(), job_.end_results());
+                job_.clear_results();
+            }
+
+            result = results();
+            job_.run(schedule_, result);
+            resume_ = true;
+            ++iteration;
+
+            if (result.cancelled  ||  converged(datasource_, job_))
+                break;
+        }
+
+        result.iterations  = iteration;
+        result.job_runtime = std::chrono::system_clock::now() - start_time;
+        return iteration;
+    }
+
+    const_result_iterator begin_results(void) const
+    {
+        return job_.begin_results();
+    }
+
+    const_result_iterator end_results(void) const
+    {
+        return job_.end_results();
+    }
+
+    Job &job(void)
+    {
+        return job_;
+    }
+
+  private:
+    datasource_type &datasource_;
+    Job              job_;
+    SchedulePolicy   schedule_;
+    bool             resume_;       // the job holds the results of an iteration
+};
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
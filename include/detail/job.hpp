@@ -36,6 +36,127 @@ class reduce_task
     typedef ReduceValue value_type;
 };
 
+namespace detail {
+
+// an intermediate store can optionally provide
+//     void stop_when(std::function<bool ()> const &stop);
+// to be given a function that returns true once the job has been cancelled,
+// so that it can stop its own long running loops
+template<typename IntermediateStore>
+class has_stop_when
+{
+    template<typename T>
+    static auto test(int) -> decltype(std::declval<T &>().stop_when(std::function<bool ()>()), std::true_type());
+
+    template<typename>
+    static std::false_type test(...);
+
+  public:
+    static bool const value = decltype(test<IntermediateStore>(0))::value;
+};
+
+template<typename IntermediateStore>
+inline void stop_when(IntermediateStore &intermediate_store, std::function<bool ()> const &stop, std::true_type)
+{
+    intermediate_store.stop_when(stop);
+}
+
+template<typename IntermediateStore>
+inline void stop_when(IntermediateStore &, std::function<bool ()> const &, std::false_type)
+{
+}
+
+// an intermediate store can optionally provide
+//     void memory_budget(std::uintmax_t const budget);
+// to be given specification::memory_budget
+template<typename IntermediateStore>
+class has_memory_budget
+{
+    template<typename T>
+    static auto test(int) -> decltype(std::declval<T &>().memory_budget(std::uintmax_t()), std::true_type());
+
+    template<typename>
+    static std::false_type test(...);
+
+  public:
+    static bool const value = decltype(test<IntermediateStore>(0))::value;
+};
+
+template<typename IntermediateStore>
+inline void memory_budget(IntermediateStore &intermediate_store, std::uintmax_t const budget, std::true_type)
+{
+    intermediate_store.memory_budget(budget);
+}
+
+template<typename IntermediateStore>
+inline void memory_budget(IntermediateStore &, std::uintmax_t const, std::false_type)
+{
+}
+
+// an intermediate store can optionally provide
+//     std::unique_ptr<IntermediateStore> map_task_store(void);
+// to give each map task a store that inserts directly into the job's
+// store, so that nothing is merged when the map task finishes
+template<typename IntermediateStore>
+class has_map_task_store
+{
+    template<typename T>
+    static auto test(int) -> decltype(std::declval<T &>().map_task_store(), std::true_type());
+
+    template<typename>
+    static std::false_type test(...);
+
+  public:
+    static bool const value = decltype(test<IntermediateStore>(0))::value;
+};
+
+template<typename IntermediateStore>
+inline std::unique_ptr<IntermediateStore> map_task_store(IntermediateStore &intermediate_store, size_t const /*num_partitions*/, std::true_type)
+{
+    return intermediate_store.map_task_store();
+}
+
+// an intermediate store can optionally provide
+//     void share_memory_budget(IntermediateStore const &intermediate_store);
+// so that the memory held by the store of a map task is counted against the
+// budget of the job's store
+template<typename IntermediateStore>
+class has_share_memory_budget
+{
+    template<typename T>
+    static auto test(int) -> decltype(std::declval<T &>().share_memory_budget(std::declval<T const &>()), std::true_type());
+
+    template<typename>
+    static std::false_type test(...);
+
+  public:
+    static bool const value = decltype(test<IntermediateStore>(0))::value;
+};
+
+template<typename IntermediateStore>
+inline void share_memory_budget(IntermediateStore &map_task_store, IntermediateStore const &intermediate_store, std::true_type)
+{
+    map_task_store.share_memory_budget(intermediate_store);
+}
+
+template<typename IntermediateStore>
+inline void share_memory_budget(IntermediateStore &, IntermediateStore const &, std::false_type)
+{
+}
+
+template<typename IntermediateStore>
+inline std::unique_ptr<IntermediateStore> map_task_store(IntermediateStore &intermediate_store, size_t const num_partitions, std::false_type)
+{
+    std::unique_ptr<IntermediateStore> map_task_store(new IntermediateStore(num_partitions));
+    share_memory_budget(
+        *map_task_store,
+        intermediate_store,
+        std::integral_constant<bool, has_share_memory_budget<IntermediateStore>::value>());
+    return map_task_store;
+}
+
+}   // namespace detail
+
 template<typename MapTask,
          typename ReduceTask,
          typename Combiner          = null_combiner,
@@ -59,15 +180,30 @@ class job : detail::noncopyable
     typename intermediate_store_type::keyvalue_t
     keyvalue_t;
 
+  private:
+    typedef
+    typename detail::checkpoint_type<
+        typename map_task_type::key_type,
+        typename intermediate_store_type::key_type,
+        typename reduce_task_type::value_type>::type
+    checkpoint_t;
+
+  public:
+    // the checkpoint of one run of a map key that is kept only if the job
+    // keeps that run's output, as when speculative execution runs a key
+    // more than once
+    typedef std::unique_ptr<typename checkpoint_t::writer> pending_checkpoint;
+
   private:
     class map_task_runner : detail::noncopyable
     {
       public:
         typedef ReduceTask reduce_task_type;
 
-        map_task_runner(job &j)
+        map_task_runner(job &j, intermediate_store_type &intermediate_store, typename checkpoint_t::writer *checkpoint=nullptr)
           : job_(j),
-            intermediate_store_(job_.number_of_partitions())
+            intermediate_store_(intermediate_store),
+            checkpoint_(checkpoint)
         {
         }
 
@@ -76,18 +212,14 @@ class job : detail::noncopyable
                                     typename map_task_type::value_type     &value)
         {
             map_task_type()(*this, key, value);
-
-            // consolidating map intermediate results can save time by
-            // aggregating the mapped valued at mapper
-            combiner_type instance;
-            intermediate_store_.combine(instance);
-
             return *this;
         }
 
         template<typename T>
         bool const emit_intermediate(T const &key, typename reduce_task_type::value_type const &value)
         {
+            if (checkpoint_)
+                checkpoint_->write(key, value);
             return intermediate_store_.insert(key, value);
         }
 
@@ -96,21 +228,37 @@ class job : detail::noncopyable
             return intermediate_store_;
         }
 
+        // the job's datasource, for side data that it holds for the map tasks
+        datasource_type &datasource(void)
+        {
+            return job_.datasource_;
+        }
+
+        // no more map keys are started once a map task has enough data, for
+        // a sample, say, and the job goes on to reduce what has been mapped
+        void enough_data(void)
+        {
+            job_.enough_data();
+        }
+
       private:
-        job                     &job_;
-        intermediate_store_type  intermediate_store_;
+        job                            &job_;
+        intermediate_store_type        &intermediate_store_;
+        typename checkpoint_t::writer  *checkpoint_;    // the map key's output is also checkpointed
     };
 
     class reduce_task_runner : detail::noncopyable
     {
       public:
         reduce_task_runner(
+            job                     &j,
             std::string       const &output_filespec,
             size_t            const &partition,
             size_t            const  num_partitions,
             intermediate_store_type &intermediate_store,
             results                 &result)
-          : partition_(partition),
+          : job_(j),
+            partition_(partition),
             result_(result),
             intermediate_store_(intermediate_store),
             store_result_(output_filespec, partition, num_partitions)
@@ -119,7 +267,16 @@ class job : detail::noncopyable
 
         void reduce(void)
         {
-            intermediate_store_.reduce(partition_, *this);
+            reduce(intermediate_store_);
+        }
+
+        // reduce the partition from a source other than the job's store,
+        // such as the shared memory written by map worker processes. the
+        // results are stored in the job's store
+        template<typename Source>
+        void reduce(Source &source)
+        {
+            source.reduce(partition_, *this);
         }
 
         void emit(typename reduce_task_type::key_type   const &key,
@@ -131,12 +288,16 @@ class job : detail::noncopyable
         template<typename It>
         void operator()(typename reduce_task_type::key_type const &key, It it, It ite)
         {
+            if (job_.work_stopped())
+                return;
+
             ++result_.counters.reduce_keys_executed;
             reduce_task_type()(*this, key, it, ite);
             ++result_.counters.reduce_keys_completed;
         }
 
       private:
+        job                     &job_;
         size_t const            &partition_;
         results                 &result_;
         intermediate_store_type &intermediate_store_;
@@ -147,8 +308,29 @@ class job : detail::noncopyable
     job(datasource_type &datasource, specification const &spec)
       : datasource_(datasource),
         specification_(spec),
-        intermediate_store_(specification_.reduce_tasks)
+        intermediate_store_(specification_.reduce_tasks),
+        enough_data_(false),
+        deadline_ended_map_phase_(false),
+        work_skipped_(false)
      {
+        if (!specification_.checkpoint_directory.empty())
+        {
+            checkpoint_.reset(
+                new checkpoint_t(
+                    specification_.checkpoint_directory,
+                    specification_.incremental,
+                    segmented_map_keys? specification_.max_file_segment_size : 0));
+        }
+
+        detail::stop_when(
+            intermediate_store_,
+            std::bind(&job::work_stopped, this),
+            std::integral_constant<bool, detail::has_stop_when<intermediate_store_type>::value>());
+
+        detail::memory_budget(
+            intermediate_store_,
+            specification_.memory_budget,
+            std::integral_constant<bool, detail::has_memory_budget<intermediate_store_type>::value>());
      }
 
     const_result_iterator begin_results(void) const
@@ -161,15 +343,77 @@ class job : detail::noncopyable
         return intermediate_store_.end_results();
     }
 
+    // append the results of one partition to 'out', for a datasource that
+    // passes them to another job. the intermediate store must provide
+    // copy_results()
+    template<typename OutputIterator>
+    void copy_results(size_t const partition, OutputIterator out) const
+    {
+        intermediate_store_.copy_results(partition, out);
+    }
+
+    // discard the results of a previous run, so that the job, its
+    // datasource and its store can be run again, as iterative_job does.
+    // the intermediate store must provide clear()
+    void clear_results(void)
+    {
+        intermediate_store_.clear();
+        enough_data_ = false;
+    }
+
+    bool const get_map_data(typename map_task_type::key_type &key, typename map_task_type::value_type &value)
+    {
+        return datasource_.get_data(key, value);
+    }
+
+    // bring data that has been read from the datasource into memory ahead
+    // of the map task that processes it
+    void prefetch_map_data(typename map_task_type::value_type &value) const
+    {
+        datasource::detail::prefetch(value);
+    }
+
     bool const get_next_map_key(typename map_task_type::key_type *&key)
     {
         std::unique_ptr<typename map_task_type::key_type> next_key(new typename map_task_type::key_type);
+        if (map_keys_stopped())
+        {
+            // a key that is still to come is skipped
+            if (datasource_.setup_key(*next_key))
+                map_keys_skipped();
+            return false;
+        }
+
         if (!datasource_.setup_key(*next_key))
             return false;
         key = next_key.release();
         return true;
     }
 
+    // claim the next batch of map keys into a buffer owned by the calling
+    // worker. keys are held by value, and datasources that provide
+    // setup_keys() are not serialised; other datasources supply a single key
+    // at a time, serialised through 'sync'
+    template<typename Sync>
+    bool const get_next_map_keys(std::vector<typename map_task_type::key_type> &keys, Sync &sync, results &result)
+    {
+        bool const stop = map_keys_stopped();
+        bool const more = get_next_map_keys(
+            keys,
+            sync,
+            result,
+            std::integral_constant<bool, datasource::detail::has_setup_keys<datasource_type, typename map_task_type::key_type>::value>());
+
+        // keys that are still to come are skipped
+        if (stop  &&  more)
+        {
+            map_keys_skipped();
+            keys.clear();
+            return false;
+        }
+        return more;
+    }
+
     size_t const number_of_partitions(void) const
     {
         return specification_.reduce_tasks;
@@ -180,6 +424,78 @@ class job : detail::noncopyable
         return specification_.map_tasks;
     }
 
+    bool const speculative_execution(void) const
+    {
+        return specification_.speculative_execution;
+    }
+
+    size_t const number_of_numa_nodes(void) const
+    {
+        return specification_.numa_nodes;
+    }
+
+    bool const numa_pin_to_cores(void) const
+    {
+        return specification_.numa_pin_to_cores;
+    }
+
+    // the job has been cancelled, or its deadline has passed after the map
+    // phase ended; the remaining merges, shuffles and reduce keys are skipped.
+    // a deadline that ends the map phase leaves what was mapped to be merged
+    // and reduced, as for enough_data()
+    bool const stopped(void) const
+    {
+        return specification_.cancellation.cancelled()
+            ||  (deadline_passed()  &&  !deadline_ended_map_phase_);
+    }
+
+    // the job's deadline has passed
+    bool const deadline_passed(void) const
+    {
+        return specification_.deadline != std::chrono::system_clock::time_point::max()
+            &&  std::chrono::system_clock::now() >= specification_.deadline;
+    }
+
+    // a map task has signalled that the job has enough data
+    bool const has_enough_data(void) const
+    {
+        return enough_data_;
+    }
+
+    // no more map keys are to be started
+    bool const map_keys_stopped(void)
+    {
+        if (!deadline_ended_map_phase_  &&  deadline_passed())
+            deadline_ended_map_phase_ = true;
+        return enough_data_  ||  deadline_ended_map_phase_  ||  specification_.cancellation.cancelled();
+    }
+
+    // map keys are left unstarted because the job has been stopped. unless a
+    // map task signalled that the job had enough data, the job is reported
+    // as cancelled
+    void map_keys_skipped(void)
+    {
+        if (!enough_data_)
+            work_skipped_ = true;
+    }
+
+    size_t const number_of_io_threads(void) const
+    {
+        return specification_.io_threads;
+    }
+
+    size_t const number_of_processes(void) const
+    {
+        return specification_.processes;
+    }
+
+    // no more map keys are started; called by a map task, or by a schedule
+    // policy on behalf of a map task that ran in another process
+    void enough_data(void)
+    {
+        enough_data_ = true;
+    }
+
     template<typename SchedulePolicy>
     void run(results &result)
     {
@@ -191,10 +507,53 @@ class job : detail::noncopyable
     void run(SchedulePolicy &schedule, results &result)
     {
         auto const start_time = std::chrono::system_clock::now();
+        if (checkpoint_  &&  specification_.incremental)
+        {
+            // the map keys that have been run before are not run again, and
+            // their combined output is reduced with the output of new keys
+            intermediate_store_type combined(number_of_partitions());
+            checkpoint_->load_combined(combined, number_of_partitions());
+            intermediate_store_.merge_from(combined);
+        }
+
         schedule(*this, result);
+
+        if (checkpoint_  &&  specification_.incremental  &&  !stopped())
+        {
+            try
+            {
+                intermediate_store_type combined(number_of_partitions());
+                checkpoint_->save_combined(
+                    combined,
+                    number_of_partitions(),
+                    std::bind(&job::combine_intermediate_results, this, std::placeholders::_1));
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "\nError: " << e.what() << "\n";
+            }
+        }
         result.job_runtime = std::chrono::system_clock::now() - start_time;
+        result.cancelled   = work_skipped_;
+        result.enough_data = enough_data_;
     }
 
+    // a store for the intermediate results of a map task, to be merged
+    // into the job's store, or one that inserts directly into the job's
+    // store if the store provides map_task_store()
+    std::unique_ptr<intermediate_store_type> make_map_task_store(void)
+    {
+        return
+            detail::map_task_store(
+                intermediate_store_,
+                number_of_partitions(),
+                std::integral_constant<bool, detail::has_map_task_store<intermediate_store_type>::value>());
+    }
+
+    // run a map task and merge its intermediate results into the job's
+    // store, serialising the merge with other map tasks through 'sync'.
+    // a store that inserts directly into the job's has nothing to merge,
+    // and the lock is not taken
     template<typename Sync>
     bool const run_map_task(typename map_task_type::key_type *key, results &result, Sync &sync)
     {
@@ -202,26 +561,42 @@ class job : detail::noncopyable
 
         try
         {
-            ++result.counters.map_keys_executed;
-
             std::unique_ptr<typename map_task_type::key_type> map_key_ptr(key);
             typename map_task_type::key_type &map_key = *map_key_ptr;
 
-            // get some data
-            typename map_task_type::value_type value;
-            if (!datasource_.get_data(map_key, value))
+            std::unique_ptr<intermediate_store_type> intermediate_store_ptr(make_map_task_store());
+            intermediate_store_type &intermediate_store = *intermediate_store_ptr;
+            if (!restore_map_key(map_key, intermediate_store, result))
             {
-                ++result.counters.map_key_errors;
-                return false;
+                // get some data
+                typename map_task_type::value_type value;
+                if (!datasource_.get_data(map_key, value))
+                {
+                    ++result.counters.map_keys_executed;
+                    ++result.counters.map_key_errors;
+                    return false;
+                }
+
+                if (!restore_map_key(map_key, value, intermediate_store, result))
+                {
+                    ++result.counters.map_keys_executed;
+                    run_map(map_key, value, intermediate_store);
+                    ++result.counters.map_keys_completed;
+                }
             }
 
-            map_task_runner runner(*this);
-            runner(map_key, value);
+            // consolidating map intermediate results can save time by
+            // aggregating the mapped valued at mapper
+            combine_intermediate_results(intermediate_store);
 
             // merge the map task intermediate results into the job
-            std::lock_guard<Sync> lock(sync);
-            intermediate_store_.merge_from(runner.intermediate_store());
-            ++result.counters.map_keys_completed;
+            if (!detail::has_map_task_store<intermediate_store_type>::value)
+            {
+                auto const lock_time = std::chrono::system_clock::now();
+                std::lock_guard<Sync> lock(sync);
+                result.lock_wait_time += std::chrono::system_clock::now() - lock_time;
+                intermediate_store_.merge_from(intermediate_store);
+            }
         }
         catch (std::exception &e)
         {
@@ -234,25 +609,153 @@ class job : detail::noncopyable
         return true;
     }
 
+    // run a map task, leaving its intermediate results in a store that is
+    // owned by the calling worker and used for all of the map keys that the
+    // worker processes. the worker's store is combined and merged into the
+    // job once, at the end of the map phase
+    bool const run_map_task(typename map_task_type::key_type &key, results &result, intermediate_store_type &intermediate_store)
+    {
+        if (map_keys_stopped())
+        {
+            map_keys_skipped();
+            return false;
+        }
+        else if (restore_map_key(key, intermediate_store, result))
+            return true;
+
+        // get some data
+        typename map_task_type::value_type value;
+        if (!get_map_data(key, value))
+        {
+            ++result.counters.map_keys_executed;
+            ++result.counters.map_key_errors;
+            return false;
+        }
+        else if (restore_map_key(key, value, intermediate_store, result))
+            return true;
+
+        return run_map_task_on_data(key, value, result, intermediate_store);
+    }
+
+    // run a map task on data that has already been read from the datasource
+    bool const run_map_task(typename map_task_type::key_type const &key,
+                            typename map_task_type::value_type     &value,
+                            results                                &result,
+                            intermediate_store_type                &intermediate_store)
+    {
+        // keys that were claimed in a batch before the job was stopped
+        if (map_keys_stopped())
+        {
+            map_keys_skipped();
+            return false;
+        }
+        else if (restore_map_key(key, intermediate_store, result)
+             ||  restore_map_key(key, value, intermediate_store, result))
+        {
+            return true;
+        }
+
+        return run_map_task_on_data(key, value, result, intermediate_store);
+    }
+
+    // run a map task on data that has already been read, holding back its
+    // checkpoint until commit_checkpoint() is called. a key that is restored
+    // from the checkpoint leaves 'checkpoint' empty
+    bool const run_map_task(typename map_task_type::key_type const &key,
+                            typename map_task_type::value_type     &value,
+                            results                                &result,
+                            intermediate_store_type                &intermediate_store,
+                            pending_checkpoint                     &checkpoint)
+    {
+        if (map_keys_stopped())
+        {
+            map_keys_skipped();
+            return false;
+        }
+        else if (restore_map_key(key, intermediate_store, result)
+             ||  restore_map_key(key, value, intermediate_store, result))
+        {
+            return true;
+        }
+
+        return run_map_task_on_data(key, value, result, intermediate_store, &checkpoint);
+    }
+
+    void commit_checkpoint(pending_checkpoint &checkpoint)
+    {
+        if (checkpoint)
+        {
+            checkpoint->commit();
+            checkpoint.reset();
+        }
+    }
+
+    void combine_intermediate_results(intermediate_store_type &intermediate_store)
+    {
+        combiner_type instance;
+        intermediate_store.combine(instance);
+    }
+
+    // merge one partition of a worker's store into the job's store. different
+    // partitions can be merged concurrently
+    void merge_intermediate_results(size_t const partition, intermediate_store_type &intermediate_store)
+    {
+        if (!merge_skipped())
+            intermediate_store_.merge_from(partition, intermediate_store);
+    }
+
+    void merge_intermediate_results(intermediate_store_type &intermediate_store)
+    {
+        if (!merge_skipped())
+            intermediate_store_.merge_from(intermediate_store);
+    }
+
+    std::uintmax_t const partition_size(size_t const partition) const
+    {
+        return intermediate_store_.partition_size(partition);
+    }
+
+    // store a result that was reduced by another process, such as a worker
+    // of a distributed job, so that it is returned by begin_results()
+    void insert_result(typename reduce_task_type::key_type   const &key,
+                       typename reduce_task_type::value_type const &value)
+    {
+        intermediate_store_.insert(key, value);
+    }
+
     void run_intermediate_results_shuffle(size_t const partition)
     {
-        intermediate_store_.run_intermediate_results_shuffle(partition);
+        if (!work_stopped())
+            intermediate_store_.run_intermediate_results_shuffle(partition);
     }
 
     bool const run_reduce_task(size_t const partition, results &result)
     {
+        return run_reduce_task(partition, intermediate_store_, result);
+    }
+
+    // run a reduce task on the intermediate results of a partition held in
+    // 'source', which provides reduce(partition, callback) in the same way
+    // as an intermediate store
+    template<typename Source>
+    bool const run_reduce_task(size_t const partition, Source &source, results &result)
+    {
+        if (work_stopped())
+            return false;
+
         bool success = true;
 
         auto const start_time(std::chrono::system_clock::now());
         try
         {
             reduce_task_runner runner(
+                *this,
                 specification_.output_filespec,
                 partition,
                 number_of_partitions(),
                 intermediate_store_,
                 result);
-            runner.reduce();
+            runner.reduce(source);
         }
         catch (std::exception &e)
         {
@@ -267,9 +770,160 @@ class job : detail::noncopyable
     }
 
   private:
-    datasource_type         &datasource_;
-    specification     const &specification_;
-    intermediate_store_type  intermediate_store_;
+    // the job has been stopped, and the work that the caller was about to do
+    // is skipped
+    bool const work_stopped(void)
+    {
+        if (!stopped())
+            return false;
+        work_skipped_ = true;
+        return true;
+    }
+
+    // the output of map tasks is merged into the job's store unless the job
+    // has been cancelled, so that what was mapped before a deadline is reduced
+    bool const merge_skipped(void)
+    {
+        if (!specification_.cancellation.cancelled())
+            return false;
+        work_skipped_ = true;
+        return true;
+    }
+
+    bool const run_map_task_on_data(typename map_task_type::key_type const &key,
+                                    typename map_task_type::value_type     &value,
+                                    results                                &result,
+                                    intermediate_store_type                &intermediate_store,
+                                    pending_checkpoint                     *pending=nullptr)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        try
+        {
+            ++result.counters.map_keys_executed;
+            run_map(key, value, intermediate_store, pending);
+            ++result.counters.map_keys_completed;
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+            ++result.counters.map_key_errors;
+            return false;
+        }
+        result.map_times.push_back(std::chrono::system_clock::now() - start_time);
+
+        return true;
+    }
+
+    // a datasource that hands out a map key more than once, each time with a
+    // segment of the key's input, is checkpointed by key and segment, so its
+    // keys can only be restored once the data has been read
+    static bool const segmented_map_keys = datasource::detail::has_map_key_segment<datasource_type, map_task_type>::value;
+
+    datasource::segment_t const map_key_segment(typename map_task_type::key_type const &key, typename map_task_type::value_type const &value, std::true_type) const
+    {
+        return datasource_.map_key_segment(key, value);
+    }
+
+    datasource::segment_t const map_key_segment(typename map_task_type::key_type const &/*key*/, typename map_task_type::value_type const &/*value*/, std::false_type) const
+    {
+        return datasource::segment_t();
+    }
+
+    // restore a map key before its data is read
+    bool const restore_map_key(typename map_task_type::key_type const &key, intermediate_store_type &intermediate_store, results &result)
+    {
+        return !segmented_map_keys  &&  restore_map_key_segment(key, datasource::segment_t(), intermediate_store, result);
+    }
+
+    // restore the segment of a map key's input that has been read
+    bool const restore_map_key(typename map_task_type::key_type   const &key,
+                               typename map_task_type::value_type const &value,
+                               intermediate_store_type                  &intermediate_store,
+                               results                                  &result)
+    {
+        return segmented_map_keys
+            &&  restore_map_key_segment(
+                    key,
+                    map_key_segment(key, value, std::integral_constant<bool, segmented_map_keys>()),
+                    intermediate_store,
+                    result);
+    }
+
+    // insert the output of a map key from the checkpoint, if it was
+    // completed when the job was last run
+    bool const restore_map_key_segment(typename map_task_type::key_type const &key, datasource::segment_t const &segment, intermediate_store_type &intermediate_store, results &result)
+    {
+        try
+        {
+            if (!checkpoint_  ||  !checkpoint_->restore(key, segment, intermediate_store))
+                return false;
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+            return false;
+        }
+
+        ++result.counters.map_keys_completed;
+        ++result.counters.map_keys_restored;
+        return true;
+    }
+
+    // the checkpoint of the key is committed once the map task has run, or
+    // is handed to 'pending' to be committed by the caller
+    void run_map(typename map_task_type::key_type const &key, typename map_task_type::value_type &value, intermediate_store_type &intermediate_store, pending_checkpoint *pending=nullptr)
+    {
+        if (!checkpoint_)
+        {
+            map_task_runner runner(*this, intermediate_store);
+            runner(key, value);
+            return;
+        }
+
+        pending_checkpoint checkpoint(
+            new typename checkpoint_t::writer(
+                *checkpoint_,
+                key,
+                map_key_segment(key, value, std::integral_constant<bool, segmented_map_keys>())));
+        map_task_runner runner(*this, intermediate_store, checkpoint.get());
+        runner(key, value);
+
+        if (pending)
+            *pending = std::move(checkpoint);
+        else
+            checkpoint->commit();
+    }
+
+    template<typename Sync>
+    bool const get_next_map_keys(std::vector<typename map_task_type::key_type> &keys, Sync &/*sync*/, results &/*result*/, std::true_type)
+    {
+        keys.resize(std::max<size_t>(1, specification_.map_key_batch_size));
+        keys.resize(datasource_.setup_keys(&keys[0], keys.size()));
+        return !keys.empty();
+    }
+
+    template<typename Sync>
+    bool const get_next_map_keys(std::vector<typename map_task_type::key_type> &keys, Sync &sync, results &result, std::false_type)
+    {
+        keys.resize(1);
+
+        auto const lock_time = std::chrono::system_clock::now();
+        std::lock_guard<Sync> lock(sync);
+        result.lock_wait_time += std::chrono::system_clock::now() - lock_time;
+        if (!datasource_.setup_key(keys[0]))
+            keys.clear();
+        return !keys.empty();
+    }
+
+  private:
+    datasource_type               &datasource_;
+    specification           const &specification_;
+    intermediate_store_type        intermediate_store_;
+    std::atomic<bool>              enough_data_;
+    std::atomic<bool>              deadline_ended_map_phase_;
+    std::atomic<bool>              work_skipped_;
+    std::unique_ptr<checkpoint_t>  checkpoint_;
 };
 
 }   // namespace mapreduce
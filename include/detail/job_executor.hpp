@@ -0,0 +1,186 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace mapreduce {
+
+// runs a number of jobs at the same time on one thread pool. each job runs
+// on a share of the pool with a weight, and the pool's workers take the
+// tasks of the jobs' map, shuffle and reduce phases in proportion to the
+// weights of the jobs that have tasks waiting. cpu_parallel's map tasks give
+// way to waiting tasks between batches of map keys, so that a job with a
+// long map phase does not hold on to the workers. a job's share is added
+// to the pool when the job is admitted and removed when it retires, so the
+// workers are rebalanced between the running jobs as they come and go.
+//
+// 'max_threads' limits the number of threads that run tasks, including the
+// threads that cpu_parallel starts for map tasks that are waiting for I/O.
+// each running job also has a driver thread, which runs its schedule policy
+// and sleeps while it waits for the job's tasks. drivers are counted against
+// the pool's size: no more jobs run at once than the pool has workers, and a
+// driver that finishes a job goes on to the next one that is admitted.
+// 'max_memory', if it is not zero, limits the memory that the jobs running
+// at the same time are expected to use; each job is submitted with an
+// estimate of its memory, and is held in a queue until there is enough
+// memory for it. a job whose estimate is more than 'max_memory' is run on
+// its own.
+//
+// the job, its datasource and its results must remain valid until wait()
+// returns. the schedule policy must be constructible from the pool that it
+// is to run on, as cpu_parallel, pipelined and prefetching are
+class job_executor : detail::noncopyable
+{
+  public:
+    explicit job_executor(size_t const max_threads=std::max(1U, std::thread::hardware_concurrency()),
+                          std::uintmax_t const max_memory=0)
+      : max_memory_(max_memory),
+        memory_in_use_(0),
+        running_(0),
+        drivers_(0)
+    {
+        size_t const num_threads = std::max(size_t(1), std::min(max_threads, size_t(std::max(1U, std::thread::hardware_concurrency()))));
+        pool_ = std::make_shared<thread_pool>(num_threads);
+        pool_->limit_additional_threads(std::max(num_threads, max_threads) - num_threads);
+    }
+
+    ~job_executor()
+    {
+        wait();
+    }
+
+    template<typename Job>
+    void submit(Job &job, results &result, unsigned const weight=1, std::uintmax_t const memory=0)
+    {
+        submit<schedule_policy::cpu_parallel<Job> >(job, result, weight, memory);
+    }
+
+    template<typename SchedulePolicy, typename Job>
+    void submit(Job &job, results &result, unsigned const weight=1, std::uintmax_t const memory=0)
+    {
+        pending_job pending;
+        pending.weight = weight;
+        pending.memory = memory;
+        pending.run    =
+            [&job, &result](std::shared_ptr<thread_pool> const &pool)
+            {
+                SchedulePolicy schedule(pool);
+                job.run(schedule, result);
+            };
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(pending);
+        admit();
+    }
+
+    // wait for all of the submitted jobs to complete
+    void wait(void)
+    {
+        mapreduce::detail::joined_thread_group threads;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return pending_.empty()  &&  running_ == 0  &&  drivers_ == 0; });
+            threads.swap(threads_);
+        }
+        threads.join_all();
+    }
+
+    std::shared_ptr<thread_pool> const &pool(void) const
+    {
+        return pool_;
+    }
+
+  private:
+    struct pending_job
+    {
+        std::function<void (std::shared_ptr<thread_pool> const &)> run;
+        unsigned                                                   weight;
+        std::uintmax_t                                             memory;
+    };
+
+    // called with the mutex held. jobs are admitted in the order they were
+    // submitted, while there is memory for them and a worker for each job's
+    // driver, and a driver thread is started for each job that has none
+    void admit(void)
+    {
+        while (!pending_.empty()  &&  running_ < pool_->size())
+        {
+            pending_job &next = pending_.front();
+            if (max_memory_ != 0  &&  running_ > 0  &&  memory_in_use_ + next.memory > max_memory_)
+                break;
+
+            memory_in_use_ += next.memory;
+            ++running_;
+            admitted_.push_back(next);
+            pending_.pop_front();
+        }
+
+        for (; drivers_ < running_; ++drivers_)
+            threads_.emplace_back(std::thread(&job_executor::driver_thread, this));
+    }
+
+    // runs admitted jobs until there are none left to start
+    void driver_thread(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!admitted_.empty())
+        {
+            pending_job const job = admitted_.front();
+            admitted_.pop_front();
+            lock.unlock();
+
+            try
+            {
+                job.run(std::make_shared<thread_pool>(pool_, job.weight));
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "\nError: " << e.what() << "\n";
+            }
+
+            lock.lock();
+            memory_in_use_ -= job.memory;
+            --running_;
+            admit();
+        }
+        --drivers_;
+        cv_.notify_all();
+    }
+
+  private:
+    std::shared_ptr<thread_pool>            pool_;
+    std::uintmax_t const                    max_memory_;
+    std::uintmax_t                          memory_in_use_;     // estimated memory of the running jobs
+    size_t                                  running_;           // number of jobs admitted and not yet retired
+    size_t                                  drivers_;
+    std::deque<pending_job>                 pending_;
+    std::deque<pending_job>                 admitted_;          // admitted jobs waiting for a driver
+    std::mutex                              mutex_;
+    std::condition_variable                 cv_;
+    mapreduce::detail::joined_thread_group  threads_;           // the driver threads, which run the jobs' schedule policies
+};
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -3,6 +3,9 @@
 
 #pragma once
 
+#include <chrono>
+#include <thread>
+#include <vector>
 #include <boost/config.hpp>
 #include <boost/system/system_error.hpp>
 
@@ -72,7 +75,72 @@ std::basic_string<Char> &get_temporary_filename(std::basic_string<Char> &pathnam
     return pathname;
 }
 
+// processor time, user and kernel, used by the calling thread
+inline std::chrono::duration<double> const thread_cpu_time(void)
+{
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!GetThreadTimes(GetCurrentThread(), &creation_time, &exit_time, &kernel_time, &user_time))
+        return std::chrono::duration<double>(0);
+
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart  = kernel_time.dwLowDateTime;
+    kernel.HighPart = kernel_time.dwHighDateTime;
+    user.LowPart    = user_time.dwLowDateTime;
+    user.HighPart   = user_time.dwHighDateTime;
+
+    // FILETIME is measured in 100 nanosecond intervals
+    return std::chrono::duration<double>(double(kernel.QuadPart + user.QuadPart) / 10000000.0);
+}
+
+// the processors of each NUMA node. processors beyond the first processor
+// group are not reported
+inline std::vector<std::vector<unsigned> > const numa_nodes(void)
+{
+    std::vector<std::vector<unsigned> > nodes;
+
+    ULONG highest_node = 0;
+    if (GetNumaHighestNodeNumber(&highest_node))
+    {
+        for (ULONG node=0; node<=highest_node; ++node)
+        {
+            ULONGLONG mask = 0;
+            if (!GetNumaNodeProcessorMask(UCHAR(node), &mask))
+                continue;
+
+            std::vector<unsigned> cpus;
+            for (unsigned cpu=0; cpu<sizeof(mask)*8; ++cpu)
+            {
+                if (mask & (ULONGLONG(1) << cpu))
+                    cpus.push_back(cpu);
+            }
+            if (!cpus.empty())
+                nodes.push_back(cpus);
+        }
+    }
+    return nodes;
+}
+
+// restrict the calling thread to run on the given processors
+inline bool const set_thread_affinity(std::vector<unsigned> const &cpus)
+{
+    DWORD_PTR mask = 0;
+    for (auto cpu : cpus)
+    {
+        if (cpu < sizeof(mask)*8)
+            mask |= DWORD_PTR(1) << cpu;
+    }
+    return mask != 0  &&  SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+}
+
 #else
+#include <fstream>
+#include <sstream>
+#include <sys/resource.h>
+#include <time.h>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace mapreduce {
 
@@ -87,6 +155,90 @@ std::string get_temporary_filename(std::string &pathname)
     return res;
 }
 
+// processor time, user and kernel, used by the calling thread
+inline std::chrono::duration<double> const thread_cpu_time(void)
+{
+#if defined(RUSAGE_THREAD)
+    rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) != 0)
+        return std::chrono::duration<double>(0);
+
+    return std::chrono::duration<double>(
+        double(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+      + double(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0);
+#else
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return std::chrono::duration<double>(0);
+    return std::chrono::duration<double>(double(ts.tv_sec) + double(ts.tv_nsec) / 1000000000.0);
+#endif
+}
+
+namespace detail {
+
+// parse a sysfs list such as "0-3,8-11"
+inline std::vector<unsigned> const read_sysfs_list(std::string const &pathname)
+{
+    std::vector<unsigned> values;
+
+    std::ifstream file(pathname.c_str());
+    std::string list;
+    if (!std::getline(file, list))
+        return values;
+
+    std::istringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ','))
+    {
+        unsigned first = 0, last = 0;
+        char dash = 0;
+        std::istringstream values_in_range(range);
+        if (!(values_in_range >> first))
+            continue;
+        if (!(values_in_range >> dash >> last)  ||  dash != '-')
+            last = first;
+
+        for (unsigned value=first; value<=last; ++value)
+            values.push_back(value);
+    }
+    return values;
+}
+
+}   // namespace detail
+
+// the processors of each NUMA node, from sysfs
+inline std::vector<std::vector<unsigned> > const numa_nodes(void)
+{
+    std::vector<std::vector<unsigned> > nodes;
+    for (auto node : detail::read_sysfs_list("/sys/devices/system/node/online"))
+    {
+        std::ostringstream pathname;
+        pathname << "/sys/devices/system/node/node" << node << "/cpulist";
+
+        std::vector<unsigned> cpus = detail::read_sysfs_list(pathname.str());
+        if (!cpus.empty())
+            nodes.push_back(cpus);
+    }
+    return nodes;
+}
+
+// restrict the calling thread to run on the given processors
+inline bool const set_thread_affinity(std::vector<unsigned> const &cpus)
+{
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (auto cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &cpu_set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#else
+    return false;
+#endif
+}
+
 #endif
 
 inline std::string const get_temporary_filename(void)
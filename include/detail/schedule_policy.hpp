@@ -2,7 +2,12 @@
 // https://github.com/cdmh/mapreduce
 
 #include "schedule_policy/sequential.hpp"
+#include "schedule_policy/map_concurrency.hpp"
 #include "schedule_policy/cpu_parallel.hpp"
+#include "schedule_policy/pipelined.hpp"
+#include "schedule_policy/numa_parallel.hpp"
+#include "schedule_policy/prefetching.hpp"
+#include "schedule_policy/multi_process.hpp"
 
 // Permission is hereby granted, free of charge, to any person obtaining a copy
 // of this software and associated documentation files (the "Software"), to deal
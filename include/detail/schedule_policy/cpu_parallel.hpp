@@ -3,6 +3,9 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <list>
 #include <mutex>
 
 namespace mapreduce {
@@ -11,50 +14,378 @@ namespace schedule_policy {
 
 namespace detail {
 
+// state shared by the map tasks of a speculative map phase. every claimed
+// map key is in flight until one copy of it has been committed to the job,
+// or every copy that was run has failed
 template<typename Job>
-inline void run_next_map_task(Job &job, std::mutex &m1, std::mutex &m2, results &result)
+class speculative_map : mapreduce::detail::noncopyable
 {
-    try
+  public:
+    typedef typename Job::map_task_type::key_type   key_type;
+    typedef typename Job::map_task_type::value_type value_type;
+
+    struct map_key
     {
-        bool run = true;
-        while (run)
+        explicit map_key(key_type const &k)
+          : key(k),
+            started(false),
+            speculated(false),
+            committed(false),
+            running(0)
         {
-            typename Job::map_task_type::key_type *key = 0;
+        }
+
+        // the members other than the key are guarded by the mutex. the data
+        // that the key was first run on is shared with its speculative copy,
+        // as a datasource need not return the same data for a key twice;
+        // directory_iterator returns the next segment of a file, say
+        key_type                              key;
+        std::shared_ptr<value_type>           value;
+        std::chrono::system_clock::time_point start_time;
+        bool                                  started;
+        bool                                  speculated;
+        bool                                  committed;    // a copy has been committed, or the key given up
+        size_t                                running;      // copies being run
+    };
+    typedef std::shared_ptr<map_key> map_key_ptr;
 
-            m1.lock();
-            run = job.get_next_map_key(key);
-            m1.unlock();
+    explicit speculative_map(size_t const map_tasks)
+      : claimers_(map_tasks),
+        claiming_(0),
+        keys_exhausted_(false)
+    {
+    }
 
-            if (run)
-                job.run_map_task(key, result, m2);
+    // claim the next batch of map keys and put them in flight. claims in
+    // progress are counted so that the map phase is never seen to be
+    // complete while keys are between the datasource and the in-flight list
+    bool const claim(Job &job, std::vector<key_type> &keys, std::vector<map_key_ptr> &claimed, results &result)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++claiming_;
         }
+
+        bool more = false;
+        claimed.clear();
+        try
+        {
+            more = job.get_next_map_keys(keys, key_mutex_, result);
+            if (more)
+            {
+                for (auto const &key : keys)
+                    claimed.push_back(std::make_shared<map_key>(key));
+            }
+        }
+        catch (std::exception &)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --claiming_;
+            cv_.notify_all();
+            throw;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        --claiming_;
+        if (more)
+            std::copy(claimed.cbegin(), claimed.cend(), std::back_inserter(in_flight_));
+        else
+            keys_exhausted_ = true;
+        cv_.notify_all();
+        return more;
+    }
+
+    // a map task has stopped claiming keys
+    void claims_finished(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --claimers_;
+        cv_.notify_all();
+    }
+
+    void started(map_key &key, std::shared_ptr<value_type> const &value)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        key.value      = value;
+        key.start_time = std::chrono::system_clock::now();
+        key.started    = true;
+        key.running    = 1;
+    }
+
+    // give up on a key that cannot be run, such as when its data cannot be
+    // read, so that the map phase does not wait for it
+    void discard(map_key_ptr const &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!key->committed)
+        {
+            key->committed = true;
+            in_flight_.remove(key);
+            cv_.notify_all();
+        }
+    }
+
+    // the longest running key that has not yet been speculatively re-run
+    map_key_ptr next_straggler(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        map_key_ptr straggler;
+        for (auto const &key : in_flight_)
+        {
+            if (key->started  &&  !key->speculated  &&  !key->committed
+            &&  (!straggler  ||  key->start_time < straggler->start_time))
+            {
+                straggler = key;
+            }
+        }
+
+        if (straggler)
+        {
+            straggler->speculated = true;
+            ++straggler->running;
+        }
+        return straggler;
+    }
+
+    // the waiting thread does not run queued tasks while it waits, as it
+    // would not be able to return until the task had finished, and that
+    // task could be the straggler that is being raced
+    void wait_for_completion(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return is_complete(); });
+    }
+
+    // a copy of a map key has been run. the first copy to succeed has its
+    // intermediate results merged into the job, and its checkpoint kept,
+    // serialised through the commit mutex. a copy that fails leaves the key
+    // to the copies still running, and the key is given up only when the
+    // last of them fails. returns true if the copy decided the key
+    bool const commit(
+        Job                                    &job,
+        map_key_ptr                      const &key,
+        bool                             const  succeeded,
+        typename Job::intermediate_store_type  &intermediate_store,
+        typename Job::pending_checkpoint       &checkpoint,
+        results                                &result)
+    {
+        if (!finish(*key, succeeded))
+            return false;
+
+        if (succeeded)
+        {
+            try
+            {
+                auto const lock_time = std::chrono::system_clock::now();
+                std::lock_guard<std::mutex> lock(commit_mutex_);
+                result.lock_wait_time += std::chrono::system_clock::now() - lock_time;
+                job.merge_intermediate_results(intermediate_store);
+                job.commit_checkpoint(checkpoint);
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "\nError: " << e.what() << "\n";
+            }
+        }
+        remove(key);
+        return true;
+    }
+
+
+  private:
+    // a copy of a key has finished. returns true if the copy decides the key
+    bool const finish(map_key &key, bool const succeeded)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --key.running;
+        if (key.committed  ||  (!succeeded  &&  key.running > 0))
+            return false;
+        key.committed = true;
+        return true;
+    }
+
+    // the map phase is complete once every key has been claimed and one
+    // copy of each has been committed. if every map task has stopped
+    // claiming keys without exhausting the datasource, after an error,
+    // then there are no more keys to wait for
+    bool const is_complete(void) const
+    {
+        return (keys_exhausted_  ||  claimers_ == 0)  &&  claiming_ == 0  &&  in_flight_.empty();
+    }
+
+    void remove(map_key_ptr const &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        in_flight_.remove(key);
+        cv_.notify_all();
+    }
+
+  private:
+    std::mutex                 mutex_;
+    std::condition_variable    cv_;
+    std::mutex                 key_mutex_;      // serialises datasources without setup_keys()
+    std::mutex                 commit_mutex_;
+    std::list<map_key_ptr>     in_flight_;
+    size_t                     claimers_;       // map tasks that are still claiming keys
+    size_t                     claiming_;       // claims in progress
+    bool                       keys_exhausted_;
+};
+
+// run one copy of a map key into a store of its own, and commit it to the
+// job if it succeeds and no other copy has been committed. the statistics
+// of a copy are recorded only if it decided the key. returns true if the
+// copy's results were committed
+template<typename Job>
+inline bool const run_speculative_map_key(
+    Job                                                   &job,
+    speculative_map<Job>                                  &state,
+    typename speculative_map<Job>::map_key_ptr      const &key,
+    results                                               &result)
+{
+    results                               key_result;
+    typename Job::intermediate_store_type intermediate_store(job.number_of_partitions());
+    typename Job::pending_checkpoint      checkpoint;
+    bool succeeded = false;
+    try
+    {
+        succeeded = job.run_map_task(key->key, *key->value, key_result, intermediate_store, checkpoint);
+        job.combine_intermediate_results(intermediate_store);
     }
     catch (std::exception &e)
     {
         std::cerr << "\nError: " << e.what() << "\n";
+        ++key_result.counters.map_key_errors;
+        succeeded = false;
     }
+
+    if (!state.commit(job, key, succeeded, intermediate_store, checkpoint, key_result))
+        return false;
+
+    result.lock_wait_time              += key_result.lock_wait_time;
+    result.counters.map_keys_executed  += key_result.counters.map_keys_executed;
+    result.counters.map_key_errors     += key_result.counters.map_key_errors;
+    result.counters.map_keys_completed += key_result.counters.map_keys_completed;
+    result.counters.map_keys_restored  += key_result.counters.map_keys_restored;
+    std::copy(
+        key_result.map_times.cbegin(),
+        key_result.map_times.cend(),
+        std::back_inserter(result.map_times));
+    return succeeded;
 }
 
+// a map task that claims and runs map keys until the datasource is exhausted,
+// and then re-runs the slowest map keys that are still running on other
+// threads. it can continue running after the map phase is complete, if it
+// is running a copy of a key that has been committed by another task
 template<typename Job>
-inline void run_next_reduce_task(Job &job, size_t &partition, std::mutex &mutex, results &result)
+inline void run_speculative_map_tasks(Job &job, std::shared_ptr<speculative_map<Job> > const &state, results &result)
 {
+    typedef typename speculative_map<Job>::map_key_ptr map_key_ptr;
+    typedef typename Job::map_task_type::value_type    value_type;
+
+    std::vector<typename Job::map_task_type::key_type> keys;
+    std::vector<map_key_ptr> claimed;
     try
     {
-        // local lambda to increment the partition within a lock
-        auto incr_partition = [&partition, &mutex] {
-            std::lock_guard<std::mutex> guard(mutex);
-            size_t const part = partition++;
-            return part;
-        };
+        while (state->claim(job, keys, claimed, result))
+        {
+            for (auto const &key : claimed)
+            {
+                // get some data
+                auto value = std::make_shared<value_type>();
+                if (!job.get_map_data(key->key, *value))
+                {
+                    ++result.counters.map_keys_executed;
+                    ++result.counters.map_key_errors;
+                    state->discard(key);
+                    continue;
+                }
+
+                state->started(*key, value);
+                run_speculative_map_key(job, *state, key, result);
+            }
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "\nError: " << e.what() << "\n";
+
+        // keys that this task has claimed but not run would never complete
+        std::for_each(claimed.cbegin(), claimed.cend(), std::bind(&speculative_map<Job>::discard, state.get(), std::placeholders::_1));
+    }
+    state->claims_finished();
+
+    // a straggler is re-run on the data its first copy was given
+    while (map_key_ptr key = state->next_straggler())
+    {
+        if (run_speculative_map_key(job, *state, key, result))
+            ++result.counters.speculative_wins;
+    }
+}
+
+// combine the results of the tasks of a job
+inline void collate_results(std::vector<std::shared_ptr<results> > const &all_results, results &result)
+{
+    for (auto it=all_results.cbegin(); it!=all_results.cend(); ++it)
+    {
+        result.lock_wait_time                 += (*it)->lock_wait_time;
+        result.counters.map_keys_executed     += (*it)->counters.map_keys_executed;
+        result.counters.map_key_errors        += (*it)->counters.map_key_errors;
+        result.counters.map_keys_completed    += (*it)->counters.map_keys_completed;
+        result.counters.reduce_keys_executed  += (*it)->counters.reduce_keys_executed;
+        result.counters.reduce_key_errors     += (*it)->counters.reduce_key_errors;
+        result.counters.reduce_keys_completed += (*it)->counters.reduce_keys_completed;
+        result.counters.speculative_wins      += (*it)->counters.speculative_wins;
+        result.counters.map_keys_restored     += (*it)->counters.map_keys_restored;
 
-        while (1)
+        std::copy(
+            (*it)->map_times.cbegin(),
+            (*it)->map_times.cend(),
+            std::back_inserter(result.map_times));
+        std::copy(
+            (*it)->merge_times.cbegin(),
+            (*it)->merge_times.cend(),
+            std::back_inserter(result.merge_times));
+        std::copy(
+            (*it)->shuffle_times.cbegin(),
+            (*it)->shuffle_times.cend(),
+            std::back_inserter(result.shuffle_times));
+        std::copy(
+            (*it)->reduce_times.cbegin(),
+            (*it)->reduce_times.cend(),
+            std::back_inserter(result.reduce_times));
+    }
+}
+
+template<typename Job>
+inline void merge_intermediate_results(
+    Job                                                                  &job,
+    size_t                                                         const  partition,
+    std::vector<std::unique_ptr<typename Job::intermediate_store_type> > &intermediate_stores,
+    results                                                              &result)
+{
+    try
+    {
+        auto const start_time = std::chrono::system_clock::now();
+        for (auto &intermediate_store : intermediate_stores)
         {
-            size_t const part = incr_partition();
-            if (part < job.number_of_partitions())
-                job.run_reduce_task(part, result);
-            else
-                break;
+            if (intermediate_store)
+                job.merge_intermediate_results(partition, *intermediate_store);
         }
+        result.merge_times.push_back(std::chrono::system_clock::now() - start_time);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "\nError: " << e.what() << "\n";
+    }
+}
+
+template<typename Job>
+inline void run_reduce_task(Job &job, size_t const partition, results &result)
+{
+    try
+    {
+        job.run_reduce_task(partition, result);
     }
     catch (std::exception &e)
     {
@@ -84,100 +415,143 @@ template<typename Job>
 class cpu_parallel : mapreduce::detail::noncopyable
 {
   public:
-    cpu_parallel() : num_cpus_(std::max(1U, std::thread::hardware_concurrency()))
+    cpu_parallel()
+      : pool_(thread_pool::shared_pool()),
+        num_cpus_(unsigned(pool_->size()))
+    {
+    }
+
+    explicit cpu_parallel(std::shared_ptr<thread_pool> const &pool)
+      : pool_(pool),
+        num_cpus_(unsigned(pool_->size()))
     {
     }
 
     void operator()(Job &job, results &result)
     {
-        map(job, result);
+        // copies of map keys that lose a speculative race are left to
+        // finish while the job continues, and are waited for here
+        mapreduce::detail::task_group speculative_group(*pool_);
+
+        if (job.speculative_execution())
+            map_speculative(job, speculative_group, result);
+        else
+            map(job, result);
         intermediate(job, result);
         reduce(job, result);
+        speculative_group.wait();
         collate_results(result);
         result.counters.num_result_files = job.number_of_partitions();
     }
 
   private:
-    void map(Job &job, results &result)
+    void map_speculative(Job &job, mapreduce::detail::task_group &speculative_group, results &result)
     {
-        // run the Map Tasks
+        // run the Map Tasks, each map key in a store of its own so that it
+        // can be run more than once, and only the first copy to finish kept
         auto   const start_time = std::chrono::system_clock::now();
-        size_t const map_tasks  = std::max(size_t(num_cpus_), std::min(size_t(num_cpus_), job.number_of_map_tasks()));
+        size_t const map_tasks  = detail::fixed_map_tasks(job, num_cpus_);
 
-        std::mutex m1, m2;
-        mapreduce::detail::joined_thread_group map_threads;
+        auto state = std::make_shared<detail::speculative_map<Job> >(map_tasks);
         for (size_t loop=0; loop<map_tasks; ++loop)
         {
             auto this_result = std::make_shared<results>();
             all_results_.push_back(this_result);
 
-            map_threads.emplace_back(
-                std::thread(
-                    std::bind(
-                        &detail::run_next_map_task<Job>,
-                        std::ref(job),
-                        std::ref(m1),
-                        std::ref(m2),
-                        std::ref(*this_result))));
+            speculative_group.run(
+                std::bind(
+                    &detail::run_speculative_map_tasks<Job>,
+                    std::ref(job),
+                    state,
+                    std::ref(*this_result)));
         }
-        map_threads.join_all();
+        state->wait_for_completion();
+
         result.map_runtime = std::chrono::system_clock::now() - start_time;
         result.counters.actual_map_tasks = map_tasks;
     }
 
-    void intermediate(Job &job, results &result)
+    void map(Job &job, results &result)
     {
-        // Intermediate results shuffle
+        // run the Map Tasks. each task keeps its own intermediate store for
+        // all of the map keys it processes, so map tasks never contend for
+        // the job's store. the number of map tasks is adjusted as they run
         auto const start_time = std::chrono::system_clock::now();
 
-        mapreduce::detail::joined_thread_group shuffle_threads;
-        for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+        typedef typename Job::intermediate_store_type intermediate_store_type;
+        std::vector<std::unique_ptr<intermediate_store_type> > intermediate_stores;
         {
-            for (size_t loop=0;
-                 loop<size_t(num_cpus_)  &&  partition<job.number_of_partitions();
-                 ++loop, ++partition)
+            detail::map_concurrency<Job> controller(job, *pool_);
+            controller.run(intermediate_stores, all_results_, result);
+        }
+        result.map_runtime = std::chrono::system_clock::now() - start_time;
+
+        // merge the map tasks' stores into the job, one task per partition
+        auto const merge_start_time = std::chrono::system_clock::now();
+        {
+            mapreduce::detail::task_group merge_group(*pool_);
+            for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
             {
                 auto this_result = std::make_shared<results>();
                 all_results_.push_back(this_result);
 
-                shuffle_threads.emplace_back(
-                    std::thread(
-                        std::bind(
-                            &detail::run_intermediate_results_shuffle<Job>,
-                            std::ref(job),
-                            partition,
-                            std::ref(*this_result))));
+                merge_group.run(
+                    std::bind(
+                        &detail::merge_intermediate_results<Job>,
+                        std::ref(job),
+                        partition,
+                        std::ref(intermediate_stores),
+                        std::ref(*this_result)));
             }
+            merge_group.wait();
         }
-        shuffle_threads.join_all();
+        result.merge_runtime = std::chrono::system_clock::now() - merge_start_time;
+    }
+
+    void intermediate(Job &job, results &result)
+    {
+        // Intermediate results shuffle, one task per partition
+        auto const start_time = std::chrono::system_clock::now();
+
+        mapreduce::detail::task_group shuffle_group(*pool_);
+        for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+        {
+            auto this_result = std::make_shared<results>();
+            all_results_.push_back(this_result);
+
+            shuffle_group.run(
+                std::bind(
+                    &detail::run_intermediate_results_shuffle<Job>,
+                    std::ref(job),
+                    partition,
+                    std::ref(*this_result)));
+        }
+        shuffle_group.wait();
         result.shuffle_runtime = std::chrono::system_clock::now() - start_time;
     }
 
     void reduce(Job &job, results &result)
     {
-        std::mutex m1;
-
-        // run the Reduce Tasks
-        mapreduce::detail::joined_thread_group reduce_threads;
+        // run the Reduce Tasks, one task per partition, largest first
         auto const start_time   = std::chrono::system_clock::now();
         auto const reduce_tasks = std::min(size_t(num_cpus_), job.number_of_partitions());
 
-        size_t partition = 0;
-        for (size_t loop=0; loop<reduce_tasks; ++loop)
+        std::vector<size_t> const partitions = detail::largest_partitions_first(job);
+
+        mapreduce::detail::task_group reduce_group(*pool_);
+        for (auto const &partition : partitions)
         {
             auto this_result = std::make_shared<results>();
             all_results_.push_back(this_result);
 
-            reduce_threads.emplace_back(
-                std::thread(
-                    std::bind(
-                        &detail::run_next_reduce_task<Job>,
-                        std::ref(job),
-                        std::ref(partition),
-                        std::ref(m1),
-                        std::ref(*this_result))));
+            reduce_group.run(
+                std::bind(
+                    &detail::run_reduce_task<Job>,
+                    std::ref(job),
+                    partition,
+                    std::ref(*this_result)));
         }
-        reduce_threads.join_all();
+        reduce_group.wait();
         result.reduce_runtime = std::chrono::system_clock::now() - start_time;
         result.counters.actual_reduce_tasks = reduce_tasks;
     }
@@ -185,34 +559,15 @@ class cpu_parallel : mapreduce::detail::noncopyable
     void collate_results(results &result)
     {
         // we're done with the map/reduce job, collate the statistics before returning
-        for (auto it=all_results_.cbegin(); it!=all_results_.cend(); ++it)
-        {
-            result.counters.map_keys_executed     += (*it)->counters.map_keys_executed;
-            result.counters.map_key_errors        += (*it)->counters.map_key_errors;
-            result.counters.map_keys_completed    += (*it)->counters.map_keys_completed;
-            result.counters.reduce_keys_executed  += (*it)->counters.reduce_keys_executed;
-            result.counters.reduce_key_errors     += (*it)->counters.reduce_key_errors;
-            result.counters.reduce_keys_completed += (*it)->counters.reduce_keys_completed;
-
-            std::copy(
-                (*it)->map_times.cbegin(),
-                (*it)->map_times.cend(),
-                std::back_inserter(result.map_times));
-            std::copy(
-                (*it)->shuffle_times.cbegin(),
-                (*it)->shuffle_times.cend(),
-                std::back_inserter(result.shuffle_times));
-            std::copy(
-                (*it)->reduce_times.cbegin(),
-                (*it)->reduce_times.cend(),
-                std::back_inserter(result.reduce_times));
-        }
+        detail::collate_results(all_results_, result);
+        all_results_.clear();
     }
 
   private:
     typedef std::vector<std::shared_ptr<results> > all_results_t;
-    all_results_t  all_results_;
-    unsigned const num_cpus_;
+    all_results_t                      all_results_;
+    std::shared_ptr<thread_pool> const pool_;
+    unsigned const                     num_cpus_;
 };
 
 }   // namespace schedule_policy
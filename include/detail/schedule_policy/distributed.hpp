@@ -0,0 +1,854 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+// the distributed schedule policies use Boost.Asio, and are not included by
+// mapreduce.hpp; include this header after it
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <boost/asio.hpp>
+
+namespace mapreduce {
+
+namespace schedule_policy {
+
+namespace detail {
+
+// the messages passed between the coordinator and the workers of a
+// distributed job, and between the workers
+enum distributed_message_type
+{
+    hello_message,              // worker to coordinator: the port on which the worker serves its partitions
+    keys_request_message,       // worker to coordinator: more map keys, and whether a map task has had enough data
+    keys_message,               // coordinator to worker: map keys; none once the map phase is complete
+    reduce_message,             // coordinator to worker: the workers and the partitions to reduce
+    partition_request_message,  // worker to worker: the intermediate results of a partition
+    partition_message,          // worker to worker: a partition's intermediate records
+    results_message,            // worker to coordinator: the worker's counters and reduced results
+    finished_message,           // coordinator to worker: every worker has returned its results
+    shutdown_message            // worker to itself: stop serving partitions
+};
+
+// the largest payload that is received. a message is not trusted, so its
+// length is not used to size a buffer without a limit; a job whose
+// partitions are larger than this needs more reduce tasks
+std::uint64_t const max_message_size = std::uint64_t(1) << 30;
+
+// reads values from the payload of a message. a value that runs past the end
+// of the payload, such as a string whose length is too long, is rejected
+class message_reader : mapreduce::detail::noncopyable
+{
+  public:
+    explicit message_reader(std::vector<char> const &payload)
+      : position_(payload.data()),
+        end_(payload.data() + payload.size())
+    {
+    }
+
+    template<typename T>
+    T const read(void)
+    {
+        T value;
+        char const *const next = mapreduce::detail::binary_codec<T>::read(position_, end_, value);
+        if (!next)
+            BOOST_THROW_EXCEPTION(std::runtime_error("distributed job message is too short"));
+        position_ = next;
+        return value;
+    }
+
+  private:
+    char const *position_;
+    char const *end_;
+};
+
+// a TCP connection that carries messages, each a type and a length followed
+// by the payload. the payload is received into a buffer of its own, so
+// blocks of records in it are aligned as they were written
+class message_connection : mapreduce::detail::noncopyable
+{
+  public:
+    explicit message_connection(boost::asio::io_service &io_service)
+      : socket_(io_service)
+    {
+    }
+
+    boost::asio::ip::tcp::socket &socket(void)
+    {
+        return socket_;
+    }
+
+    void connect(boost::asio::ip::tcp::endpoint const &endpoint)
+    {
+        socket_.connect(endpoint);
+        socket_.set_option(boost::asio::ip::tcp::no_delay(true));
+    }
+
+    void send(distributed_message_type const type, std::vector<char> const &payload=std::vector<char>())
+    {
+        std::uint64_t header[2] = { std::uint64_t(type), std::uint64_t(payload.size()) };
+        std::vector<boost::asio::const_buffer> buffers;
+        buffers.push_back(boost::asio::buffer(header, sizeof(header)));
+        buffers.push_back(boost::asio::buffer(payload));
+        boost::asio::write(socket_, buffers);
+    }
+
+    distributed_message_type const receive(std::vector<char> &payload)
+    {
+        std::uint64_t header[2];
+        boost::asio::read(socket_, boost::asio::buffer(header, sizeof(header)));
+        if (header[0] > std::uint64_t(shutdown_message))
+            BOOST_THROW_EXCEPTION(std::runtime_error("unknown distributed job message"));
+        else if (header[1] > max_message_size)
+            BOOST_THROW_EXCEPTION(std::runtime_error("distributed job message is too long"));
+        payload.resize(size_t(header[1]));
+        boost::asio::read(socket_, boost::asio::buffer(payload));
+        return distributed_message_type(header[0]);
+    }
+
+    // receive a message that must be of the given type
+    void receive(distributed_message_type const type, std::vector<char> &payload)
+    {
+        if (receive(payload) != type)
+            BOOST_THROW_EXCEPTION(std::runtime_error("unexpected distributed job message"));
+    }
+
+  private:
+    boost::asio::ip::tcp::socket socket_;
+};
+
+// the counters that a worker returns to the coordinator with its results
+inline void write_counters(mapreduce::detail::buffer_writer &writer, results const &result)
+{
+    std::uint64_t const counters[] = {
+        result.counters.map_keys_executed,
+        result.counters.map_key_errors,
+        result.counters.map_keys_completed,
+        result.counters.reduce_keys_executed,
+        result.counters.reduce_key_errors,
+        result.counters.reduce_keys_completed };
+    writer.write(counters, sizeof(counters));
+}
+
+inline void read_counters(message_reader &reader, results &result)
+{
+    result.counters.map_keys_executed     = size_t(reader.read<std::uint64_t>());
+    result.counters.map_key_errors        = size_t(reader.read<std::uint64_t>());
+    result.counters.map_keys_completed    = size_t(reader.read<std::uint64_t>());
+    result.counters.reduce_keys_executed  = size_t(reader.read<std::uint64_t>());
+    result.counters.reduce_key_errors     = size_t(reader.read<std::uint64_t>());
+    result.counters.reduce_keys_completed = size_t(reader.read<std::uint64_t>());
+}
+
+}   // namespace detail
+
+// the coordinator of a distributed job. it listens for the workers, hands
+// out map keys from the job's datasource as the workers ask for them, and
+// when the map phase is complete assigns the partitions to the workers to
+// reduce. the workers return their reduced results, which are stored in
+// the job so that they are available from begin_results().
+//
+// the map keys given to a worker that fails before the map phase is
+// complete are given to the other workers; results::counters::
+// failed_map_processes counts the workers that failed. the partitions of a
+// worker that fails after the map phase are lost, and counted as reduce
+// errors
+template<typename Job>
+class distributed_coordinator : mapreduce::detail::noncopyable
+{
+  public:
+    // listen on 'port' for 'workers' workers. a port of zero lets the system
+    // choose one, which is returned by port(). the coordinator listens on
+    // the loopback interface unless it is given the 'address' of another,
+    // or "0.0.0.0" for every interface. the connections are not
+    // authenticated, so workers on other machines must be on a trusted
+    // network
+    distributed_coordinator(unsigned short const port, size_t const workers, std::string const &address="127.0.0.1")
+      : acceptor_(io_service_, boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(address), port)),
+        num_workers_(workers)
+    {
+    }
+
+    unsigned short const port(void) const
+    {
+        return acceptor_.local_endpoint().port();
+    }
+
+    void operator()(Job &job, results &result)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+        map_start_time_ = start_time;
+        num_partitions_ = job.number_of_partitions();
+
+        workers_.clear();
+        retry_keys_.clear();
+        keys_exhausted_ = false;
+        map_done_       = false;
+        waiting_        = 0;
+        live_           = num_workers_;
+        finished_       = 0;
+
+        for (size_t loop=0; loop<num_workers_; ++loop)
+        {
+            workers_.emplace_back(new worker(io_service_));
+            acceptor_.accept(workers_.back()->connection.socket());
+            workers_.back()->connection.socket().set_option(boost::asio::ip::tcp::no_delay(true));
+        }
+
+        {
+            mapreduce::detail::joined_thread_group threads;
+            for (size_t loop=0; loop<num_workers_; ++loop)
+            {
+                auto this_result = std::make_shared<results>();
+                all_results_.push_back(this_result);
+
+                threads.emplace_back(
+                    std::thread(
+                        &distributed_coordinator::serve_worker,
+                        this,
+                        std::ref(job),
+                        loop,
+                        std::ref(*this_result)));
+            }
+        }
+        result.map_runtime = map_runtime_;
+        result.reduce_runtime = std::chrono::system_clock::now() - start_time - map_runtime_;
+        result.counters.actual_map_tasks    = num_workers_;
+        result.counters.actual_reduce_tasks = std::min(job.number_of_partitions(), live_);
+        result.counters.num_result_files    = job.number_of_partitions();
+
+        // we're done with the map/reduce job, collate the statistics before returning
+        detail::collate_results(all_results_, result);
+        for (auto const &this_result : all_results_)
+            result.counters.failed_map_processes += this_result->counters.failed_map_processes;
+        all_results_.clear();
+        workers_.clear();
+    }
+
+  private:
+    typedef typename Job::map_task_type::key_type      key_type;
+    typedef typename Job::reduce_task_type::key_type   reduce_key_type;
+    typedef typename Job::reduce_task_type::value_type reduce_value_type;
+
+    struct worker
+    {
+        explicit worker(boost::asio::io_service &io_service)
+          : connection(io_service),
+            port(0),
+            alive(true)
+        {
+        }
+
+        detail::message_connection connection;
+        std::string                address;     // address and port on which the worker serves its partitions
+        unsigned short             port;
+        std::vector<key_type>      keys;        // map keys given to the worker
+        std::vector<size_t>        partitions;  // partitions the worker reduces
+        bool                       alive;
+    };
+
+    void serve_worker(Job &job, size_t const index, results &result)
+    {
+        worker &w = *workers_[index];
+        try
+        {
+            std::vector<char> payload;
+            w.connection.receive(detail::hello_message, payload);
+            {
+                detail::message_reader reader(payload);
+                w.address = w.connection.socket().remote_endpoint().address().to_string();
+                w.port    = reader.read<std::uint16_t>();
+            }
+
+            // hand out map keys until the map phase is complete
+            for (;;)
+            {
+                w.connection.receive(detail::keys_request_message, payload);
+                if (detail::message_reader(payload).read<std::uint8_t>())
+                    job.enough_data();
+
+                std::vector<key_type> keys;
+                next_map_keys(job, w, keys, result);
+
+                payload.clear();
+                mapreduce::detail::buffer_writer writer(payload);
+                std::uint64_t const count = keys.size();
+                writer.write(&count, sizeof(count));
+                for (auto const &key : keys)
+                    mapreduce::detail::binary_codec<key_type>::write(writer, key);
+                w.connection.send(detail::keys_message, payload);
+
+                if (keys.empty())
+                    break;
+            }
+
+            // the workers, and the partitions that this worker reduces
+            payload.clear();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                mapreduce::detail::buffer_writer writer(payload);
+                std::uint64_t const num_peers = peers_.size();
+                writer.write(&num_peers, sizeof(num_peers));
+                for (auto const peer : peers_)
+                {
+                    std::uint64_t const is_self = (peer == index);
+                    writer.write(&is_self, sizeof(is_self));
+                    mapreduce::detail::binary_codec<std::string>::write(writer, workers_[peer]->address);
+                    mapreduce::detail::binary_codec<std::uint16_t>::write(writer, workers_[peer]->port);
+                }
+                std::uint64_t const num_partitions = w.partitions.size();
+                writer.write(&num_partitions, sizeof(num_partitions));
+                for (auto const partition : w.partitions)
+                {
+                    std::uint64_t const p = partition;
+                    writer.write(&p, sizeof(p));
+                }
+            }
+            w.connection.send(detail::reduce_message, payload);
+
+            // the worker's counters and its reduced results
+            w.connection.receive(detail::results_message, payload);
+            {
+                detail::message_reader reader(payload);
+                detail::read_counters(reader, result);
+
+                std::uint64_t const count = reader.read<std::uint64_t>();
+                std::lock_guard<std::mutex> lock(results_mutex_);
+                for (std::uint64_t loop=0; loop<count; ++loop)
+                {
+                    reduce_key_type   const key   = reader.read<reduce_key_type>();
+                    reduce_value_type const value = reader.read<reduce_value_type>();
+                    job.insert_result(key, value);
+                }
+            }
+
+            // the workers serve their partitions to each other until every
+            // worker has returned its results
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ++finished_;
+                finished_changed_.notify_all();
+                finished_changed_.wait(lock, [this]() { return finished_ == live_; });
+            }
+            w.connection.send(detail::finished_message);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+            worker_failed(w, result);
+        }
+    }
+
+    // the next map keys for a worker, which are none once the map phase is
+    // complete. a worker that asks for keys when there are none waits, as
+    // another worker may fail and leave keys to be run again; the map phase
+    // is complete once every worker is waiting
+    void next_map_keys(Job &job, worker &w, std::vector<key_type> &keys, results &result)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++waiting_;
+        for (;;)
+        {
+            if (map_done_)
+                break;
+            else if (!retry_keys_.empty())
+            {
+                keys.push_back(retry_keys_.front());
+                retry_keys_.pop_front();
+                break;
+            }
+            else if (!keys_exhausted_)
+            {
+                detail::null_lock nolock;
+                if (job.get_next_map_keys(keys, nolock, result))
+                    break;
+                keys_exhausted_ = true;
+            }
+            else if (waiting_ == live_)
+            {
+                complete_map_phase();
+                break;
+            }
+            else
+                keys_changed_.wait(lock);
+        }
+        --waiting_;
+        std::copy(keys.begin(), keys.end(), std::back_inserter(w.keys));
+    }
+
+    // assign the partitions to the workers that are alive, in turn
+    void complete_map_phase(void)
+    {
+        map_done_    = true;
+        map_runtime_ = std::chrono::system_clock::now() - map_start_time_;
+
+        peers_.clear();
+        for (size_t loop=0; loop<workers_.size(); ++loop)
+        {
+            if (workers_[loop]->alive)
+                peers_.push_back(loop);
+        }
+
+        for (size_t partition=0; !peers_.empty()  &&  partition<num_partitions_; ++partition)
+            workers_[peers_[partition % peers_.size()]]->partitions.push_back(partition);
+        keys_changed_.notify_all();
+    }
+
+    void worker_failed(worker &w, results &result)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        w.alive = false;
+        --live_;
+        if (!map_done_)
+        {
+            // the worker's intermediate results are lost, so its keys are run again
+            std::copy(w.keys.begin(), w.keys.end(), std::back_inserter(retry_keys_));
+            ++result.counters.failed_map_processes;
+            keys_changed_.notify_all();
+        }
+        else
+        {
+            result.counters.reduce_key_errors += w.partitions.size();
+            finished_changed_.notify_all();
+        }
+    }
+
+  private:
+    typedef std::vector<std::shared_ptr<results> > all_results_t;
+
+    boost::asio::io_service                       io_service_;
+    boost::asio::ip::tcp::acceptor                acceptor_;
+    size_t const                                  num_workers_;
+    std::vector<std::unique_ptr<worker> >         workers_;
+    all_results_t                                 all_results_;
+
+    std::mutex                                    mutex_;
+    std::condition_variable                       keys_changed_;       // keys are to be run again, or the map phase is complete
+    std::condition_variable                       finished_changed_;   // a worker has returned its results, or has failed
+    std::deque<key_type>                          retry_keys_;
+    bool                                          keys_exhausted_;     // the datasource has no more keys
+    bool                                          map_done_;
+    size_t                                        waiting_;            // workers waiting for map keys
+    size_t                                        live_;               // workers that have not failed
+    size_t                                        finished_;           // workers that have returned their results
+    std::vector<size_t>                           peers_;              // workers that reduce the partitions
+    size_t                                        num_partitions_;
+    std::chrono::system_clock::time_point         map_start_time_;
+    std::chrono::duration<double>                 map_runtime_;
+    std::mutex                                    results_mutex_;
+};
+
+// a worker of a distributed job. it connects to the coordinator, runs map
+// tasks on the keys that it is given, with data from its own datasource, and
+// serves its intermediate results to the other workers over TCP. it then
+// reduces the partitions that it is assigned, pulling each from every
+// worker, and returns the results to the coordinator.
+//
+// the worker's datasource must be able to read the data of a key that it
+// did not set up, so the key must identify its data; directory_iterator with
+// std::ifstream values does. intermediate values must be trivially copyable,
+// and keys trivially copyable or std::string, as must the map keys
+template<typename Job, typename KeyCompare=std::less<typename Job::reduce_task_type::key_type> >
+class distributed_worker : mapreduce::detail::noncopyable
+{
+  public:
+    distributed_worker(std::string const &coordinator_address, unsigned short const coordinator_port)
+      : coordinator_(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(coordinator_address), coordinator_port)),
+        pool_(thread_pool::shared_pool()),
+        num_cpus_(unsigned(pool_->size()))
+    {
+    }
+
+    distributed_worker(std::string const &coordinator_address, unsigned short const coordinator_port, std::shared_ptr<thread_pool> const &pool)
+      : coordinator_(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(coordinator_address), coordinator_port)),
+        pool_(pool),
+        num_cpus_(unsigned(pool_->size()))
+    {
+    }
+
+    void operator()(Job &job, results &result)
+    {
+        boost::asio::io_service io_service;
+        detail::message_connection coordinator(io_service);
+        connect(coordinator);
+
+        // serve partitions on the address that reaches the coordinator
+        boost::asio::ip::tcp::acceptor acceptor(
+            io_service,
+            boost::asio::ip::tcp::endpoint(coordinator.socket().local_endpoint().address(), 0));
+
+        std::vector<char> payload;
+        {
+            mapreduce::detail::buffer_writer writer(payload);
+            mapreduce::detail::binary_codec<std::uint16_t>::write(writer, acceptor.local_endpoint().port());
+        }
+        coordinator.send(detail::hello_message, payload);
+
+        map(job, coordinator, result);
+
+        // the workers and the partitions to reduce
+        coordinator.receive(detail::reduce_message, payload);
+        detail::message_reader reader(payload);
+        peers_.clear();
+        for (std::uint64_t loop=reader.read<std::uint64_t>(); loop>0; --loop)
+        {
+            bool           const is_self = (reader.read<std::uint64_t>() != 0);
+            std::string    const address = reader.read<std::string>();
+            std::uint16_t  const port    = reader.read<std::uint16_t>();
+            peers_.push_back(std::make_pair(is_self, boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(address), port)));
+        }
+        std::vector<size_t> partitions;
+        for (std::uint64_t loop=reader.read<std::uint64_t>(); loop>0; --loop)
+            partitions.push_back(size_t(reader.read<std::uint64_t>()));
+
+        std::thread server(&distributed_worker::serve_partitions, this, std::ref(io_service), std::ref(acceptor));
+        try
+        {
+            reduce(job, partitions, result);
+            collate_results(result);
+
+            // return the counters and the results to the coordinator
+            payload.clear();
+            mapreduce::detail::buffer_writer writer(payload);
+            detail::write_counters(writer, result);
+            std::uint64_t const count = std::uint64_t(std::distance(job.begin_results(), job.end_results()));
+            writer.write(&count, sizeof(count));
+            for (auto it=job.begin_results(); it!=job.end_results(); ++it)
+            {
+                mapreduce::detail::binary_codec<typename Job::reduce_task_type::key_type>::write(writer, it->first);
+                mapreduce::detail::binary_codec<typename Job::reduce_task_type::value_type>::write(writer, it->second);
+            }
+            coordinator.send(detail::results_message, payload);
+            coordinator.receive(detail::finished_message, payload);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+        }
+
+        // stop serving partitions
+        try
+        {
+            detail::message_connection self(io_service);
+            self.connect(acceptor.local_endpoint());
+            self.send(detail::shutdown_message);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+        }
+        server.join();
+        result.counters.num_result_files = partitions.size();
+    }
+
+  private:
+    typedef typename Job::map_task_type::key_type                   key_type;
+    typedef typename Job::intermediate_store_type                   intermediate_store_type;
+    typedef std::vector<std::unique_ptr<intermediate_store_type> >  intermediate_stores_t;
+    typedef std::pair<bool, boost::asio::ip::tcp::endpoint>         peer_t;     // is this worker, and the address of the peer
+
+    // the coordinator may still be starting
+    void connect(detail::message_connection &coordinator)
+    {
+        for (unsigned attempt=0; ; ++attempt)
+        {
+            try
+            {
+                coordinator.connect(coordinator_);
+                return;
+            }
+            catch (boost::system::system_error &)
+            {
+                if (attempt == 50)
+                    throw;
+                coordinator.socket().close();
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        }
+    }
+
+    // map keys are asked for one batch at a time, by whichever map task
+    // has run out
+    class map_keys : mapreduce::detail::noncopyable
+    {
+      public:
+        map_keys(Job &job, detail::message_connection &coordinator)
+          : job_(job),
+            coordinator_(coordinator),
+            exhausted_(false)
+        {
+        }
+
+        bool const next(key_type &key)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (keys_.empty()  &&  !exhausted_)
+            {
+                std::vector<char> payload(1, char(job_.has_enough_data()));
+                coordinator_.send(detail::keys_request_message, payload);
+                coordinator_.receive(detail::keys_message, payload);
+
+                detail::message_reader reader(payload);
+                for (std::uint64_t loop=reader.read<std::uint64_t>(); loop>0; --loop)
+                    keys_.push_back(reader.read<key_type>());
+                exhausted_ = keys_.empty();
+            }
+
+            if (keys_.empty())
+                return false;
+            key = keys_.front();
+            keys_.pop_front();
+            return true;
+        }
+
+      private:
+        Job                        &job_;
+        detail::message_connection &coordinator_;
+        std::deque<key_type>        keys_;
+        bool                        exhausted_;     // the map phase is complete
+        std::mutex                  mutex_;
+    };
+
+    static void run_map_tasks(Job &job, map_keys &keys, intermediate_store_type &intermediate_store, results &result)
+    {
+        try
+        {
+            key_type key;
+            while (keys.next(key))
+                job.run_map_task(key, result, intermediate_store);
+
+            // consolidate everything the task has mapped, once
+            job.combine_intermediate_results(intermediate_store);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+        }
+    }
+
+    static void merge_partition(size_t const partition, intermediate_store_type &store, intermediate_stores_t &intermediate_stores)
+    {
+        for (auto &intermediate_store : intermediate_stores)
+            store.merge_from(partition, *intermediate_store);
+    }
+
+    void map(Job &job, detail::message_connection &coordinator, results &result)
+    {
+        auto   const start_time = std::chrono::system_clock::now();
+        size_t const map_tasks  = detail::fixed_map_tasks(job, num_cpus_);
+
+        intermediate_stores_t intermediate_stores;
+        {
+            map_keys keys(job, coordinator);
+            mapreduce::detail::task_group map_group(*pool_);
+            for (size_t loop=0; loop<map_tasks; ++loop)
+            {
+                auto this_result = std::make_shared<results>();
+                all_results_.push_back(this_result);
+                intermediate_stores.emplace_back(new intermediate_store_type(job.number_of_partitions()));
+
+                map_group.run(
+                    std::bind(
+                        &distributed_worker::run_map_tasks,
+                        std::ref(job),
+                        std::ref(keys),
+                        std::ref(*intermediate_stores.back()),
+                        std::ref(*this_result)));
+            }
+            map_group.wait();
+        }
+        result.map_runtime = std::chrono::system_clock::now() - start_time;
+        result.counters.actual_map_tasks = map_tasks;
+
+        // merge the map tasks' stores into the store that is served to the
+        // other workers, one task per partition
+        auto const merge_start_time = std::chrono::system_clock::now();
+        num_partitions_ = job.number_of_partitions();
+        store_.reset(new intermediate_store_type(num_partitions_));
+        {
+            mapreduce::detail::task_group merge_group(*pool_);
+            for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+            {
+                merge_group.run(
+                    std::bind(
+                        &distributed_worker::merge_partition,
+                        partition,
+                        std::ref(*store_),
+                        std::ref(intermediate_stores)));
+            }
+            merge_group.wait();
+        }
+        result.merge_runtime = std::chrono::system_clock::now() - merge_start_time;
+    }
+
+    // the intermediate records of one of this worker's partitions. each
+    // partition is taken once, by the worker that reduces it
+    void write_partition(size_t const partition, std::vector<char> &payload)
+    {
+        payload.clear();
+        if (partition >= num_partitions_)
+            BOOST_THROW_EXCEPTION(std::runtime_error("distributed job partition is out of range"));
+
+        mapreduce::detail::buffer_writer writer(payload);
+        mapreduce::detail::record_writer<Job, mapreduce::detail::buffer_writer> record_writer(writer);
+        store_->reduce(partition, record_writer);
+    }
+
+    void serve_connection(std::shared_ptr<detail::message_connection> const &connection, std::vector<char> request)
+    {
+        try
+        {
+            std::vector<char> payload;
+            for (;;)
+            {
+                size_t const partition = size_t(detail::message_reader(request).read<std::uint64_t>());
+                write_partition(partition, payload);
+                connection->send(detail::partition_message, payload);
+
+                if (connection->receive(request) != detail::partition_request_message)
+                    break;
+            }
+        }
+        catch (boost::system::system_error &)
+        {
+            // the reducer has closed the connection
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+        }
+    }
+
+    void serve_partitions(boost::asio::io_service &io_service, boost::asio::ip::tcp::acceptor &acceptor)
+    {
+        mapreduce::detail::joined_thread_group connections;
+        for (;;)
+        {
+            try
+            {
+                auto connection = std::make_shared<detail::message_connection>(io_service);
+                acceptor.accept(connection->socket());
+
+                std::vector<char> request;
+                if (connection->receive(request) == detail::shutdown_message)
+                    break;
+
+                connections.emplace_back(
+                    std::thread(
+                        &distributed_worker::serve_connection,
+                        this,
+                        connection,
+                        request));
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "\nError: " << e.what() << "\n";
+            }
+        }
+    }
+
+    // the intermediate results of a partition, pulled from every worker
+    class partition_source : mapreduce::detail::noncopyable
+    {
+      public:
+        explicit partition_source(distributed_worker &outer)
+          : outer_(outer)
+        {
+        }
+
+        template<typename Callback>
+        void reduce(size_t const partition, Callback &callback)
+        {
+            boost::asio::io_service io_service;
+            std::vector<std::vector<char> > payloads(outer_.peers_.size());
+            std::vector<typename mapreduce::detail::record_merger<Job, KeyCompare>::block_t> blocks;
+            for (size_t loop=0; loop<outer_.peers_.size(); ++loop)
+            {
+                if (outer_.peers_[loop].first)
+                    outer_.write_partition(partition, payloads[loop]);
+                else
+                {
+                    detail::message_connection peer(io_service);
+                    peer.connect(outer_.peers_[loop].second);
+
+                    std::vector<char> request;
+                    mapreduce::detail::buffer_writer writer(request);
+                    std::uint64_t const p = partition;
+                    writer.write(&p, sizeof(p));
+                    peer.send(detail::partition_request_message, request);
+                    peer.receive(detail::partition_message, payloads[loop]);
+
+                    // the records are used where they lie, so they must not
+                    // run past the end of the payload
+                    if (!mapreduce::detail::record_merger<Job, KeyCompare>::valid(std::make_pair(payloads[loop].data(), payloads[loop].data() + payloads[loop].size())))
+                        BOOST_THROW_EXCEPTION(std::runtime_error("distributed job partition holds malformed records"));
+                }
+                blocks.push_back(std::make_pair(payloads[loop].data(), payloads[loop].data() + payloads[loop].size()));
+            }
+            mapreduce::detail::record_merger<Job, KeyCompare>::reduce(blocks, callback);
+        }
+
+      private:
+        distributed_worker &outer_;
+    };
+
+    static void run_reduce_task(Job &job, size_t const partition, partition_source &source, results &result)
+    {
+        try
+        {
+            job.run_reduce_task(partition, source, result);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+        }
+    }
+
+    void reduce(Job &job, std::vector<size_t> const &partitions, results &result)
+    {
+        // run the Reduce Tasks, one task per partition
+        auto const start_time = std::chrono::system_clock::now();
+
+        partition_source source(*this);
+        mapreduce::detail::task_group reduce_group(*pool_);
+        for (auto const partition : partitions)
+        {
+            auto this_result = std::make_shared<results>();
+            all_results_.push_back(this_result);
+
+            reduce_group.run(
+                std::bind(
+                    &distributed_worker::run_reduce_task,
+                    std::ref(job),
+                    partition,
+                    std::ref(source),
+                    std::ref(*this_result)));
+        }
+        reduce_group.wait();
+        result.reduce_runtime = std::chrono::system_clock::now() - start_time;
+        result.counters.actual_reduce_tasks = std::min(size_t(num_cpus_), partitions.size());
+    }
+
+    void collate_results(results &result)
+    {
+        detail::collate_results(all_results_, result);
+        all_results_.clear();
+    }
+
+  private:
+    typedef std::vector<std::shared_ptr<results> > all_results_t;
+
+    boost::asio::ip::tcp::endpoint const      coordinator_;
+    std::shared_ptr<thread_pool> const        pool_;
+    unsigned const                            num_cpus_;
+    all_results_t                             all_results_;
+    std::unique_ptr<intermediate_store_type>  store_;       // the worker's intermediate results, served to the other workers
+    size_t                                    num_partitions_;
+    std::vector<peer_t>                       peers_;
+};
+
+}   // namespace schedule_policy
+
+}   // namespace mapreduce
+
@@ -0,0 +1,314 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+
+namespace mapreduce {
+
+namespace schedule_policy {
+
+namespace detail {
+
+// the number of map tasks to use when the number is fixed for the whole of
+// the map phase; specification::map_tasks, or one per processor if it is zero
+template<typename Job>
+inline size_t const fixed_map_tasks(Job const &job, size_t const num_cpus)
+{
+    return (job.number_of_map_tasks() == 0)? num_cpus : job.number_of_map_tasks();
+}
+
+// the partitions of a job in the order their reduce tasks are to be started,
+// largest first, as 'size' measures them. reduce tasks are started in the
+// order they are submitted, so a large partition is not left to run on its
+// own at the end of the phase. partitions of the same size keep their order
+template<typename Size>
+inline std::vector<size_t> const largest_partitions_first(size_t const num_partitions, Size size)
+{
+    std::vector<std::pair<std::uintmax_t, size_t> > sizes;
+    for (size_t partition=0; partition<num_partitions; ++partition)
+        sizes.push_back(std::make_pair(size(partition), partition));
+    std::stable_sort(
+        sizes.begin(),
+        sizes.end(),
+        [](std::pair<std::uintmax_t, size_t> const &lhs, std::pair<std::uintmax_t, size_t> const &rhs)
+        {
+            return lhs.first > rhs.first;
+        });
+
+    std::vector<size_t> partitions;
+    for (auto const &partition : sizes)
+        partitions.push_back(partition.second);
+    return partitions;
+}
+
+// the partitions of a job, largest first, as the job's store measures them
+template<typename Job>
+inline std::vector<size_t> const largest_partitions_first(Job const &job)
+{
+    return largest_partitions_first(
+        job.number_of_partitions(),
+        [&job](size_t const partition)
+        {
+            return job.partition_size(partition);
+        });
+}
+
+// runs the map phase with a number of map tasks that is adjusted while the
+// phase runs. the processor time and the elapsed time of each map key are
+// measured; map keys that spend most of their time waiting for I/O lower
+// the processor utilisation, and more tasks are started so that the
+// processors are kept busy. as utilisation rises, tasks are retired until
+// there is one per processor. specification::map_tasks, if it is not zero,
+// is the maximum number of map tasks that are run at the same time.
+//
+// tasks are run on the thread pool while it has threads available for
+// them, and on threads of their own beyond that, within the pool's limit on
+// additional threads
+template<typename Job>
+class map_concurrency : mapreduce::detail::noncopyable
+{
+  public:
+    typedef typename Job::intermediate_store_type                   intermediate_store_type;
+    typedef std::vector<std::unique_ptr<intermediate_store_type> >  intermediate_stores_t;
+    typedef std::vector<std::shared_ptr<results> >                  all_results_t;
+
+    map_concurrency(Job &job, thread_pool &pool)
+      : job_(job),
+        pool_(pool),
+        num_cpus_(pool.size()),
+        max_tasks_((job.number_of_map_tasks() == 0)? pool.size() * max_oversubscription : job.number_of_map_tasks()),
+        target_tasks_(std::min(num_cpus_, max_tasks_)),
+        active_tasks_(0),
+        running_tasks_(0),
+        pool_tasks_(0),
+        tasks_started_(0),
+        keys_exhausted_(false),
+        sample_cpu_time_(0),
+        sample_elapsed_time_(0)
+    {
+    }
+
+    ~map_concurrency()
+    {
+        threads_.join_all();
+    }
+
+    // run the map phase. the stores of the map tasks and their results are
+    // added to 'intermediate_stores' and 'all_results'
+    void run(intermediate_stores_t &intermediate_stores, all_results_t &all_results, results &result)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        sample_start_time_ = start_time;
+        start_tasks(intermediate_stores, all_results);
+        result.map_concurrency.push_back(std::make_pair(std::chrono::duration<double>(0), active_tasks_));
+
+        while (running_tasks_ > 0)
+        {
+            cv_.wait_for(lock, sample_interval());
+            if (active_tasks_ > 0)
+            {
+                adjust_target_tasks();
+                start_tasks(intermediate_stores, all_results);
+            }
+
+            if (active_tasks_ != result.map_concurrency.back().second)
+                result.map_concurrency.push_back(std::make_pair(std::chrono::system_clock::now() - start_time, active_tasks_));
+        }
+        lock.unlock();
+
+        threads_.join_all();
+        result.counters.actual_map_tasks = tasks_started_;
+    }
+
+  private:
+    static size_t const max_oversubscription = 4;   // tasks per processor when map_tasks is zero
+
+    static std::chrono::milliseconds const sample_interval(void)
+    {
+        return std::chrono::milliseconds(50);
+    }
+
+    // called with the mutex held
+    void start_tasks(intermediate_stores_t &intermediate_stores, all_results_t &all_results)
+    {
+        while (active_tasks_ < target_tasks_  &&  !keys_exhausted_)
+        {
+            bool const use_pool = (pool_tasks_ < pool_.size());
+            if (!use_pool  &&  !pool_.reserve_thread())
+                break;
+
+            auto this_result = std::make_shared<results>();
+            all_results.push_back(this_result);
+            intermediate_stores.push_back(job_.make_map_task_store());
+
+            ++active_tasks_;
+            ++running_tasks_;
+            ++tasks_started_;
+
+            auto task =
+                std::bind(
+                    &map_concurrency::run_map_tasks,
+                    this,
+                    std::ref(*intermediate_stores.back()),
+                    std::ref(*this_result),
+                    use_pool);
+
+            if (use_pool)
+            {
+                ++pool_tasks_;
+                pool_.submit(task);
+            }
+            else
+                threads_.emplace_back(std::thread(task));
+        }
+    }
+
+    // called with the mutex held. the number of tasks that keep the
+    // processors busy is the number of processors divided by the fraction
+    // of a processor that each task uses. a task that is waiting for a
+    // processor also uses less than a whole one, so once the processors
+    // are saturated the target returns to one task per processor. the
+    // processors are those of the pool, one per worker, rather than of the
+    // machine, as a pool that is smaller than the machine saturates before
+    // the machine does. the target moves half way to the ideal at each
+    // sample to avoid oscillating
+    void adjust_target_tasks(void)
+    {
+        auto const now = std::chrono::system_clock::now();
+        std::chrono::duration<double> const interval = now - sample_start_time_;
+        if (sample_elapsed_time_.count() <= 0.0  ||  interval.count() <= 0.0)
+            return;
+
+        double const utilisation = std::max(0.05, std::min(1.0, sample_cpu_time_.count() / sample_elapsed_time_.count()));
+        double const saturation  = sample_cpu_time_.count() / (interval.count() * double(std::max(size_t(1), num_cpus_)));
+
+        size_t ideal = num_cpus_;
+        if (saturation < 0.9)
+            ideal = size_t(double(num_cpus_) / utilisation + 0.5);
+        ideal = std::max(size_t(1), std::min(max_tasks_, ideal));
+        target_tasks_ = (ideal > target_tasks_)? (target_tasks_ + ideal + 1) / 2 : (target_tasks_ + ideal) / 2;
+
+        sample_start_time_   = now;
+        sample_cpu_time_     = std::chrono::duration<double>(0);
+        sample_elapsed_time_ = std::chrono::duration<double>(0);
+    }
+
+    void run_map_tasks(intermediate_store_type &intermediate_store, results &result, bool const pool_task)
+    {
+        bool retired = false;
+        try
+        {
+            std::vector<typename Job::map_task_type::key_type> keys;
+            while (!(retired = retire())  &&  job_.get_next_map_keys(keys, key_mutex_, result))
+            {
+                for (auto &key : keys)
+                {
+                    auto const start_time = std::chrono::system_clock::now();
+                    auto const cpu_time   = platform::thread_cpu_time();
+                    job_.run_map_task(key, result, intermediate_store);
+
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    sample_cpu_time_     += platform::thread_cpu_time() - cpu_time;
+                    sample_elapsed_time_ += std::chrono::system_clock::now() - start_time;
+                }
+
+                // on a share of a pool, give way to the tasks of other jobs
+                // and continue when this task is next taken from the queue
+                if (pool_task  &&  pool_.yield_requested())
+                {
+                    pool_.submit(
+                        std::bind(
+                            &map_concurrency::run_map_tasks,
+                            this,
+                            std::ref(intermediate_store),
+                            std::ref(result),
+                            true));
+                    return;
+                }
+            }
+
+            // consolidate everything the task has mapped, once
+            job_.combine_intermediate_results(intermediate_store);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+        }
+
+        // a task that has not been retired has run out of keys, or failed,
+        // and no more tasks are started to replace it
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!retired)
+        {
+            keys_exhausted_ = true;
+            --active_tasks_;
+        }
+        if (pool_task)
+            --pool_tasks_;
+        else
+            pool_.release_thread();
+        --running_tasks_;
+        cv_.notify_all();
+    }
+
+    // a task is retired when there are more tasks than the target. the
+    // task leaves its intermediate store to be merged with the others
+    bool const retire(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (active_tasks_ <= target_tasks_)
+            return false;
+
+        --active_tasks_;
+        return true;
+    }
+
+  private:
+    Job                                    &job_;
+    thread_pool                            &pool_;
+    size_t const                            num_cpus_;
+    size_t const                            max_tasks_;
+    size_t                                  target_tasks_;
+    size_t                                  active_tasks_;      // tasks that are processing map keys
+    size_t                                  running_tasks_;     // active tasks and retired tasks that have not yet returned
+    size_t                                  pool_tasks_;        // tasks that are running on the pool
+    size_t                                  tasks_started_;
+    bool                                    keys_exhausted_;
+    std::chrono::system_clock::time_point   sample_start_time_;
+    std::chrono::duration<double>           sample_cpu_time_;       // processor time of the map keys completed since the sample started
+    std::chrono::duration<double>           sample_elapsed_time_;   // elapsed time of the map keys completed since the sample started
+    std::mutex                              mutex_;
+    std::mutex                              key_mutex_;         // serialises datasources without setup_keys()
+    std::condition_variable                 cv_;
+    mapreduce::detail::joined_thread_group  threads_;
+};
+
+}   // namespace detail
+
+}   // namespace schedule_policy
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,713 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#if defined(__linux__)
+#include <atomic>
+#include <new>
+#include <numeric>
+#include <sstream>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace mapreduce {
+
+namespace schedule_policy {
+
+#if defined(__linux__)
+
+namespace detail {
+
+// an area of memory shared with the processes that are forked after it
+// is created
+class shared_memory : mapreduce::detail::noncopyable
+{
+  public:
+    explicit shared_memory(size_t const size)
+      : size_(size),
+        memory_(mmap(0, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0))
+    {
+        if (memory_ == MAP_FAILED)
+            BOOST_THROW_EXCEPTION(boost::system::system_error(errno, boost::system::system_category()));
+    }
+
+    ~shared_memory()
+    {
+        munmap(memory_, size_);
+    }
+
+    char *data(void) const
+    {
+        return static_cast<char *>(memory_);
+    }
+
+  private:
+    size_t const size_;
+    void * const memory_;
+};
+
+// a named POSIX shared memory segment that holds the partitioned output of
+// one map worker process. the segment starts with the number of partitions
+// and the offset of each partition, followed by the partitions' records
+// in key order. each record is the encoded key, the number of values and
+// the values, aligned so that the values can be used where they lie
+class shared_memory_segment : mapreduce::detail::noncopyable
+{
+  public:
+    // map the segment written by a worker process, and remove its name; the
+    // memory is released when the segment is unmapped
+    explicit shared_memory_segment(std::string const &name)
+      : size_(0),
+        memory_(MAP_FAILED)
+    {
+        int const fd = shm_open(name.c_str(), O_RDONLY, 0);
+        int error = errno;
+        shm_unlink(name.c_str());
+        if (fd != -1)
+        {
+            struct stat st;
+            if (fstat(fd, &st) == 0  &&  size_t(st.st_size) >= sizeof(std::uint64_t))
+            {
+                size_ = size_t(st.st_size);
+                memory_ = mmap(0, size_, PROT_READ, MAP_SHARED, fd, 0);
+            }
+            error = errno;
+            close(fd);
+        }
+
+        if (memory_ == MAP_FAILED)
+            BOOST_THROW_EXCEPTION(boost::system::system_error(error, boost::system::system_category()));
+    }
+
+    ~shared_memory_segment()
+    {
+        munmap(memory_, size_);
+    }
+
+    size_t const num_partitions(void) const
+    {
+        return size_t(header()[0]);
+    }
+
+    // the first and one past the last byte of a partition's records
+    std::pair<char const *, char const *> const partition(size_t const partition) const
+    {
+        assert(partition < num_partitions());
+        char const *data = static_cast<char const *>(memory_);
+        return std::make_pair(data + header()[partition+1], data + header()[partition+2]);
+    }
+
+  private:
+    std::uint64_t const *header(void) const
+    {
+        return static_cast<std::uint64_t const *>(memory_);
+    }
+
+    size_t  size_;
+    void   *memory_;
+};
+
+// writes the output of a map worker process to a new named shared memory
+// segment, through a buffer
+class shared_memory_segment_writer : mapreduce::detail::noncopyable
+{
+  public:
+    shared_memory_segment_writer(std::string const &name, size_t const num_partitions)
+      : fd_(-1),
+        offset_(0),
+        offsets_(num_partitions+1, 0)
+    {
+        shm_unlink(name.c_str());
+        fd_ = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+        if (fd_ == -1)
+            BOOST_THROW_EXCEPTION(boost::system::system_error(errno, boost::system::system_category()));
+
+        // the header is written once the partitions' offsets are known
+        buffer_.reserve(buffer_size);
+        std::uint64_t const zero = 0;
+        for (size_t loop=0; loop<num_partitions+2; ++loop)
+            write(&zero, sizeof(zero));
+    }
+
+    ~shared_memory_segment_writer()
+    {
+        if (fd_ != -1)
+            close(fd_);
+    }
+
+    void start_partition(size_t const partition)
+    {
+        offsets_[partition] = offset_;
+    }
+
+    void write(void const *data, size_t const size)
+    {
+        char const *bytes = static_cast<char const *>(data);
+        buffer_.insert(buffer_.end(), bytes, bytes + size);
+        offset_ += size;
+        if (buffer_.size() >= buffer_size)
+            flush();
+    }
+
+    // pad with zeros to the next multiple of 'alignment'
+    void align(size_t const alignment)
+    {
+        static char const zeros[16] = { 0 };
+        size_t padding = mapreduce::detail::align_to(size_t(offset_), alignment) - size_t(offset_);
+        while (padding > 0)
+        {
+            size_t const size = std::min(padding, sizeof(zeros));
+            write(zeros, size);
+            padding -= size;
+        }
+    }
+
+    void finish(void)
+    {
+        offsets_.back() = offset_;
+        flush();
+
+        std::vector<std::uint64_t> header;
+        header.push_back(offsets_.size() - 1);
+        std::copy(offsets_.begin(), offsets_.end(), std::back_inserter(header));
+        if (pwrite(fd_, &header[0], header.size() * sizeof(header[0]), 0) != ssize_t(header.size() * sizeof(header[0])))
+            BOOST_THROW_EXCEPTION(boost::system::system_error(errno, boost::system::system_category()));
+    }
+
+  private:
+    void flush(void)
+    {
+        char const *data = buffer_.data();
+        size_t      size = buffer_.size();
+        while (size > 0)
+        {
+            ssize_t const written = ::write(fd_, data, size);
+            if (written == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                BOOST_THROW_EXCEPTION(boost::system::system_error(errno, boost::system::system_category()));
+            }
+            data += written;
+            size -= size_t(written);
+        }
+        buffer_.clear();
+    }
+
+    static size_t const buffer_size = 1048576;
+
+    int                        fd_;
+    std::uint64_t              offset_;
+    std::vector<std::uint64_t> offsets_;
+    std::vector<char>          buffer_;
+};
+
+// the intermediate results of a job that are held in the segments of its
+// map worker processes. a partition is reduced by merging the sorted
+// records of every segment, with the values read in place
+template<typename Job, typename KeyCompare>
+class shared_memory_partitions : mapreduce::detail::noncopyable
+{
+  public:
+    void add(std::unique_ptr<shared_memory_segment> &segment)
+    {
+        segments_.push_back(std::move(segment));
+    }
+
+    // the bytes of records that the map processes wrote for a partition
+    std::uintmax_t const partition_size(size_t const partition) const
+    {
+        std::uintmax_t size = 0;
+        for (auto const &segment : segments_)
+            size += std::uintmax_t(segment->partition(partition).second - segment->partition(partition).first);
+        return size;
+    }
+
+    template<typename Callback>
+    void reduce(size_t const partition, Callback &callback)
+    {
+        std::vector<typename mapreduce::detail::record_merger<Job, KeyCompare>::block_t> blocks;
+        for (auto const &segment : segments_)
+            blocks.push_back(segment->partition(partition));
+        mapreduce::detail::record_merger<Job, KeyCompare>::reduce(blocks, callback);
+    }
+
+  private:
+    std::vector<std::unique_ptr<shared_memory_segment> > segments_;
+};
+
+}   // namespace detail
+
+// a schedule policy that runs the map phase in worker processes, rather
+// than threads, so that each map task has a heap, and an allocator, of its
+// own. specification::processes worker processes are forked, one per
+// processor by default. the workers claim map keys from a list that is
+// made before they are forked, and each writes its combined intermediate
+// results to a POSIX shared memory segment, partitioned and in key order.
+// the reduce tasks run on the thread pool of the calling process and read
+// the intermediate values from the segments where they lie.
+//
+// a worker that crashes, or exits without writing its segment, loses the
+// output of every key that it claimed; those keys, and any that were not
+// claimed, are run again by new workers, up to max_attempts times.
+//
+// intermediate values must be trivially copyable, and keys trivially
+// copyable or std::string. KeyCompare must order keys as the intermediate
+// store does. the worker processes are forked from the calling thread, so
+// the map tasks must not rely on other threads of the process
+template<typename Job, typename KeyCompare=std::less<typename Job::reduce_task_type::key_type> >
+class multi_process : mapreduce::detail::noncopyable
+{
+  public:
+    multi_process()
+      : pool_(thread_pool::shared_pool()),
+        num_cpus_(unsigned(pool_->size()))
+    {
+    }
+
+    explicit multi_process(std::shared_ptr<thread_pool> const &pool)
+      : pool_(pool),
+        num_cpus_(unsigned(pool_->size()))
+    {
+    }
+
+    void operator()(Job &job, results &result)
+    {
+        map(job, result);
+        reduce(job, result);
+        collate_results(result);
+        result.counters.num_result_files = job.number_of_partitions();
+    }
+
+  private:
+    typedef typename Job::map_task_type::key_type            key_type;
+    typedef typename Job::map_task_type::value_type          value_type;
+    typedef typename Job::intermediate_store_type            intermediate_store_type;
+    typedef detail::shared_memory_partitions<Job, KeyCompare> partitions_t;
+
+    static size_t const max_attempts = 3;
+
+    // the state shared between the calling process and the map workers of
+    // one attempt, followed by the claim of each of its map keys
+    struct control_block
+    {
+        std::atomic<size_t> next_key;       // index of the next key to be claimed
+        std::atomic<bool>   stop;           // no more keys are to be claimed
+        std::atomic<bool>   enough_data;    // a map task signalled that the job had enough data
+    };
+
+    struct worker_counters
+    {
+        size_t map_keys_executed;
+        size_t map_key_errors;
+        size_t map_keys_completed;
+        size_t map_keys_restored;
+        double map_time;
+    };
+
+    static size_t const counters_offset(void)
+    {
+        return mapreduce::detail::align_to(sizeof(control_block), sizeof(double));
+    }
+
+    static size_t const claims_offset(size_t const workers)
+    {
+        return mapreduce::detail::align_to(counters_offset() + workers * sizeof(worker_counters), sizeof(std::atomic<int>));
+    }
+
+    static std::string const segment_name(size_t const worker)
+    {
+        std::ostringstream name;
+        name << "/mapreduce_" << getpid() << "_" << worker;
+        return name.str();
+    }
+
+    bool const read_map_data(Job &job, key_type &key, results &result, std::true_type)
+    {
+        value_type value;
+        if (!job.get_map_data(key, value))
+        {
+            ++result.counters.map_keys_executed;
+            ++result.counters.map_key_errors;
+            return false;
+        }
+        values_.push_back(value);
+        return true;
+    }
+
+    bool const read_map_data(Job &, key_type &, results &, std::false_type)
+    {
+        return true;
+    }
+
+    void run_map_key(Job &job, std::vector<key_type> const &keys, size_t const index, results &result, intermediate_store_type &intermediate_store, std::true_type)
+    {
+        value_type value = values_[index];
+        job.run_map_task(keys[index], value, result, intermediate_store);
+    }
+
+    // values that cannot be copied, such as streams, are read by the worker
+    void run_map_key(Job &job, std::vector<key_type> const &keys, size_t const index, results &result, intermediate_store_type &intermediate_store, std::false_type)
+    {
+        key_type key = keys[index];
+        job.run_map_task(key, result, intermediate_store);
+    }
+
+    // the body of a map worker process, which never returns
+    void run_map_worker(
+        Job                         &job,
+        std::vector<key_type> const &keys,
+        std::vector<size_t>   const &attempt_keys,
+        control_block               &control,
+        worker_counters             &counters,
+        std::atomic<int>            *claims,
+        int                   const  worker,
+        std::string           const &name)
+    {
+        int status = 1;
+        try
+        {
+            results result;
+            intermediate_store_type intermediate_store(job.number_of_partitions());
+            while (!control.stop)
+            {
+                size_t const index = control.next_key++;
+                if (index >= attempt_keys.size())
+                    break;
+                claims[index] = worker;
+
+                run_map_key(job, keys, attempt_keys[index], result, intermediate_store, std::is_copy_constructible<value_type>());
+                if (job.map_keys_stopped())
+                {
+                    if (job.has_enough_data())
+                        control.enough_data = true;
+                    control.stop = true;
+                }
+            }
+
+            // consolidate everything the worker has mapped, once, and write
+            // it to the worker's segment
+            job.combine_intermediate_results(intermediate_store);
+
+            detail::shared_memory_segment_writer writer(name, job.number_of_partitions());
+            mapreduce::detail::record_writer<Job, detail::shared_memory_segment_writer> record_writer(writer);
+            for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+            {
+                writer.start_partition(partition);
+                intermediate_store.reduce(partition, record_writer);
+            }
+            writer.finish();
+
+            counters.map_keys_executed  = result.counters.map_keys_executed;
+            counters.map_key_errors     = result.counters.map_key_errors;
+            counters.map_keys_completed = result.counters.map_keys_completed;
+            counters.map_keys_restored  = result.counters.map_keys_restored;
+            counters.map_time           = std::accumulate(result.map_times.begin(), result.map_times.end(), std::chrono::duration<double>(0)).count();
+            status = 0;
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+        }
+        catch (...)
+        {
+        }
+
+        // leave without running the destructors and exit handlers that
+        // belong to the calling process
+        _exit(status);
+    }
+
+    // run the map keys of one attempt in worker processes, adding the
+    // segments of the workers that succeed to the partitions, and returning
+    // the keys that are to be run again
+    std::vector<size_t> const run_attempt(Job &job, std::vector<key_type> const &keys, std::vector<size_t> const &attempt_keys, size_t &next_worker, results &result)
+    {
+        size_t const num_workers = std::min(attempt_keys.size(), (job.number_of_processes() == 0)? size_t(num_cpus_) : job.number_of_processes());
+
+        detail::shared_memory shared(claims_offset(num_workers) + attempt_keys.size() * sizeof(std::atomic<int>));
+        control_block &control = *new(shared.data()) control_block;
+        control.next_key    = 0;
+        control.stop        = false;
+        control.enough_data = false;
+
+        worker_counters  *counters = reinterpret_cast<worker_counters *>(shared.data() + counters_offset());
+        std::atomic<int> *claims   = reinterpret_cast<std::atomic<int> *>(shared.data() + claims_offset(num_workers));
+        for (size_t loop=0; loop<attempt_keys.size(); ++loop)
+            new(&claims[loop]) std::atomic<int>(-1);
+
+        // fork the workers. the output of each goes to a segment named from
+        // its number, which is unique across the attempts of the job
+        std::vector<std::pair<pid_t, std::string> > workers;
+        for (size_t loop=0; loop<num_workers; ++loop)
+        {
+            std::string const name = segment_name(next_worker++);
+            pid_t const pid = fork();
+            if (pid == 0)
+                run_map_worker(job, keys, attempt_keys, control, counters[loop], claims, int(loop), name);
+            else if (pid == -1)
+            {
+                int const error = errno;
+                control.stop = true;
+                wait_for_workers(job, control, workers);
+                for (auto const &worker : workers)
+                    shm_unlink(worker.second.c_str());
+                BOOST_THROW_EXCEPTION(boost::system::system_error(error, boost::system::system_category()));
+            }
+            workers.push_back(std::make_pair(pid, name));
+        }
+        result.counters.actual_map_tasks += num_workers;
+
+        std::vector<int> const status = wait_for_workers(job, control, workers);
+        if (control.enough_data)
+            job.enough_data();
+
+        std::vector<bool> failed(num_workers, false);
+        for (size_t loop=0; loop<num_workers; ++loop)
+        {
+            if (WIFEXITED(status[loop])  &&  WEXITSTATUS(status[loop]) == 0)
+            {
+                try
+                {
+                    std::unique_ptr<detail::shared_memory_segment> segment(new detail::shared_memory_segment(workers[loop].second));
+                    if (segment->num_partitions() != job.number_of_partitions())
+                        BOOST_THROW_EXCEPTION(std::runtime_error("map worker segment has the wrong number of partitions"));
+                    partitions_.add(segment);
+
+                    result.counters.map_keys_executed  += counters[loop].map_keys_executed;
+                    result.counters.map_key_errors     += counters[loop].map_key_errors;
+                    result.counters.map_keys_completed += counters[loop].map_keys_completed;
+                    result.counters.map_keys_restored  += counters[loop].map_keys_restored;
+                    result.map_times.push_back(std::chrono::duration<double>(counters[loop].map_time));
+                    continue;
+                }
+                catch (std::exception &e)
+                {
+                    std::cerr << "\nError: " << e.what() << "\n";
+                }
+            }
+            else
+                shm_unlink(workers[loop].second.c_str());
+
+            failed[loop] = true;
+            ++result.counters.failed_map_processes;
+        }
+
+        // the keys claimed by a failed worker, and those that were not
+        // claimed before the workers finished, are run again. keys that were
+        // not claimed before the job was stopped are skipped
+        std::vector<size_t> again;
+        bool skipped = false;
+        for (size_t loop=0; loop<attempt_keys.size(); ++loop)
+        {
+            int const worker = claims[loop];
+            if ((worker == -1  &&  !control.stop)  ||  (worker != -1  &&  failed[size_t(worker)]))
+                again.push_back(attempt_keys[loop]);
+            else if (worker == -1)
+                skipped = true;
+        }
+        if (skipped)
+            job.map_keys_skipped();
+        return again;
+    }
+
+    // wait for the worker processes to exit, passing on a cancellation of
+    // the job, and return the status of each
+    static std::vector<int> const wait_for_workers(Job &job, control_block &control, std::vector<std::pair<pid_t, std::string> > const &workers)
+    {
+        std::vector<int>  status(workers.size(), 0);
+        std::vector<bool> running(workers.size(), true);
+        size_t num_running = workers.size();
+        while (num_running > 0)
+        {
+            if (job.map_keys_stopped())
+                control.stop = true;
+
+            bool exited = false;
+            for (size_t loop=0; loop<workers.size(); ++loop)
+            {
+                if (!running[loop])
+                    continue;
+
+                pid_t const pid = waitpid(workers[loop].first, &status[loop], WNOHANG);
+                if (pid == workers[loop].first  ||  (pid == -1  &&  errno != EINTR))
+                {
+                    if (pid == -1)
+                        status[loop] = -1;
+                    running[loop] = false;
+                    --num_running;
+                    exited = true;
+                }
+            }
+
+            if (!exited  &&  num_running > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return status;
+    }
+
+    void map(Job &job, results &result)
+    {
+        auto const start_time = std::chrono::system_clock::now();
+
+        // claim every map key before the workers are forked, so that they
+        // share the list without sharing the datasource. the data of keys
+        // whose values can be copied is read here too, as datasources such
+        // as the memory mapped file segments hand out a key more than once,
+        // with the next segment each time; the workers inherit the mapping
+        std::vector<key_type> keys;
+        values_.clear();
+        {
+            std::mutex m1;
+            std::vector<key_type> batch;
+            while (job.get_next_map_keys(batch, m1, result))
+            {
+                for (auto const &key : batch)
+                {
+                    keys.push_back(key);
+                    if (!read_map_data(job, keys.back(), result, std::is_copy_constructible<value_type>()))
+                        keys.pop_back();
+                }
+            }
+        }
+
+        std::vector<size_t> attempt_keys(keys.size());
+        for (size_t loop=0; loop<keys.size(); ++loop)
+            attempt_keys[loop] = loop;
+
+        // flush the calling process's streams so that the workers do not
+        // inherit, and write again, anything that has not yet been written
+        std::cout.flush();
+        std::cerr.flush();
+
+        size_t next_worker = 0;
+        for (size_t attempt=0; attempt<max_attempts  &&  !attempt_keys.empty()  &&  !job.map_keys_stopped(); ++attempt)
+            attempt_keys = run_attempt(job, keys, attempt_keys, next_worker, result);
+
+        // keys that failed on every attempt, or that were not run because
+        // the job was stopped
+        if (job.map_keys_stopped())
+        {
+            if (!attempt_keys.empty())
+                job.map_keys_skipped();
+        }
+        else
+        {
+            result.counters.map_keys_executed += attempt_keys.size();
+            result.counters.map_key_errors    += attempt_keys.size();
+        }
+
+        result.map_runtime = std::chrono::system_clock::now() - start_time;
+    }
+
+    static void run_reduce_task(Job &job, size_t const partition, partitions_t &partitions, results &result)
+    {
+        try
+        {
+            job.run_reduce_task(partition, partitions, result);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+        }
+    }
+
+    void reduce(Job &job, results &result)
+    {
+        // run the Reduce Tasks, one task per partition, largest first
+        auto const start_time   = std::chrono::system_clock::now();
+        auto const reduce_tasks = std::min(size_t(num_cpus_), job.number_of_partitions());
+
+        std::vector<size_t> const partitions =
+            detail::largest_partitions_first(
+                job.number_of_partitions(),
+                [this](size_t const partition)
+                {
+                    return partitions_.partition_size(partition);
+                });
+
+        {
+            mapreduce::detail::task_group reduce_group(*pool_);
+            for (auto const &partition : partitions)
+            {
+                auto this_result = std::make_shared<results>();
+                all_results_.push_back(this_result);
+
+                reduce_group.run(
+                    std::bind(
+                        &multi_process::run_reduce_task,
+                        std::ref(job),
+                        partition,
+                        std::ref(partitions_),
+                        std::ref(*this_result)));
+            }
+            reduce_group.wait();
+        }
+        result.reduce_runtime = std::chrono::system_clock::now() - start_time;
+        result.counters.actual_reduce_tasks = reduce_tasks;
+    }
+
+    void collate_results(results &result)
+    {
+        // we're done with the map/reduce job, collate the statistics before returning
+        detail::collate_results(all_results_, result);
+        all_results_.clear();
+    }
+
+  private:
+    typedef std::vector<std::shared_ptr<results> > all_results_t;
+
+    all_results_t                      all_results_;
+    std::vector<value_type>            values_;     // data of the map keys, read before the fork
+    partitions_t                       partitions_;
+    std::shared_ptr<thread_pool> const pool_;
+    unsigned const                     num_cpus_;
+};
+
+#else
+
+// processes are only forked on linux; elsewhere the map phase runs on
+// threads, as cpu_parallel
+template<typename Job, typename KeyCompare=std::less<typename Job::reduce_task_type::key_type> >
+class multi_process : public cpu_parallel<Job>
+{
+  public:
+    multi_process()
+    {
+    }
+
+    explicit multi_process(std::shared_ptr<thread_pool> const &pool)
+      : cpu_parallel<Job>(pool)
+    {
+    }
+};
+
+#endif
+
+}   // namespace schedule_policy
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
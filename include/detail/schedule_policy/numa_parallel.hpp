@@ -0,0 +1,283 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <mutex>
+
+namespace mapreduce {
+
+namespace schedule_policy {
+
+namespace detail {
+
+// a map task whose intermediate store is created by the thread that runs
+// it, so that the store's memory is first touched, and allocated, on the
+// NUMA node of that thread
+template<typename Job>
+inline void run_local_map_tasks(
+    Job                                                    &job,
+    std::mutex                                             &m1,
+    std::unique_ptr<typename Job::intermediate_store_type> &intermediate_store,
+    results                                                &result)
+{
+    try
+    {
+        intermediate_store = job.make_map_task_store();
+
+        std::vector<typename Job::map_task_type::key_type> keys;
+        while (job.get_next_map_keys(keys, m1, result))
+        {
+            for (auto &key : keys)
+                job.run_map_task(key, result, *intermediate_store);
+        }
+
+        // consolidate everything the task has mapped, once
+        job.combine_intermediate_results(*intermediate_store);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "\nError: " << e.what() << "\n";
+    }
+}
+
+}   // namespace detail
+
+// a schedule policy for machines with more than one NUMA node. each node has
+// a thread pool of its own, with its threads pinned to the node's cores. map
+// tasks are spread across the nodes and each allocates its intermediate
+// store on its own node. each partition has a home node, whose threads merge,
+// shuffle and reduce it, which spreads the partitions across the nodes.
+// merging does not copy the data to the home node: stores such as in_memory
+// and hashed_in_memory move the map tasks' values into the job's store, so
+// a partition is reduced from memory on the nodes where it was mapped.
+//
+// on a machine with a single node, or when specification::numa_nodes is one,
+// threads are not pinned and the process-wide thread pool is used
+template<typename Job>
+class numa_parallel : mapreduce::detail::noncopyable
+{
+  public:
+    numa_parallel()
+      : num_nodes_(0),
+        pin_to_cores_(false)
+    {
+    }
+
+    void operator()(Job &job, results &result)
+    {
+        create_pools(job.number_of_numa_nodes(), job.numa_pin_to_cores());
+
+        map(job, result);
+        intermediate(job, result);
+        reduce(job, result);
+        collate_results(result);
+        result.counters.num_result_files = job.number_of_partitions();
+    }
+
+  private:
+    typedef std::vector<std::unique_ptr<mapreduce::detail::task_group> > task_groups_t;
+
+    // the pools are kept between jobs that are run with the same policy
+    // object and the same configuration
+    void create_pools(size_t const num_nodes, bool const pin_to_cores)
+    {
+        if (!pools_.empty()  &&  num_nodes == num_nodes_  &&  pin_to_cores == pin_to_cores_)
+            return;
+
+        num_nodes_    = num_nodes;
+        pin_to_cores_ = pin_to_cores;
+        pools_.clear();
+
+        std::vector<std::vector<unsigned> > nodes = platform::numa_nodes();
+        if (num_nodes > 0  &&  num_nodes < nodes.size())
+            nodes.resize(num_nodes);
+
+        if (nodes.size() < 2)
+            pools_.push_back(thread_pool::shared_pool());
+        else
+        {
+            for (auto const &cpus : nodes)
+            {
+                pools_.push_back(
+                    std::make_shared<thread_pool>(
+                        cpus.size(),
+                        std::bind(&numa_parallel::pin_thread, cpus, pin_to_cores, std::placeholders::_1)));
+            }
+        }
+    }
+
+    static void pin_thread(std::vector<unsigned> const &cpus, bool const pin_to_core, size_t const index)
+    {
+        if (pin_to_core)
+            platform::set_thread_affinity(std::vector<unsigned>(1, cpus[index % cpus.size()]));
+        else
+            platform::set_thread_affinity(cpus);
+    }
+
+    size_t const home_node(size_t const partition) const
+    {
+        return partition % pools_.size();
+    }
+
+    task_groups_t task_groups(void)
+    {
+        task_groups_t groups;
+        for (auto const &pool : pools_)
+            groups.emplace_back(new mapreduce::detail::task_group(*pool));
+        return groups;
+    }
+
+    static void wait(task_groups_t &groups)
+    {
+        for (auto &group : groups)
+            group->wait();
+    }
+
+    void map(Job &job, results &result)
+    {
+        // run the Map Tasks, spread across the nodes in proportion to the
+        // number of threads that each node has
+        auto const start_time = std::chrono::system_clock::now();
+
+        size_t num_threads = 0;
+        std::vector<size_t> node_of_thread;
+        for (size_t node=0; node<pools_.size(); ++node)
+        {
+            node_of_thread.insert(node_of_thread.end(), pools_[node]->size(), node);
+            num_threads += pools_[node]->size();
+        }
+
+        size_t const map_tasks = detail::fixed_map_tasks(job, num_threads);
+        std::vector<std::unique_ptr<typename Job::intermediate_store_type> > intermediate_stores(map_tasks);
+
+        std::mutex m1;
+        {
+            task_groups_t groups = task_groups();
+            for (size_t loop=0; loop<map_tasks; ++loop)
+            {
+                auto this_result = std::make_shared<results>();
+                all_results_.push_back(this_result);
+
+                groups[node_of_thread[loop % num_threads]]->run(
+                    std::bind(
+                        &detail::run_local_map_tasks<Job>,
+                        std::ref(job),
+                        std::ref(m1),
+                        std::ref(intermediate_stores[loop]),
+                        std::ref(*this_result)));
+            }
+            wait(groups);
+        }
+        result.map_runtime = std::chrono::system_clock::now() - start_time;
+        result.counters.actual_map_tasks = map_tasks;
+
+        // merge the map tasks' stores into the job, each partition by the
+        // threads of its home node
+        auto const merge_start_time = std::chrono::system_clock::now();
+        {
+            task_groups_t groups = task_groups();
+            for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+            {
+                auto this_result = std::make_shared<results>();
+                all_results_.push_back(this_result);
+
+                groups[home_node(partition)]->run(
+                    std::bind(
+                        &detail::merge_intermediate_results<Job>,
+                        std::ref(job),
+                        partition,
+                        std::ref(intermediate_stores),
+                        std::ref(*this_result)));
+            }
+            wait(groups);
+        }
+        result.merge_runtime = std::chrono::system_clock::now() - merge_start_time;
+    }
+
+    void intermediate(Job &job, results &result)
+    {
+        // Intermediate results shuffle, each partition on its home node
+        auto const start_time = std::chrono::system_clock::now();
+
+        task_groups_t groups = task_groups();
+        for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+        {
+            auto this_result = std::make_shared<results>();
+            all_results_.push_back(this_result);
+
+            groups[home_node(partition)]->run(
+                std::bind(
+                    &detail::run_intermediate_results_shuffle<Job>,
+                    std::ref(job),
+                    partition,
+                    std::ref(*this_result)));
+        }
+        wait(groups);
+        result.shuffle_runtime = std::chrono::system_clock::now() - start_time;
+    }
+
+    void reduce(Job &job, results &result)
+    {
+        // run the Reduce Tasks, each partition on its home node, with the
+        // largest partitions first
+        auto const start_time = std::chrono::system_clock::now();
+
+        std::vector<size_t> const partitions = detail::largest_partitions_first(job);
+
+        task_groups_t groups = task_groups();
+        for (auto const &partition : partitions)
+        {
+            auto this_result = std::make_shared<results>();
+            all_results_.push_back(this_result);
+
+            groups[home_node(partition)]->run(
+                std::bind(
+                    &detail::run_reduce_task<Job>,
+                    std::ref(job),
+                    partition,
+                    std::ref(*this_result)));
+        }
+        wait(groups);
+        result.reduce_runtime = std::chrono::system_clock::now() - start_time;
+        result.counters.actual_reduce_tasks = job.number_of_partitions();
+    }
+
+    void collate_results(results &result)
+    {
+        // we're done with the map/reduce job, collate the statistics before returning
+        detail::collate_results(all_results_, result);
+        all_results_.clear();
+    }
+
+  private:
+    typedef std::vector<std::shared_ptr<results> >     all_results_t;
+    typedef std::vector<std::shared_ptr<thread_pool> > pools_t;
+
+    all_results_t  all_results_;
+    pools_t        pools_;          // one per node
+    size_t         num_nodes_;      // configuration of the pools
+    bool           pin_to_cores_;
+};
+
+}   // namespace schedule_policy
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,246 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <mutex>
+
+namespace mapreduce {
+
+namespace schedule_policy {
+
+// a schedule policy that overlaps the phases of the job. each map task maps
+// all of its keys into one intermediate store, as cpu_parallel does, which is
+// sealed when the task runs out of keys and merged into the job's store in
+// the background, one partition at a time, while other map tasks are still
+// running. once the map phase completes, each partition is shuffled and
+// reduced as soon as its own outstanding merges have finished, without
+// waiting for the other partitions.
+//
+// map keys can emit to any partition, so a partition can only be reduced
+// once every map key has been processed; the latency saving comes from
+// merging the stores of the map tasks that finish early while the last map
+// keys are still running
+template<typename Job>
+class pipelined : mapreduce::detail::noncopyable
+{
+  public:
+    pipelined()
+      : pool_(thread_pool::shared_pool()),
+        num_cpus_(unsigned(pool_->size()))
+    {
+    }
+
+    explicit pipelined(std::shared_ptr<thread_pool> const &pool)
+      : pool_(pool),
+        num_cpus_(unsigned(pool_->size()))
+    {
+    }
+
+    void operator()(Job &job, results &result)
+    {
+        mapreduce::detail::task_group pipeline_group(*pool_);
+        for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+            partitions_.emplace_back(new partition_state);
+
+        // run the Map Tasks, merging the store of each as it completes
+        auto   const start_time = std::chrono::system_clock::now();
+        size_t const map_tasks  = detail::fixed_map_tasks(job, num_cpus_);
+        {
+            std::mutex m1;
+            mapreduce::detail::task_group map_group(*pool_);
+            for (size_t loop=0; loop<map_tasks; ++loop)
+            {
+                auto this_result = std::make_shared<results>();
+                all_results_.push_back(this_result);
+
+                map_group.run(
+                    std::bind(
+                        &pipelined::run_map_tasks,
+                        this,
+                        std::ref(job),
+                        std::ref(m1),
+                        std::ref(pipeline_group),
+                        std::ref(*this_result)));
+            }
+            map_group.wait();
+        }
+        auto const map_end_time = std::chrono::system_clock::now();
+        result.map_runtime = map_end_time - start_time;
+        result.counters.actual_map_tasks = map_tasks;
+
+        // all map output is sealed, so any partition that has no merge in
+        // progress can be reduced now. the others are reduced by the task
+        // that completes their last merge
+        for (size_t partition=0; partition<partitions_.size(); ++partition)
+        {
+            partition_state &state = *partitions_[partition];
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.map_complete = true;
+            if (!state.merging)
+                schedule_reduce(job, partition, state, pipeline_group);
+        }
+        pipeline_group.wait();
+
+        // merge, shuffle and reduce overlap, so only the time after the
+        // last map task is reported, as the reduce runtime
+        result.reduce_runtime = std::chrono::system_clock::now() - map_end_time;
+        result.counters.actual_reduce_tasks = std::min(size_t(num_cpus_), job.number_of_partitions());
+        collate_results(result);
+        result.counters.num_result_files = job.number_of_partitions();
+    }
+
+  private:
+    typedef typename Job::intermediate_store_type intermediate_store_type;
+    typedef std::shared_ptr<intermediate_store_type> store_ptr_t;
+
+    struct partition_state
+    {
+        partition_state()
+          : merging(false),
+            map_complete(false),
+            result(std::make_shared<results>())
+        {
+        }
+
+        std::mutex                 mutex;
+        std::deque<store_ptr_t>    sealed;          // stores waiting to be merged
+        bool                       merging;         // a task is merging sealed stores
+        bool                       map_complete;    // no more stores will be sealed
+        std::shared_ptr<results>   result;
+    };
+
+    void run_map_tasks(Job &job, std::mutex &m1, mapreduce::detail::task_group &pipeline_group, results &result)
+    {
+        try
+        {
+            store_ptr_t intermediate_store(job.make_map_task_store());
+            std::vector<typename Job::map_task_type::key_type> keys;
+            while (job.get_next_map_keys(keys, m1, result))
+            {
+                for (auto &key : keys)
+                    job.run_map_task(key, result, *intermediate_store);
+            }
+
+            // consolidate everything the task has mapped, once, and merge it
+            // while the other map tasks finish
+            job.combine_intermediate_results(*intermediate_store);
+            seal(job, intermediate_store, pipeline_group);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+        }
+    }
+
+    // hand a completed store over to be merged into the job. a merge task is
+    // started for each partition that is not already being merged; a running
+    // merge task picks up the store when it finishes its current one
+    void seal(Job &job, store_ptr_t const &intermediate_store, mapreduce::detail::task_group &pipeline_group)
+    {
+        for (size_t partition=0; partition<partitions_.size(); ++partition)
+        {
+            partition_state &state = *partitions_[partition];
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.sealed.push_back(intermediate_store);
+            if (!state.merging)
+            {
+                state.merging = true;
+                pipeline_group.run(
+                    std::bind(
+                        &pipelined::merge_sealed_stores,
+                        this,
+                        std::ref(job),
+                        partition,
+                        std::ref(pipeline_group)));
+            }
+        }
+    }
+
+    void merge_sealed_stores(Job &job, size_t const partition, mapreduce::detail::task_group &pipeline_group)
+    {
+        partition_state &state = *partitions_[partition];
+        while (1)
+        {
+            store_ptr_t intermediate_store;
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                if (state.sealed.empty())
+                {
+                    state.merging = false;
+                    if (state.map_complete)
+                        schedule_reduce(job, partition, state, pipeline_group);
+                    return;
+                }
+                intermediate_store = state.sealed.front();
+                state.sealed.pop_front();
+            }
+
+            // the store is destroyed when its last partition has been merged
+            try
+            {
+                auto const start_time = std::chrono::system_clock::now();
+                job.merge_intermediate_results(partition, *intermediate_store);
+                state.result->merge_times.push_back(std::chrono::system_clock::now() - start_time);
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "\nError: " << e.what() << "\n";
+            }
+        }
+    }
+
+    // called with the partition's mutex held, once map output is complete
+    // and there is no merge outstanding
+    void schedule_reduce(Job &job, size_t const partition, partition_state &state, mapreduce::detail::task_group &pipeline_group)
+    {
+        pipeline_group.run(
+            [&job, partition, &state]()
+            {
+                detail::run_intermediate_results_shuffle(job, partition, *state.result);
+                detail::run_reduce_task(job, partition, *state.result);
+            });
+    }
+
+    void collate_results(results &result)
+    {
+        for (auto const &partition : partitions_)
+            all_results_.push_back(partition->result);
+
+        // we're done with the map/reduce job, collate the statistics before returning
+        detail::collate_results(all_results_, result);
+        all_results_.clear();
+        partitions_.clear();
+    }
+
+  private:
+    typedef std::vector<std::shared_ptr<results> >         all_results_t;
+    typedef std::vector<std::unique_ptr<partition_state> > partitions_t;
+
+    all_results_t                      all_results_;
+    partitions_t                       partitions_;
+    std::shared_ptr<thread_pool> const pool_;
+    unsigned const                     num_cpus_;
+};
+
+}   // namespace schedule_policy
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
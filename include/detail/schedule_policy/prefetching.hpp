@@ -0,0 +1,334 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace mapreduce {
+
+namespace schedule_policy {
+
+// a schedule policy that overlaps reading the input with the map tasks.
+// a small number of I/O threads, specification::io_threads, claim map keys
+// and read their data from the datasource ahead of the map tasks, into a
+// bounded queue of prepared keys. the map tasks run on the thread pool, one
+// per processor by default, and only ever process data that has already
+// been read, so the processors are not left idle waiting for I/O.
+//
+// the merge, shuffle and reduce phases are the same as cpu_parallel
+template<typename Job>
+class prefetching : mapreduce::detail::noncopyable
+{
+  public:
+    prefetching()
+      : pool_(thread_pool::shared_pool()),
+        num_cpus_(unsigned(pool_->size()))
+    {
+    }
+
+    explicit prefetching(std::shared_ptr<thread_pool> const &pool)
+      : pool_(pool),
+        num_cpus_(unsigned(pool_->size()))
+    {
+    }
+
+    void operator()(Job &job, results &result)
+    {
+        map(job, result);
+        intermediate(job, result);
+        reduce(job, result);
+        collate_results(result);
+        result.counters.num_result_files = job.number_of_partitions();
+    }
+
+  private:
+    typedef typename Job::map_task_type::key_type                   key_type;
+    typedef typename Job::map_task_type::value_type                 value_type;
+    typedef typename Job::intermediate_store_type                   intermediate_store_type;
+    typedef std::vector<std::unique_ptr<intermediate_store_type> >  intermediate_stores_t;
+
+    // a map key and the data that has been read for it. value types such
+    // as streams cannot be copied, so prepared keys are passed by pointer
+    struct prepared_key
+    {
+        explicit prepared_key(key_type const &k)
+          : key(k)
+        {
+        }
+
+        key_type   key;
+        value_type value;
+    };
+    typedef std::unique_ptr<prepared_key> prepared_key_ptr;
+
+    // the queue of keys that have been read, shared by the I/O threads that
+    // fill it and the map tasks that empty it
+    class prepared_keys : mapreduce::detail::noncopyable
+    {
+      public:
+        prepared_keys(size_t const capacity, size_t const readers, size_t const consumers)
+          : capacity_(capacity),
+            readers_(readers),
+            consumers_(consumers)
+        {
+        }
+
+        // called by an I/O thread; blocks while the queue is full. returns
+        // false if there are no map tasks left to take the key
+        bool const push(prepared_key_ptr &key)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            space_.wait(lock, [this]() { return queue_.size() < capacity_  ||  consumers_ == 0; });
+            if (consumers_ == 0)
+                return false;
+
+            queue_.push_back(std::move(key));
+            ready_.notify_one();
+            return true;
+        }
+
+        // called by a map task; blocks while the queue is empty and an I/O
+        // thread is still reading. returns false once all keys have been taken
+        bool const pop(prepared_key_ptr &key)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [this]() { return !queue_.empty()  ||  readers_ == 0; });
+            if (queue_.empty())
+                return false;
+
+            key = std::move(queue_.front());
+            queue_.pop_front();
+            space_.notify_one();
+            return true;
+        }
+
+        void reader_finished(void)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --readers_;
+            ready_.notify_all();
+        }
+
+        void consumer_finished(void)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --consumers_;
+            space_.notify_all();
+        }
+
+      private:
+        size_t const                  capacity_;
+        size_t                        readers_;     // I/O threads that are still reading
+        size_t                        consumers_;   // map tasks that are still running
+        std::deque<prepared_key_ptr>  queue_;
+        std::mutex                    mutex_;
+        std::condition_variable       ready_;       // a key has been queued, or the readers have finished
+        std::condition_variable       space_;       // a key has been taken, or the map tasks have finished
+    };
+
+    static size_t const prefetch_depth = 2;     // keys queued per map task
+
+    static void read_map_keys(Job &job, std::mutex &m1, prepared_keys &queue, results &result)
+    {
+        try
+        {
+            std::vector<key_type> keys;
+            bool more = true;
+            while (more  &&  job.get_next_map_keys(keys, m1, result))
+            {
+                for (auto it=keys.begin(); more  &&  it!=keys.end(); ++it)
+                {
+                    prepared_key_ptr key(new prepared_key(*it));
+                    if (!job.get_map_data(key->key, key->value))
+                    {
+                        ++result.counters.map_keys_executed;
+                        ++result.counters.map_key_errors;
+                        continue;
+                    }
+
+                    job.prefetch_map_data(key->value);
+                    more = queue.push(key);
+                }
+            }
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+        }
+        queue.reader_finished();
+    }
+
+    static void run_map_tasks(Job &job, prepared_keys &queue, intermediate_store_type &intermediate_store, results &result)
+    {
+        try
+        {
+            prepared_key_ptr key;
+            while (queue.pop(key))
+                job.run_map_task(key->key, key->value, result, intermediate_store);
+
+            // consolidate everything the task has mapped, once
+            job.combine_intermediate_results(intermediate_store);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+        }
+        queue.consumer_finished();
+    }
+
+    void map(Job &job, results &result)
+    {
+        // run the I/O threads and the Map Tasks
+        auto   const start_time = std::chrono::system_clock::now();
+        size_t const map_tasks  = detail::fixed_map_tasks(job, num_cpus_);
+        size_t const io_threads = std::max(size_t(1), job.number_of_io_threads());
+
+        intermediate_stores_t intermediate_stores;
+        {
+            std::mutex m1;
+            prepared_keys queue(map_tasks * prefetch_depth, io_threads, map_tasks);
+            mapreduce::detail::joined_thread_group readers;
+            for (size_t loop=0; loop<io_threads; ++loop)
+            {
+                auto this_result = std::make_shared<results>();
+                all_results_.push_back(this_result);
+
+                readers.emplace_back(
+                    std::thread(
+                        &prefetching::read_map_keys,
+                        std::ref(job),
+                        std::ref(m1),
+                        std::ref(queue),
+                        std::ref(*this_result)));
+            }
+
+            mapreduce::detail::task_group map_group(*pool_);
+            for (size_t loop=0; loop<map_tasks; ++loop)
+            {
+                auto this_result = std::make_shared<results>();
+                all_results_.push_back(this_result);
+                intermediate_stores.push_back(job.make_map_task_store());
+
+                map_group.run(
+                    std::bind(
+                        &prefetching::run_map_tasks,
+                        std::ref(job),
+                        std::ref(queue),
+                        std::ref(*intermediate_stores.back()),
+                        std::ref(*this_result)));
+            }
+            map_group.wait();
+            readers.join_all();
+        }
+        result.map_runtime = std::chrono::system_clock::now() - start_time;
+        result.counters.actual_map_tasks = map_tasks;
+
+        // merge the map tasks' stores into the job, one task per partition
+        auto const merge_start_time = std::chrono::system_clock::now();
+        {
+            mapreduce::detail::task_group merge_group(*pool_);
+            for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+            {
+                auto this_result = std::make_shared<results>();
+                all_results_.push_back(this_result);
+
+                merge_group.run(
+                    std::bind(
+                        &detail::merge_intermediate_results<Job>,
+                        std::ref(job),
+                        partition,
+                        std::ref(intermediate_stores),
+                        std::ref(*this_result)));
+            }
+            merge_group.wait();
+        }
+        result.merge_runtime = std::chrono::system_clock::now() - merge_start_time;
+    }
+
+    void intermediate(Job &job, results &result)
+    {
+        // Intermediate results shuffle, one task per partition
+        auto const start_time = std::chrono::system_clock::now();
+
+        mapreduce::detail::task_group shuffle_group(*pool_);
+        for (size_t partition=0; partition<job.number_of_partitions(); ++partition)
+        {
+            auto this_result = std::make_shared<results>();
+            all_results_.push_back(this_result);
+
+            shuffle_group.run(
+                std::bind(
+                    &detail::run_intermediate_results_shuffle<Job>,
+                    std::ref(job),
+                    partition,
+                    std::ref(*this_result)));
+        }
+        shuffle_group.wait();
+        result.shuffle_runtime = std::chrono::system_clock::now() - start_time;
+    }
+
+    void reduce(Job &job, results &result)
+    {
+        // run the Reduce Tasks, one task per partition, largest first
+        auto const start_time   = std::chrono::system_clock::now();
+        auto const reduce_tasks = std::min(size_t(num_cpus_), job.number_of_partitions());
+
+        std::vector<size_t> const partitions = detail::largest_partitions_first(job);
+
+        mapreduce::detail::task_group reduce_group(*pool_);
+        for (auto const &partition : partitions)
+        {
+            auto this_result = std::make_shared<results>();
+            all_results_.push_back(this_result);
+
+            reduce_group.run(
+                std::bind(
+                    &detail::run_reduce_task<Job>,
+                    std::ref(job),
+                    partition,
+                    std::ref(*this_result)));
+        }
+        reduce_group.wait();
+        result.reduce_runtime = std::chrono::system_clock::now() - start_time;
+        result.counters.actual_reduce_tasks = reduce_tasks;
+    }
+
+    void collate_results(results &result)
+    {
+        // we're done with the map/reduce job, collate the statistics before returning
+        detail::collate_results(all_results_, result);
+        all_results_.clear();
+    }
+
+  private:
+    typedef std::vector<std::shared_ptr<results> > all_results_t;
+
+    all_results_t                      all_results_;
+    std::shared_ptr<thread_pool> const pool_;
+    unsigned const                     num_cpus_;
+};
+
+}   // namespace schedule_policy
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
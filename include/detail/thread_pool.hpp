@@ -0,0 +1,508 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+namespace mapreduce {
+
+// a long-lived pool of worker threads. each worker owns a double-ended
+// task queue; it takes work from the back of its own queue, then from the
+// pool's shared queue and finally steals from the front of the queues of
+// the other workers. tasks submitted from outside the pool are placed on
+// the shared queue, so they are started in the order they were submitted.
+//
+// a pool can be divided into weighted shares, each of which is itself a
+// thread_pool without threads of its own. tasks submitted to a share are
+// placed on a queue of its own in the parent pool, and the parent's workers
+// take tasks from the queues in proportion to the shares' weights, so that
+// jobs that run on different shares of one pool get a fair share of it
+class thread_pool : detail::noncopyable
+{
+  public:
+    typedef std::function<void ()> task_t;
+    typedef std::function<void (size_t)> thread_start_t;
+
+    explicit thread_pool(size_t const num_threads=std::max(1U, std::thread::hardware_concurrency()))
+      : stop_(false),
+        queued_(0),
+        pass_(0),
+        max_additional_threads_(std::numeric_limits<size_t>::max()),
+        additional_threads_(0),
+        queue_(std::make_shared<share_queue>(1))
+    {
+        shares_.push_back(queue_);
+        start(num_threads);
+    }
+
+    // 'thread_start' is called on each worker thread, with the index of the
+    // worker, before the thread runs any tasks; to set its affinity, say
+    thread_pool(size_t const num_threads, thread_start_t const &thread_start)
+      : stop_(false),
+        queued_(0),
+        pass_(0),
+        max_additional_threads_(std::numeric_limits<size_t>::max()),
+        additional_threads_(0),
+        queue_(std::make_shared<share_queue>(1)),
+        thread_start_(thread_start)
+    {
+        shares_.push_back(queue_);
+        start(num_threads);
+    }
+
+    // a share of 'parent', which runs the share's tasks on its workers in
+    // proportion to 'weight'
+    thread_pool(std::shared_ptr<thread_pool> const &parent, unsigned const weight)
+      : stop_(false),
+        queued_(0),
+        pass_(0),
+        max_additional_threads_(0),
+        additional_threads_(0),
+        parent_(parent),
+        queue_(std::make_shared<share_queue>(weight))
+    {
+        parent_->add_share(queue_);
+    }
+
+    ~thread_pool()
+    {
+        if (parent_)
+        {
+            parent_->remove_share(queue_);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        threads_.join_all();
+    }
+
+    // a process-wide pool that is shared by default between all of the jobs
+    // run by the cpu_parallel schedule policy, so that threads are created
+    // once rather than for every phase of every job
+    static std::shared_ptr<thread_pool> shared_pool(void)
+    {
+        static std::shared_ptr<thread_pool> pool(std::make_shared<thread_pool>());
+        return pool;
+    }
+
+    // tasks of a share run only on the workers of its parent pool
+    bool const is_share(void) const
+    {
+        return bool(parent_);
+    }
+
+    size_t const size(void) const
+    {
+        return parent_? parent_->size() : workers_.size();
+    }
+
+    // limit the number of threads, beyond the workers, that tasks of the
+    // pool can start for work that is waiting for I/O. unlimited by default
+    void limit_additional_threads(size_t const max_threads)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_additional_threads_ = max_threads;
+    }
+
+    // reserve one of the additional threads before starting it, and release
+    // it when it finishes. returns false if the limit has been reached
+    bool const reserve_thread(void)
+    {
+        if (parent_)
+            return parent_->reserve_thread();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (additional_threads_ >= max_additional_threads_)
+            return false;
+        ++additional_threads_;
+        return true;
+    }
+
+    void release_thread(void)
+    {
+        if (parent_)
+            return parent_->release_thread();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        --additional_threads_;
+    }
+
+    // a long running task on a share can give way to other tasks, by
+    // submitting its continuation and returning, when there are tasks
+    // waiting for a worker
+    bool const yield_requested(void) const
+    {
+        return parent_  &&  parent_->queued_ > 0;
+    }
+
+    void submit(task_t task)
+    {
+        // tasks of a share are always queued on the share's queue, even when
+        // they are submitted by a worker, so that each share gets its weight
+        if (parent_)
+        {
+            parent_->push(*queue_, std::move(task));
+            return;
+        }
+
+        // the count is raised before the task is visible so that it can
+        // never be decremented below zero by a thread taking the task
+        size_t const index = worker_index();
+        if (index < workers_.size())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ++queued_;
+            }
+
+            std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+            workers_[index]->tasks.push_back(std::move(task));
+        }
+        else
+        {
+            push(*queue_, std::move(task));
+            return;
+        }
+        cv_.notify_one();
+    }
+
+    // run one queued task on the calling thread, if there is one. this
+    // enables a thread that is waiting for tasks to complete to help
+    // rather than block. threads waiting on a share do not run tasks, as
+    // they are not counted among the workers of the parent pool
+    bool const run_pending_task(void)
+    {
+        if (parent_)
+            return false;
+
+        task_t task;
+        if (!pop_task(worker_index(), task))
+            return false;
+
+        run_task(task);
+        return true;
+    }
+
+  private:
+    struct worker
+    {
+        std::mutex         mutex;
+        std::deque<task_t> tasks;
+    };
+
+    // stride scheduling; each time a task is taken from a queue, the queue's
+    // pass advances by its stride, which is inversely proportional to its
+    // weight, and tasks are taken from the queue with the lowest pass
+    struct share_queue
+    {
+        explicit share_queue(unsigned const weight)
+          : stride(stride_scale / std::max(1U, weight)),
+            pass(0)
+        {
+        }
+
+        std::uint64_t const stride;
+        std::uint64_t       pass;
+        std::deque<task_t>  tasks;
+    };
+
+    static std::uint64_t const stride_scale = 1 << 16;
+
+    void add_share(std::shared_ptr<share_queue> const &queue)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shares_.push_back(queue);
+    }
+
+    // tasks that are left on a share's queue are moved to the pool's own
+    void remove_share(std::shared_ptr<share_queue> const &queue)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            shares_.erase(std::find(shares_.begin(), shares_.end(), queue));
+            if (queue->tasks.empty())
+                return;
+
+            if (queue_->tasks.empty())
+                queue_->pass = std::max(queue_->pass, pass_);
+            std::move(queue->tasks.begin(), queue->tasks.end(), std::back_inserter(queue_->tasks));
+            queue->tasks.clear();
+        }
+        cv_.notify_all();
+    }
+
+    void push(share_queue &queue, task_t task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            // a queue that has been idle does not accumulate credit
+            if (queue.tasks.empty())
+                queue.pass = std::max(queue.pass, pass_);
+            queue.tasks.push_back(std::move(task));
+            ++queued_;
+        }
+        cv_.notify_one();
+    }
+
+    // called with the mutex held
+    bool const pop_shared(task_t &task)
+    {
+        share_queue *next = 0;
+        for (auto const &queue : shares_)
+        {
+            if (!queue->tasks.empty()  &&  (next == 0  ||  queue->pass < next->pass))
+                next = queue.get();
+        }
+        if (next == 0)
+            return false;
+
+        task = std::move(next->tasks.front());
+        next->tasks.pop_front();
+        pass_ = next->pass;
+        next->pass += next->stride;
+        --queued_;
+        return true;
+    }
+
+    void start(size_t const num_threads)
+    {
+        for (size_t loop=0; loop<num_threads; ++loop)
+            workers_.emplace_back(new worker);
+
+        for (size_t loop=0; loop<num_threads; ++loop)
+            threads_.emplace_back(std::thread(std::bind(&thread_pool::worker_thread, this, loop)));
+    }
+
+    void worker_thread(size_t const index)
+    {
+        if (thread_start_)
+        {
+            try
+            {
+                thread_start_(index);
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "\nError: " << e.what() << "\n";
+            }
+        }
+
+        while (1)
+        {
+            task_t task;
+            if (pop_task(index, task))
+            {
+                run_task(task);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return stop_  ||  queued_ > 0; });
+            if (stop_  &&  queued_ == 0)
+                break;
+        }
+    }
+
+    bool const pop_task(size_t const index, task_t &task)
+    {
+        // own queue first, most recently queued task
+        if (index < workers_.size()  &&  pop_back(*workers_[index], task))
+            return true;
+
+        // then the shared queues, in submission order within each share
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (pop_shared(task))
+                return true;
+        }
+
+        // and finally steal the oldest task from another worker
+        size_t const start = (index < workers_.size())? index+1 : 0;
+        for (size_t loop=0; loop<workers_.size(); ++loop)
+        {
+            worker &victim = *workers_[(start + loop) % workers_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                --queued_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool const pop_back(worker &w, task_t &task)
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (w.tasks.empty())
+            return false;
+
+        task = std::move(w.tasks.back());
+        w.tasks.pop_back();
+        --queued_;
+        return true;
+    }
+
+    void run_task(task_t &task)
+    {
+        try
+        {
+            task();
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "\nError: " << e.what() << "\n";
+        }
+    }
+
+    size_t const worker_index(void) const
+    {
+        std::thread::id const id = std::this_thread::get_id();
+        for (size_t loop=0; loop<threads_.size(); ++loop)
+        {
+            if (threads_[loop].get_id() == id)
+                return loop;
+        }
+        return std::numeric_limits<size_t>::max();
+    }
+
+  private:
+    typedef std::vector<std::unique_ptr<worker> >      workers_t;
+    typedef std::vector<std::shared_ptr<share_queue> > shares_t;
+
+    bool                                   stop_;
+    std::atomic<size_t>                    queued_;     // number of tasks waiting to run
+    std::mutex                             mutex_;
+    std::condition_variable                cv_;
+    shares_t                               shares_;     // shared queues, the pool's own and one per share
+    std::uint64_t                          pass_;       // pass of the queue that a task was last taken from
+    size_t                                 max_additional_threads_;
+    size_t                                 additional_threads_;
+    std::shared_ptr<thread_pool> const     parent_;     // the pool that this is a share of
+    std::shared_ptr<share_queue> const     queue_;      // the queue that tasks submitted here are placed on
+    thread_start_t const                   thread_start_;
+    workers_t                              workers_;
+    mapreduce::detail::joined_thread_group threads_;
+};
+
+namespace detail {
+
+// a set of tasks run on a thread_pool that can be waited upon as a group.
+// the waiting thread runs queued tasks while it waits, unless the pool is a
+// share, when it sleeps until the last of the group's tasks is done
+class task_group : noncopyable
+{
+  public:
+    explicit task_group(thread_pool &pool)
+      : pool_(pool),
+        outstanding_(0)
+    {
+    }
+
+    ~task_group()
+    {
+        wait();
+    }
+
+    template<typename Fn>
+    void run(Fn fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++outstanding_;
+        }
+
+        pool_.submit(
+            [this, fn]() mutable
+            {
+                try
+                {
+                    fn();
+                }
+                catch (std::exception &e)
+                {
+                    std::cerr << "\nError: " << e.what() << "\n";
+                }
+                task_done();
+            });
+    }
+
+    void wait(void)
+    {
+        if (pool_.is_share())
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return outstanding_ == 0; });
+            return;
+        }
+
+        while (1)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (outstanding_ == 0)
+                    return;
+            }
+
+            if (!pool_.run_pending_task())
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait_for(lock, std::chrono::milliseconds(10), [this] { return outstanding_ == 0; });
+            }
+        }
+    }
+
+  private:
+    void task_done(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--outstanding_ == 0)
+            cv_.notify_all();
+    }
+
+  private:
+    thread_pool             &pool_;
+    size_t                   outstanding_;
+    std::mutex               mutex_;
+    std::condition_variable  cv_;
+};
+
+}   // namespace detail
+
+}   // namespace mapreduce
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
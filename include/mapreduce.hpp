@@ -14,6 +14,10 @@
 #   endif
 #endif
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include <thread>
@@ -69,6 +73,31 @@ class joined_thread_group : public std::vector<std::thread>
 
 namespace mapreduce {
 
+// cancels a running job from any thread. copies of a token share their
+// state, so a token can be kept by the caller and a copy given to the job
+// in its specification
+class cancellation_token
+{
+  public:
+    cancellation_token()
+      : cancelled_(std::make_shared<std::atomic<bool> >(false))
+    {
+    }
+
+    void cancel(void)
+    {
+        *cancelled_ = true;
+    }
+
+    bool const cancelled(void) const
+    {
+        return *cancelled_;
+    }
+
+  private:
+    std::shared_ptr<std::atomic<bool> > cancelled_;
+};
+
 struct specification
 {
     size_t          map_tasks;             // ideal number of map tasks to use
@@ -76,12 +105,32 @@ struct specification
     std::string     output_filespec;       // filespec of the output files - can contain a directory path if required
     std::string     input_directory;       // directory path to scan for input files
     std::streamsize max_file_segment_size; // ideal maximum number of bytes in each input file segment
+    size_t          map_key_batch_size;    // number of map keys claimed at a time from datasources that support setup_keys()
+    bool            speculative_execution; // re-run the slowest map keys on idle threads once all keys have been claimed
+    size_t          numa_nodes;            // number of NUMA nodes used by numa_parallel, zero for all of them
+    bool            numa_pin_to_cores;     // numa_parallel pins each thread to one core, rather than to the cores of its node
+    size_t          io_threads;            // number of threads the prefetching policy uses to read map data ahead of the map tasks
+    size_t          processes;             // number of map worker processes used by multi_process, zero for one per processor
+    cancellation_token cancellation;       // stops the job once it is cancelled
+    std::chrono::system_clock::time_point deadline; // ends the map phase, or the merges and reduces after it, once the time has passed
+    std::string     checkpoint_directory;  // directory that keeps the output of completed map keys, empty for none
+    bool            incremental;           // keep the combined intermediate results in the checkpoint directory, and map only new input
+    std::uintmax_t  memory_budget;         // bytes of intermediate results that a hybrid store keeps in memory, zero for no limit
 
     specification()
       : map_tasks(0),                   
         reduce_tasks(1),
         max_file_segment_size(1048576L),    // default 1Mb
-        output_filespec("mapreduce_")   
+        output_filespec("mapreduce_"),
+        map_key_batch_size(1),
+        speculative_execution(false),
+        numa_nodes(0),
+        numa_pin_to_cores(true),
+        io_threads(2),
+        processes(0),
+        deadline(std::chrono::system_clock::time_point::max()),
+        incremental(false),
+        memory_budget(0)
     {
     }
 };
@@ -105,6 +154,10 @@ struct results
 
         size_t num_result_files;        // number of result files created
 
+        size_t speculative_wins;        // number of map keys where a speculative copy finished first
+        size_t failed_map_processes;    // number of map worker processes that failed, whose map keys were run again
+        size_t map_keys_restored;       // number of map keys whose output was restored from a checkpoint
+
         tag_counters()
           : actual_map_tasks(0),
             actual_reduce_tasks(0),
@@ -114,18 +167,44 @@ struct results
             reduce_keys_executed(0),
             reduce_key_errors(0),
             reduce_keys_completed(0),
-            num_result_files(0)
+            num_result_files(0),
+            speculative_wins(0),
+            failed_map_processes(0),
+            map_keys_restored(0)
         {
         }
     } counters;
 
+    bool cancelled;                 // work was skipped because the job was cancelled or ran past its deadline
+    bool enough_data;               // a map task signalled that the job had enough data
+    size_t iterations;              // number of iterations run by an iterative_job
+
     std::chrono::duration<double>              job_runtime;
     std::chrono::duration<double>              map_runtime;
+    std::chrono::duration<double>              merge_runtime;   // merging map results into the job's store
     std::chrono::duration<double>              shuffle_runtime;
     std::chrono::duration<double>              reduce_runtime;
+    std::chrono::duration<double>              lock_wait_time;  // total time map tasks spent waiting for locks
     std::vector<std::chrono::duration<double>> map_times;
+    std::vector<std::chrono::duration<double>> merge_times;
     std::vector<std::chrono::duration<double>> shuffle_times;
     std::vector<std::chrono::duration<double>> reduce_times;
+
+    // number of map tasks running, from the time into the map phase that it changed
+    std::vector<std::pair<std::chrono::duration<double>, size_t>> map_concurrency;
+
+    results()
+      : cancelled(false),
+        enough_data(false),
+        iterations(0),
+        job_runtime(0),
+        map_runtime(0),
+        merge_runtime(0),
+        shuffle_runtime(0),
+        reduce_runtime(0),
+        lock_wait_time(0)
+    {
+    }
 };
 
 }   // namespace mapreduce
@@ -134,10 +213,15 @@ struct results
 #include "detail/platform.hpp"
 #include "detail/mergesort.hpp"
 #include "detail/null_combiner.hpp"
+#include "detail/binary_records.hpp"
 #include "detail/intermediates.hpp"
+#include "detail/thread_pool.hpp"
 #include "detail/schedule_policy.hpp"
 #include "detail/datasource.hpp"
+#include "detail/checkpoint.hpp"
 #include "detail/job.hpp"
+#include "detail/job_executor.hpp"
+#include "detail/iterative_job.hpp"
 
 namespace mapreduce {
 
@@ -0,0 +1,223 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+// folds 200,000 emits into aggregating_in_memory stores, summing them in a
+// job run on a pool of threads and taking their maximum in stores merged by
+// hand, and checks the results, and that they are iterated in key order,
+// against a reference. returns zero if the checks pass
+
+#include "mapreduce.hpp"
+#include <iostream>
+#include <map>
+
+namespace aggregating_test {
+
+unsigned const num_map_keys  = 200;
+unsigned const num_words     = 1000;
+unsigned const emits_per_key = 1000;
+
+std::string const word(unsigned const key, unsigned const emit)
+{
+    return "word_" + std::to_string((key * 7919 + emit * 104729) % num_words);
+}
+
+unsigned const count(unsigned const key, unsigned const emit)
+{
+    return (key + emit) % 17;
+}
+
+template<typename MapTask>
+class number_source : mapreduce::detail::noncopyable
+{
+  public:
+    number_source()
+      : sequence_(0)
+    {
+    }
+
+    bool const setup_key(typename MapTask::key_type &key)
+    {
+        key = sequence_++;
+        return key < num_map_keys;
+    }
+
+    bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value)
+    {
+        value = key;
+        return true;
+    }
+
+  private:
+    std::atomic<unsigned> sequence_;
+};
+
+// emits words both as strings and as a pointer and a length
+struct map_task : public mapreduce::map_task<unsigned, unsigned>
+{
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &/*key*/, value_type const &value) const
+    {
+        for (unsigned emit=0; emit<emits_per_key; ++emit)
+        {
+            std::string const w = word(value, emit);
+            if (emit % 2)
+                runtime.emit_intermediate(std::make_pair(w.data(), std::uintmax_t(w.length())), count(value, emit));
+            else
+                runtime.emit_intermediate(w, count(value, emit));
+        }
+    }
+};
+
+// the store has folded the values of a key into one
+struct reduce_task : public mapreduce::reduce_task<std::string, unsigned>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, key_type const &key, It it, It ite) const
+    {
+        if (std::distance(it, ite) == 1)
+            runtime.emit(key, *it);
+    }
+};
+
+struct maximum
+{
+    unsigned const operator()(unsigned const a, unsigned const b) const
+    {
+        return std::max(a, b);
+    }
+};
+
+typedef
+mapreduce::job<map_task,
+               reduce_task,
+               mapreduce::null_combiner,
+               number_source<map_task>,
+               mapreduce::intermediates::aggregating_in_memory<map_task, reduce_task> >
+job;
+
+typedef
+mapreduce::intermediates::aggregating_in_memory<map_task, reduce_task, maximum>
+max_store;
+
+bool const check(bool const condition, char const * const message)
+{
+    if (!condition)
+        std::cerr << "\nFailed: " << message;
+    return condition;
+}
+
+template<typename FoldFn>
+std::map<std::string, unsigned> const reference(FoldFn fold)
+{
+    std::map<std::string, unsigned> results;
+    for (unsigned key=0; key<num_map_keys; ++key)
+    {
+        for (unsigned emit=0; emit<emits_per_key; ++emit)
+        {
+            auto const inserted = results.insert(std::make_pair(word(key, emit), count(key, emit)));
+            if (!inserted.second)
+                inserted.first->second = fold(inserted.first->second, count(key, emit));
+        }
+    }
+    return results;
+}
+
+template<typename It>
+bool const in_key_order(It it, It ite)
+{
+    if (it == ite)
+        return true;
+    for (auto previous=it++; it!=ite; previous=it++)
+    {
+        if (!(previous->first < it->first))
+            return false;
+    }
+    return true;
+}
+
+bool const test_job(void)
+{
+    mapreduce::specification spec;
+    spec.map_tasks    = 8;
+    spec.reduce_tasks = 5;
+
+    job::datasource_type datasource;
+    job j(datasource, spec);
+    mapreduce::results result;
+    mapreduce::schedule_policy::cpu_parallel<job> schedule(std::make_shared<mapreduce::thread_pool>(4));
+    j.run(schedule, result);
+
+    std::map<std::string, unsigned> sums;
+    for (auto it=j.begin_results(); it!=j.end_results(); ++it)
+        sums[it->first] += it->second;
+
+    bool success = true;
+    success &= check(sums == reference(std::plus<unsigned>()), "the job sums the values of each word");
+    success &= check(std::distance(j.begin_results(), j.end_results()) == num_words, "the job emits each word once");
+    success &= check(in_key_order(j.begin_results(), j.end_results()), "the results are in key order");
+    return success;
+}
+
+// a store for each map key, merged into one that is reduced and then holds
+// the final results
+bool const test_merged_stores(void)
+{
+    size_t const num_partitions = 4;
+    max_store store(num_partitions);
+    for (unsigned key=0; key<num_map_keys; ++key)
+    {
+        max_store task_store(num_partitions);
+        for (unsigned emit=0; emit<emits_per_key; ++emit)
+            task_store.insert(word(key, emit), count(key, emit));
+        store.merge_from(task_store);
+    }
+
+    std::map<std::string, unsigned> maxima;
+    bool single_values = true;
+    max_store results(num_partitions);
+    auto reduce = [&](std::string const &key, unsigned const *it, unsigned const *ite) {
+        single_values &= (ite - it == 1);
+        maxima[key] = *it;
+        results.insert(key, *it);
+    };
+    for (size_t partition=0; partition<num_partitions; ++partition)
+        store.reduce(partition, reduce);
+
+    bool success = true;
+    success &= check(single_values, "a reduce task is given one value for each key");
+    success &= check(maxima == reference(maximum()), "the stores take the maximum of each word");
+
+    std::map<std::string, unsigned> const iterated(results.begin_results(), results.end_results());
+    success &= check(iterated == maxima, "the results are iterated");
+    success &= check(in_key_order(results.begin_results(), results.end_results()), "the results are iterated in key order");
+    return success;
+}
+
+} // namespace aggregating_test
+
+int main()
+{
+    bool success = aggregating_test::test_job();
+    success &= aggregating_test::test_merged_stores();
+
+    std::cout << (success? "\nPassed" : "\nFailed") << std::endl;
+    return success? 0 : 1;
+}
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
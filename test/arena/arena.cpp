@@ -0,0 +1,219 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+// builds the stores of many map tasks on arenas, with in_memory and an
+// arena_allocator, and merges them into a job's store that outlives them;
+// then runs a job with the same store twice, so that the second run reuses
+// the slabs of the first. checks the counts of the words against a
+// reference. returns zero if the checks pass
+
+#include "mapreduce.hpp"
+#include <iostream>
+#include <map>
+
+namespace arena_test {
+
+unsigned const num_map_keys = 200;
+unsigned const num_words    = 500;
+unsigned const emits_per_key = 100;
+
+// the word emitted by a map key, some long enough to be held on the arena
+std::string const word(unsigned const key, unsigned const emit)
+{
+    unsigned const n = (key * 7919 + emit * 104729) % num_words;
+    return "word_" + std::to_string(n) + ((n % 3 == 0)? "_with_a_suffix_too_long_for_a_short_string" : "");
+}
+
+template<typename MapTask>
+class number_source : mapreduce::detail::noncopyable
+{
+  public:
+    number_source()
+      : sequence_(0)
+    {
+    }
+
+    bool const setup_key(typename MapTask::key_type &key)
+    {
+        key = sequence_++;
+        return key < num_map_keys;
+    }
+
+    bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value)
+    {
+        value = key;
+        return true;
+    }
+
+  private:
+    std::atomic<unsigned> sequence_;
+};
+
+// emits words both as strings and as a pointer and a length
+struct map_task : public mapreduce::map_task<unsigned, unsigned>
+{
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &/*key*/, value_type const &value) const
+    {
+        for (unsigned emit=0; emit<emits_per_key; ++emit)
+        {
+            std::string const w = word(value, emit);
+            if (emit % 2)
+                runtime.emit_intermediate(std::make_pair(w.data(), std::uintmax_t(w.length())), 1U);
+            else
+                runtime.emit_intermediate(w, 1U);
+        }
+    }
+};
+
+struct reduce_task : public mapreduce::reduce_task<std::string, unsigned>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, key_type const &key, It it, It ite) const
+    {
+        unsigned total = 0;
+        for (; it!=ite; ++it)
+            total += *it;
+        runtime.emit(key, total);
+    }
+};
+
+typedef
+mapreduce::intermediates::in_memory<
+    map_task,
+    reduce_task,
+    std::string,
+    mapreduce::hash_partitioner,
+    std::less<std::string>,
+    mapreduce::intermediates::reduce_null_output<map_task, reduce_task>,
+    mapreduce::arena_allocator<char> >
+store;
+
+typedef
+mapreduce::job<map_task,
+               reduce_task,
+               mapreduce::null_combiner,
+               number_source<map_task>,
+               store>
+job;
+
+bool const check(bool const condition, char const * const message)
+{
+    if (!condition)
+        std::cerr << "\nFailed: " << message;
+    return condition;
+}
+
+std::map<std::string, unsigned> const reference(void)
+{
+    std::map<std::string, unsigned> counts;
+    for (unsigned key=0; key<num_map_keys; ++key)
+    {
+        for (unsigned emit=0; emit<emits_per_key; ++emit)
+            ++counts[word(key, emit)];
+    }
+    return counts;
+}
+
+struct collector
+{
+    template<typename It>
+    void operator()(std::string const &key, It it, It ite)
+    {
+        for (; it!=ite; ++it)
+            counts[key] += *it;
+    }
+
+    std::map<std::string, unsigned> counts;
+};
+
+// the stores of the map tasks are destroyed, and their arenas with them,
+// before the job's store is reduced
+bool const test_merged_stores(void)
+{
+    size_t const num_partitions = 4;
+    store job_store(num_partitions);
+    for (unsigned key=0; key<num_map_keys; ++key)
+    {
+        store task_store(num_partitions);
+        for (unsigned emit=0; emit<emits_per_key; ++emit)
+            task_store.insert(word(key, emit), 1U);
+        job_store.merge_from(task_store);
+    }
+
+    collector counts;
+    for (size_t partition=0; partition<num_partitions; ++partition)
+        job_store.reduce(partition, counts);
+
+    bool success = true;
+    success &= check(counts.counts == reference(), "the merged stores hold every word");
+
+    job_store.clear();
+    for (unsigned emit=0; emit<emits_per_key; ++emit)
+        job_store.insert(word(0, emit), 1U);
+    collector again;
+    for (size_t partition=0; partition<num_partitions; ++partition)
+        job_store.reduce(partition, again);
+
+    std::map<std::string, unsigned> first_key;
+    for (unsigned emit=0; emit<emits_per_key; ++emit)
+        ++first_key[word(0, emit)];
+    success &= check(again.counts == first_key, "a cleared store is reused");
+    return success;
+}
+
+// a job run twice on a pool of four threads, the second reusing the slabs
+// that the first returned
+bool const test_job(void)
+{
+    auto const pool = std::make_shared<mapreduce::thread_pool>(4);
+
+    bool success = true;
+    for (unsigned run=0; run<2; ++run)
+    {
+        mapreduce::specification spec;
+        spec.map_tasks    = 4;
+        spec.reduce_tasks = 3;
+
+        job::datasource_type datasource;
+        job j(datasource, spec);
+        mapreduce::results result;
+        mapreduce::schedule_policy::cpu_parallel<job> schedule(pool);
+        j.run(schedule, result);
+
+        std::map<std::string, unsigned> counts;
+        for (auto it=j.begin_results(); it!=j.end_results(); ++it)
+            counts[it->first] += it->second;
+        success &= check(counts == reference(), "the job counts every word");
+    }
+    return success;
+}
+
+} // namespace arena_test
+
+int main()
+{
+    bool success = arena_test::test_merged_stores();
+    success &= arena_test::test_job();
+
+    std::cout << (success? "\nPassed" : "\nFailed") << std::endl;
+    return success? 0 : 1;
+}
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,302 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+// runs jobs that are cancelled, or whose deadline passes, during the map and
+// reduce phases, and checks what is mapped and reduced and that
+// results::cancelled is set only when work was skipped. returns zero if the
+// checks pass
+
+#include "mapreduce.hpp"
+#include <iostream>
+#include <map>
+
+namespace cancellation_test {
+
+unsigned const num_keys = 20;
+
+// the specification of the running job, and what the map and reduce tasks
+// do to it when they reach a given key
+mapreduce::specification *running_spec = nullptr;
+
+enum action { none, cancel, pass_deadline, enough_data };
+
+action   map_action      = none;
+unsigned map_action_key  = 0;
+action   reduce_action   = none;
+unsigned reduce_action_at = 0;
+std::atomic<unsigned> reduced_keys(0);
+
+void act(action const what)
+{
+    if (what == cancel)
+        running_spec->cancellation.cancel();
+    else if (what == pass_deadline)
+        running_spec->deadline = std::chrono::system_clock::now();
+}
+
+// a key for each number, with the number as its data
+template<typename MapTask>
+class number_source : mapreduce::detail::noncopyable
+{
+  public:
+    number_source()
+      : sequence_(0)
+    {
+    }
+
+    bool const setup_key(typename MapTask::key_type &key)
+    {
+        key = sequence_++;
+        return key < num_keys;
+    }
+
+    bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value)
+    {
+        value = key;
+        return true;
+    }
+
+  private:
+    unsigned sequence_;
+};
+
+struct map_task : public mapreduce::map_task<unsigned, unsigned>
+{
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &key, value_type const &value) const
+    {
+        runtime.emit_intermediate(value, 1U);
+        if (key == map_action_key)
+        {
+            if (map_action == enough_data)
+                runtime.enough_data();
+            else
+                act(map_action);
+        }
+    }
+};
+
+struct reduce_task : public mapreduce::reduce_task<unsigned, unsigned>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, key_type const &key, It it, It ite) const
+    {
+        unsigned total = 0;
+        for (; it!=ite; ++it)
+            total += *it;
+        runtime.emit(key, total);
+
+        if (++reduced_keys == reduce_action_at)
+            act(reduce_action);
+    }
+};
+
+typedef
+mapreduce::job<map_task,
+               reduce_task,
+               mapreduce::null_combiner,
+               number_source<map_task> >
+job;
+
+bool const check(bool const condition, char const * const message)
+{
+    if (!condition)
+        std::cerr << "\nFailed: " << message;
+    return condition;
+}
+
+struct outcome
+{
+    mapreduce::results               result;
+    std::map<unsigned, unsigned>     counts;
+};
+
+// run a job with a deadline an hour away, unless it has been cancelled or
+// given a deadline by 'setup', and with 'threads' map workers
+template<typename Setup>
+outcome const run(action const on_map, unsigned const map_key, action const on_reduce, unsigned const reduce_at, size_t const threads, Setup setup)
+{
+    mapreduce::specification spec;
+    spec.map_tasks    = threads;
+    spec.reduce_tasks = 1;
+    spec.deadline     = std::chrono::system_clock::now() + std::chrono::hours(1);
+    setup(spec);
+
+    running_spec     = &spec;
+    map_action       = on_map;
+    map_action_key   = map_key;
+    reduce_action    = on_reduce;
+    reduce_action_at = reduce_at;
+    reduced_keys     = 0;
+
+    outcome out;
+    job::datasource_type datasource;
+    job j(datasource, spec);
+    if (threads == 1)
+        j.run<mapreduce::schedule_policy::sequential<job> >(out.result);
+    else
+    {
+        mapreduce::schedule_policy::cpu_parallel<job> schedule(std::make_shared<mapreduce::thread_pool>(threads));
+        j.run(schedule, out.result);
+    }
+
+    for (auto it=j.begin_results(); it!=j.end_results(); ++it)
+        out.counts[it->first] += it->second;
+    return out;
+}
+
+template<typename Setup>
+outcome const run(action const on_map, unsigned const map_key, action const on_reduce, unsigned const reduce_at, Setup setup)
+{
+    return run(on_map, map_key, on_reduce, reduce_at, 1, setup);
+}
+
+outcome const run(action const on_map, unsigned const map_key, action const on_reduce, unsigned const reduce_at, size_t const threads=1)
+{
+    return run(on_map, map_key, on_reduce, reduce_at, threads, [](mapreduce::specification &) {});
+}
+
+bool const counted_once(outcome const &out)
+{
+    for (auto const &count : out.counts)
+    {
+        if (count.second != 1)
+            return false;
+    }
+    return true;
+}
+
+bool const test_not_stopped(void)
+{
+    outcome const out = run(none, 0, none, 0);
+
+    bool success = true;
+    success &= check(!out.result.cancelled, "a job that finishes is not cancelled");
+    success &= check(out.counts.size() == num_keys, "a job that finishes reduces every key");
+    return success;
+}
+
+bool const test_cancelled_before_run(void)
+{
+    outcome const out = run(none, 0, none, 0, [](mapreduce::specification &spec) { spec.cancellation.cancel(); });
+
+    bool success = true;
+    success &= check(out.result.cancelled, "a job cancelled before it runs is cancelled");
+    success &= check(out.result.counters.map_keys_executed == 0, "a job cancelled before it runs maps nothing");
+    success &= check(out.counts.empty(), "a job cancelled before it runs reduces nothing");
+    return success;
+}
+
+bool const test_cancelled_during_map(void)
+{
+    outcome const out = run(cancel, 5, none, 0);
+
+    bool success = true;
+    success &= check(out.result.cancelled, "a job cancelled during the map phase is cancelled");
+    success &= check(out.result.counters.map_keys_executed == 6, "a job cancelled during the map phase starts no more map keys");
+    success &= check(out.result.counters.reduce_keys_executed == 0, "a job cancelled during the map phase reduces nothing");
+    return success;
+}
+
+bool const test_cancelled_during_reduce(void)
+{
+    outcome const out = run(none, 0, cancel, 3);
+
+    bool success = true;
+    success &= check(out.result.cancelled, "a job cancelled during the reduce phase is cancelled");
+    success &= check(out.counts.size() == 3, "a job cancelled during the reduce phase keeps the keys already reduced");
+    return success;
+}
+
+bool const test_deadline_before_run(void)
+{
+    outcome const out = run(none, 0, none, 0, [](mapreduce::specification &spec) { spec.deadline = std::chrono::system_clock::now(); });
+
+    bool success = true;
+    success &= check(out.result.cancelled, "a job whose deadline has passed is cancelled");
+    success &= check(out.result.counters.map_keys_executed == 0, "a job whose deadline has passed maps nothing");
+    return success;
+}
+
+bool const test_deadline_during_map(size_t const threads)
+{
+    outcome const out = run(pass_deadline, 5, none, 0, threads);
+
+    bool success = true;
+    success &= check(out.result.cancelled, "a job whose deadline passes during the map phase is cancelled");
+    success &= check(out.result.counters.map_keys_completed < num_keys, "a job whose deadline passes during the map phase starts no more map keys");
+    success &= check(out.counts.size() == out.result.counters.map_keys_completed, "a job whose deadline passes during the map phase reduces what was mapped");
+    success &= check(counted_once(out), "a job whose deadline passes during the map phase counts each key once");
+    return success;
+}
+
+bool const test_deadline_during_reduce(void)
+{
+    outcome const out = run(none, 0, pass_deadline, 3);
+
+    bool success = true;
+    success &= check(out.result.cancelled, "a job whose deadline passes during the reduce phase is cancelled");
+    success &= check(out.result.counters.map_keys_completed == num_keys, "a job whose deadline passes during the reduce phase maps every key");
+    success &= check(out.counts.size() == 3, "a job whose deadline passes during the reduce phase reduces no more keys");
+    return success;
+}
+
+bool const test_deadline_after_last_key(void)
+{
+    outcome const out = run(none, 0, pass_deadline, num_keys);
+
+    bool success = true;
+    success &= check(!out.result.cancelled, "a job that finishes as its deadline passes is not cancelled");
+    success &= check(out.counts.size() == num_keys, "a job that finishes as its deadline passes reduces every key");
+    return success;
+}
+
+bool const test_enough_data(void)
+{
+    outcome const out = run(enough_data, 5, none, 0);
+
+    bool success = true;
+    success &= check(!out.result.cancelled, "a job with enough data is not cancelled");
+    success &= check(out.result.enough_data, "a job with enough data reports it");
+    success &= check(out.counts.size() == 6, "a job with enough data reduces what was mapped");
+    return success;
+}
+
+} // namespace cancellation_test
+
+int main()
+{
+    using namespace cancellation_test;
+
+    bool success = test_not_stopped();
+    success &= test_cancelled_before_run();
+    success &= test_cancelled_during_map();
+    success &= test_cancelled_during_reduce();
+    success &= test_deadline_before_run();
+    success &= test_deadline_during_map(1);
+    success &= test_deadline_during_map(2);
+    success &= test_deadline_during_reduce();
+    success &= test_deadline_after_last_key();
+    success &= test_enough_data();
+
+    std::cout << (success? "\nPassed" : "\nFailed") << std::endl;
+    return success? 0 : 1;
+}
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,246 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+// runs jobs with a checkpoint directory twice, and checks that the second run
+// restores every map key and produces the same results as the first, and
+// that a job run again with a different segment size restores none of the
+// segments it no longer has. returns zero if the checks pass
+
+#include "mapreduce.hpp"
+#include <fstream>
+#include <iostream>
+#include <map>
+
+namespace checkpoint_test {
+
+// map keys and intermediate keys that hold whitespace, and an empty key
+char const * const words[] = { "one two", " leading", "trailing ", "tab\there", "line\nbreak", "", "plain" };
+size_t const num_words = sizeof(words) / sizeof(words[0]);
+
+template<typename MapTask>
+class word_source : mapreduce::detail::noncopyable
+{
+  public:
+    word_source() : sequence_(0)
+    {
+    }
+
+    bool const setup_key(typename MapTask::key_type &key)
+    {
+        size_t const index = sequence_++;
+        if (index >= num_words)
+            return false;
+        key = std::string("map key ") + words[index];
+        return true;
+    }
+
+    bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value)
+    {
+        value = key.substr(8);
+        return true;
+    }
+
+  private:
+    std::atomic<size_t> sequence_;
+};
+
+struct map_task : public mapreduce::map_task<std::string, std::string>
+{
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &/*key*/, value_type const &value) const
+    {
+        runtime.emit_intermediate(value, 1U);
+        runtime.emit_intermediate(value + " again", 2U);
+    }
+};
+
+// counts the lines of the segments of files
+struct line_map_task : public mapreduce::map_task<std::string, std::pair<char const *, std::uintmax_t> >
+{
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &/*key*/, value_type const &value) const
+    {
+        char const *begin = value.first;
+        char const *const end = value.first + value.second;
+        while (begin != end)
+        {
+            char const *line = begin;
+            while (begin != end  &&  *begin != '\n'  &&  *begin != '\r')
+                ++begin;
+            if (begin != line)
+                runtime.emit_intermediate(std::string(line, begin), 1U);
+            while (begin != end  &&  (*begin == '\n'  ||  *begin == '\r'))
+                ++begin;
+        }
+    }
+};
+
+struct reduce_task : public mapreduce::reduce_task<std::string, unsigned>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, key_type const &key, It it, It ite) const
+    {
+        unsigned total = 0;
+        for (; it!=ite; ++it)
+            total += *it;
+        runtime.emit(key, total);
+    }
+};
+
+typedef
+mapreduce::job<map_task,
+               reduce_task,
+               mapreduce::null_combiner,
+               word_source<map_task> >
+word_job;
+
+typedef
+mapreduce::job<line_map_task,
+               reduce_task,
+               mapreduce::null_combiner,
+               mapreduce::datasource::directory_iterator<line_map_task> >
+line_job;
+
+template<typename Job>
+std::map<std::string, unsigned> const run(typename Job::datasource_type &datasource, mapreduce::specification const &spec, mapreduce::results &result)
+{
+    Job job(datasource, spec);
+    job.template run<mapreduce::schedule_policy::cpu_parallel<Job> >(result);
+
+    std::map<std::string, unsigned> results;
+    for (auto it=job.begin_results(); it!=job.end_results(); ++it)
+        results[it->first] += it->second;
+    return results;
+}
+
+bool const check(bool const condition, char const * const message)
+{
+    if (!condition)
+        std::cerr << "\nFailed: " << message;
+    return condition;
+}
+
+bool const test_keys_with_whitespace(boost::filesystem::path const &directory)
+{
+    mapreduce::specification spec;
+    spec.checkpoint_directory = (directory / "words").string();
+
+    mapreduce::results first_result, second_result;
+    word_job::datasource_type first_datasource, second_datasource;
+    auto const first  = run<word_job>(first_datasource, spec, first_result);
+    auto const second = run<word_job>(second_datasource, spec, second_result);
+
+    bool success = true;
+    success &= check(first.size() == num_words * 2, "every intermediate key is reduced");
+    for (size_t loop=0; loop<num_words; ++loop)
+    {
+        auto const it = first.find(words[loop]);
+        success &= check(it != first.end()  &&  it->second == 1, "a key with whitespace is reduced once");
+    }
+    success &= check(first_result.counters.map_keys_restored == 0, "nothing is restored by the first job");
+    success &= check(second_result.counters.map_keys_restored == num_words, "every map key is restored by the second job");
+    success &= check(second_result.counters.map_keys_executed == 0, "no map key is run by the second job");
+    success &= check(first == second, "restored keys and values are unchanged");
+    return success;
+}
+
+bool const test_file_segments(boost::filesystem::path const &directory)
+{
+    boost::filesystem::path const input = directory / "input";
+    boost::filesystem::create_directories(input);
+    {
+        std::ofstream file((input / "lines.txt").string().c_str(), std::ios_base::binary);
+        for (unsigned loop=0; loop<1000; ++loop)
+            file << "line " << loop << "\n";
+    }
+
+    mapreduce::specification spec;
+    spec.input_directory       = input.string();
+    spec.max_file_segment_size = 256;
+    spec.checkpoint_directory  = (directory / "lines").string();
+
+    mapreduce::results first_result, second_result;
+    line_job::datasource_type first_datasource(spec), second_datasource(spec);
+    auto const first  = run<line_job>(first_datasource, spec, first_result);
+    auto const second = run<line_job>(second_datasource, spec, second_result);
+
+    bool success = true;
+    success &= check(first.size() == 1000, "every line of every segment is reduced");
+    success &= check(first_result.counters.map_keys_executed > 1, "the file is mapped in segments");
+    success &= check(second_result.counters.map_keys_restored == first_result.counters.map_keys_completed, "every segment is restored by the second job");
+    success &= check(second_result.counters.map_keys_executed == 0, "no segment is mapped by the second job");
+    success &= check(first == second, "restored segments are unchanged");
+    return success;
+}
+
+// segments that start at the offsets of the last run's segments, but are
+// longer, must be mapped again rather than restored
+bool const test_changed_segment_size(boost::filesystem::path const &directory)
+{
+    boost::filesystem::path const input = directory / "resized_input";
+    boost::filesystem::create_directories(input);
+    {
+        std::ofstream file((input / "lines.txt").string().c_str(), std::ios_base::binary);
+        for (unsigned loop=0; loop<100; ++loop)
+            file << "line " << loop << "\n";
+    }
+
+    mapreduce::specification spec;
+    spec.input_directory       = input.string();
+    spec.max_file_segment_size = 150;
+    spec.checkpoint_directory  = (directory / "resized").string();
+
+    mapreduce::results first_result, second_result, third_result;
+    line_job::datasource_type first_datasource(spec);
+    auto const first = run<line_job>(first_datasource, spec, first_result);
+
+    spec.max_file_segment_size = 200;
+    line_job::datasource_type second_datasource(spec), third_datasource(spec);
+    auto const second = run<line_job>(second_datasource, spec, second_result);
+    auto const third  = run<line_job>(third_datasource, spec, third_result);
+
+    bool success = true;
+    success &= check(first.size() == 100, "every line is reduced");
+    success &= check(second == first, "every line is reduced with a larger segment size");
+    success &= check(second_result.counters.map_keys_restored == 0, "no segment of a different length is restored");
+    success &= check(third == first, "every line is reduced when the larger segments are restored");
+    success &= check(third_result.counters.map_keys_restored == second_result.counters.map_keys_completed, "segments of the same length are restored");
+    success &= check(third_result.counters.map_keys_executed == 0, "no segment of the same length is mapped again");
+    return success;
+}
+
+} // namespace checkpoint_test
+
+int main()
+{
+    boost::filesystem::path const directory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("checkpoint_%%%%-%%%%");
+
+    bool success = true;
+    success &= checkpoint_test::test_keys_with_whitespace(directory);
+    success &= checkpoint_test::test_file_segments(directory);
+    success &= checkpoint_test::test_changed_segment_size(directory);
+
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(directory, ec);
+
+    std::cout << (success? "\nPassed" : "\nFailed") << std::endl;
+    return success? 0 : 1;
+}
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,322 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+// inserts into concurrent_in_memory, keeping lists of values and folding
+// them, from eight threads at once through map task stores, with keys as
+// strings and as a pointer and a length, and merges private stores into it
+// a partition at a time from eight threads at once; then runs jobs with it
+// on a pool of eight threads. checks the counts of the words against a
+// reference. with an argument of "benchmark", runs 4 million string emits
+// over 10,000 keys into 8 partitions with in_memory and concurrent_in_memory
+// on 8, 16, 32 and 64 threads, and prints the time of the map phase and its
+// merges. returns zero if the checks pass
+
+#include "mapreduce.hpp"
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <thread>
+
+namespace concurrent_test {
+
+unsigned num_map_keys  = 64;
+unsigned num_words     = 1000;
+unsigned emits_per_key = 2000;
+bool     split_keys    = true;
+
+std::string const word(unsigned const key, unsigned const emit)
+{
+    return "word_" + std::to_string((key * 7919 + emit * 104729) % num_words);
+}
+
+template<typename MapTask>
+class number_source : mapreduce::detail::noncopyable
+{
+  public:
+    number_source()
+      : sequence_(0)
+    {
+    }
+
+    bool const setup_key(typename MapTask::key_type &key)
+    {
+        key = sequence_++;
+        return key < num_map_keys;
+    }
+
+    bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value)
+    {
+        value = key;
+        return true;
+    }
+
+  private:
+    std::atomic<unsigned> sequence_;
+};
+
+// emits words as strings, and every other one as a pointer and a length
+// unless split_keys is false
+struct map_task : public mapreduce::map_task<unsigned, unsigned>
+{
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &/*key*/, value_type const &value) const
+    {
+        for (unsigned emit=0; emit<emits_per_key; ++emit)
+        {
+            std::string const w = word(value, emit);
+            if (split_keys  &&  emit % 2)
+                runtime.emit_intermediate(std::make_pair(w.data(), std::uintmax_t(w.length())), 1U);
+            else
+                runtime.emit_intermediate(w, 1U);
+        }
+    }
+};
+
+struct reduce_task : public mapreduce::reduce_task<std::string, unsigned>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, key_type const &key, It it, It ite) const
+    {
+        unsigned total = 0;
+        for (; it!=ite; ++it)
+            total += *it;
+        runtime.emit(key, total);
+    }
+};
+
+typedef mapreduce::intermediates::reduce_null_output<map_task, reduce_task> null_output;
+
+typedef
+mapreduce::intermediates::concurrent_in_memory<map_task, reduce_task>
+list_store;
+
+typedef
+mapreduce::intermediates::concurrent_in_memory<
+    map_task, reduce_task, std::string, mapreduce::hash_partitioner, std::less<std::string>, null_output, true, std::plus<unsigned> >
+fold_store;
+
+bool const check(bool const condition, char const * const message)
+{
+    if (!condition)
+        std::cerr << "\nFailed: " << message;
+    return condition;
+}
+
+std::map<std::string, unsigned> const reference(void)
+{
+    std::map<std::string, unsigned> counts;
+    for (unsigned key=0; key<num_map_keys; ++key)
+    {
+        for (unsigned emit=0; emit<emits_per_key; ++emit)
+            ++counts[word(key, emit)];
+    }
+    return counts;
+}
+
+// sums the values of each key reduced, and checks that the keys of a
+// partition are reduced in order
+struct collector
+{
+    collector()
+      : ordered(true), most_values(0)
+    {
+    }
+
+    template<typename It>
+    void operator()(std::string const &key, It it, It ite)
+    {
+        ordered &= (previous.empty()  ||  previous < key);
+        previous = key;
+        most_values = std::max(most_values, size_t(std::distance(it, ite)));
+        for (; it!=ite; ++it)
+            counts[key] += *it;
+    }
+
+    void next_partition(void)
+    {
+        previous.clear();
+    }
+
+    std::map<std::string, unsigned> counts;
+    std::string                     previous;
+    bool                            ordered;
+    size_t                          most_values;
+};
+
+template<typename Store>
+collector const reduce(Store &store, size_t const num_partitions)
+{
+    collector counts;
+    for (size_t partition=0; partition<num_partitions; ++partition)
+    {
+        counts.next_partition();
+        store.run_intermediate_results_shuffle(partition);
+        store.reduce(partition, counts);
+    }
+    return counts;
+}
+
+template<typename Store>
+void insert_words(Store &store, unsigned const key)
+{
+    for (unsigned emit=0; emit<emits_per_key; ++emit)
+    {
+        std::string const w = word(key, emit);
+        if (emit % 2)
+            store.insert(std::make_pair(w.data(), std::uintmax_t(w.length())), 1U);
+        else
+            store.insert(w, 1U);
+    }
+}
+
+// runs 'fn(thread)' on eight threads at once
+template<typename Fn>
+void on_eight_threads(Fn fn)
+{
+    std::vector<std::thread> threads;
+    for (unsigned thread=0; thread<8; ++thread)
+        threads.push_back(std::thread(fn, thread));
+    for (auto &thread : threads)
+        thread.join();
+}
+
+// eight threads insert the words of their map keys through map task stores
+template<typename Store>
+bool const test_map_task_stores(char const * const mode, bool const folded)
+{
+    size_t const num_partitions = 8;
+    Store store(num_partitions);
+    on_eight_threads([&store](unsigned const thread) {
+        auto task_store = store.map_task_store();
+        for (unsigned key=thread; key<num_map_keys; key+=8)
+            insert_words(*task_store, key);
+        store.merge_from(*task_store);
+    });
+
+    auto const counts = reduce(store, num_partitions);
+    bool success = true;
+    success &= check(counts.counts == reference(), mode);
+    success &= check(counts.ordered, "keys are reduced in order");
+    success &= check(!folded  ||  counts.most_values == 1, "a folded key has one value");
+    return success;
+}
+
+// eight threads fill private stores, then merge them into the job's store a
+// partition at a time, all at once
+template<typename Store>
+bool const test_merges(char const * const mode)
+{
+    size_t const num_partitions = 8;
+    Store store(num_partitions);
+    std::vector<std::unique_ptr<Store> > private_stores;
+    for (unsigned thread=0; thread<8; ++thread)
+        private_stores.emplace_back(new Store(num_partitions));
+
+    on_eight_threads([&private_stores](unsigned const thread) {
+        for (unsigned key=thread; key<num_map_keys; key+=8)
+            insert_words(*private_stores[thread], key);
+    });
+    on_eight_threads([&store, &private_stores, num_partitions](unsigned const thread) {
+        for (size_t partition=0; partition<num_partitions; ++partition)
+        {
+            for (unsigned loop=0; loop<8; ++loop)
+                store.merge_from((partition + thread) % num_partitions, *private_stores[(thread + loop) % 8]);
+        }
+    });
+
+    auto const counts = reduce(store, num_partitions);
+    return check(counts.counts == reference(), mode);
+}
+
+template<typename Store>
+mapreduce::results const run(std::map<std::string, unsigned> &counts, unsigned const num_threads)
+{
+    typedef
+    mapreduce::job<map_task,
+                   reduce_task,
+                   mapreduce::null_combiner,
+                   number_source<map_task>,
+                   Store>
+    job;
+
+    mapreduce::specification spec;
+    spec.map_tasks    = num_threads;
+    spec.reduce_tasks = 8;
+
+    typename job::datasource_type datasource;
+    job j(datasource, spec);
+    mapreduce::results result;
+    mapreduce::schedule_policy::cpu_parallel<job> schedule(std::make_shared<mapreduce::thread_pool>(num_threads));
+    j.run(schedule, result);
+
+    for (auto it=j.begin_results(); it!=j.end_results(); ++it)
+        counts[it->first] += it->second;
+    return result;
+}
+
+template<typename Store>
+bool const test_job(char const * const mode)
+{
+    std::map<std::string, unsigned> counts;
+    run<Store>(counts, 8);
+    return check(counts == reference(), mode);
+}
+
+template<typename Store>
+void benchmark(char const * const name, unsigned const num_threads)
+{
+    std::map<std::string, unsigned> counts;
+    auto const result = run<Store>(counts, num_threads);
+    std::cout << "\n" << name << ", " << num_threads << " threads: map and merge "
+              << (result.map_runtime + result.merge_runtime).count() << "s";
+}
+
+} // namespace concurrent_test
+
+int main(int argc, char **argv)
+{
+    using namespace concurrent_test;
+
+    if (argc > 1  &&  strcmp(argv[1], "benchmark") == 0)
+    {
+        num_map_keys  = 64;
+        num_words     = 10000;
+        emits_per_key = 4000000 / num_map_keys;
+        split_keys    = false;
+        for (unsigned num_threads=8; num_threads<=64; num_threads*=2)
+        {
+            benchmark<mapreduce::intermediates::in_memory<map_task, reduce_task> >("in_memory", num_threads);
+            benchmark<list_store>("concurrent_in_memory", num_threads);
+        }
+        std::cout << std::endl;
+        return 0;
+    }
+
+    bool success = test_map_task_stores<list_store>("map task stores keep the values of each word", false);
+    success &= test_map_task_stores<fold_store>("map task stores fold the values of each word", true);
+    success &= test_merges<list_store>("merged stores keep the values of each word");
+    success &= test_merges<fold_store>("merged stores fold the values of each word");
+    success &= test_job<list_store>("a job keeps the values of each word");
+    success &= test_job<fold_store>("a job folds the values of each word");
+
+    std::cout << (success? "\nPassed" : "\nFailed") << std::endl;
+    return success? 0 : 1;
+}
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,225 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+// runs a distributed job with a coordinator and two workers in one process,
+// over the loopback interface, and checks its results. also checks that
+// messages and partitions that run past their end, and messages that are
+// too long, are rejected. returns zero if the checks pass
+
+#include "mapreduce.hpp"
+#include "detail/schedule_policy/distributed.hpp"
+#include <iostream>
+#include <map>
+
+namespace distributed_test {
+
+unsigned const num_map_keys = 1000;
+unsigned const num_keys     = 10;
+
+// a map key identifies its data, so that a worker can read the data of
+// keys that were set up by the coordinator
+template<typename MapTask>
+class number_source : mapreduce::detail::noncopyable
+{
+  public:
+    number_source() : sequence_(0)
+    {
+    }
+
+    bool const setup_key(typename MapTask::key_type &key)
+    {
+        key = sequence_++;
+        return key < num_map_keys;
+    }
+
+    bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value)
+    {
+        value = key;
+        return true;
+    }
+
+  private:
+    std::atomic<unsigned> sequence_;
+};
+
+struct map_task : public mapreduce::map_task<unsigned, unsigned>
+{
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &/*key*/, value_type const &value) const
+    {
+        runtime.emit_intermediate(value % num_keys, 1U);
+    }
+};
+
+struct reduce_task : public mapreduce::reduce_task<unsigned, unsigned>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, key_type const &key, It it, It ite) const
+    {
+        unsigned total = 0;
+        for (; it!=ite; ++it)
+            total += *it;
+        runtime.emit(key, total);
+    }
+};
+
+typedef
+mapreduce::job<map_task,
+               reduce_task,
+               mapreduce::null_combiner,
+               number_source<map_task> >
+job;
+
+typedef mapreduce::detail::record_merger<job, std::less<unsigned> > record_merger;
+
+bool const check(bool const condition, char const * const message)
+{
+    if (!condition)
+        std::cerr << "\nFailed: " << message;
+    return condition;
+}
+
+void run_worker(unsigned short const port, mapreduce::specification const &spec, mapreduce::results &result)
+{
+    job::datasource_type datasource;
+    job j(datasource, spec);
+    mapreduce::schedule_policy::distributed_worker<job> worker("127.0.0.1", port, std::make_shared<mapreduce::thread_pool>(2));
+    j.run(worker, result);
+}
+
+bool const test_loopback_job(void)
+{
+    mapreduce::specification spec;
+    spec.reduce_tasks = 4;
+
+    job::datasource_type datasource;
+    job j(datasource, spec);
+    mapreduce::schedule_policy::distributed_coordinator<job> coordinator(0, 2);
+
+    mapreduce::results result, first_result, second_result;
+    {
+        mapreduce::detail::joined_thread_group workers;
+        workers.emplace_back(std::thread(&run_worker, coordinator.port(), std::cref(spec), std::ref(first_result)));
+        workers.emplace_back(std::thread(&run_worker, coordinator.port(), std::cref(spec), std::ref(second_result)));
+        j.run(coordinator, result);
+    }
+
+    std::map<unsigned, unsigned> totals;
+    for (auto it=j.begin_results(); it!=j.end_results(); ++it)
+        totals[it->first] += it->second;
+
+    bool success = true;
+    success &= check(totals.size() == num_keys, "every key is reduced");
+    for (auto const &total : totals)
+        success &= check(total.second == num_map_keys / num_keys, "every value is reduced once");
+    success &= check(result.counters.map_keys_completed == num_map_keys, "every map key is run by a worker");
+    success &= check(result.counters.failed_map_processes == 0, "no worker fails");
+    return success;
+}
+
+// a string whose length runs past the end of the message
+bool const test_message_bounds(void)
+{
+    std::vector<char> payload;
+    {
+        mapreduce::detail::buffer_writer writer(payload);
+        std::uint64_t const length = std::uint64_t(1) << 40;
+        writer.write(&length, sizeof(length));
+        writer.write("abc", 3);
+    }
+
+    mapreduce::schedule_policy::detail::message_reader reader(payload);
+    try
+    {
+        reader.read<std::string>();
+    }
+    catch (std::runtime_error &)
+    {
+        return true;
+    }
+    return check(false, "a string that runs past the end of a message is rejected");
+}
+
+// a message whose header claims more than the largest payload
+bool const test_message_size(void)
+{
+    boost::asio::io_service io_service;
+    boost::asio::ip::tcp::acceptor acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+
+    mapreduce::schedule_policy::detail::message_connection sender(io_service);
+    sender.connect(acceptor.local_endpoint());
+    mapreduce::schedule_policy::detail::message_connection receiver(io_service);
+    acceptor.accept(receiver.socket());
+
+    std::uint64_t const header[2] = { std::uint64_t(mapreduce::schedule_policy::detail::partition_message), mapreduce::schedule_policy::detail::max_message_size + 1 };
+    boost::asio::write(sender.socket(), boost::asio::buffer(header, sizeof(header)));
+
+    std::vector<char> payload;
+    try
+    {
+        receiver.receive(payload);
+    }
+    catch (std::runtime_error &)
+    {
+        return check(payload.empty(), "no buffer is allocated for a message that is too long");
+    }
+    return check(false, "a message that is too long is rejected");
+}
+
+// partitions received from another worker are checked before their records
+// are merged
+bool const test_partition_bounds(void)
+{
+    std::vector<char> payload;
+    {
+        mapreduce::detail::buffer_writer writer(payload);
+        mapreduce::detail::record_writer<job, mapreduce::detail::buffer_writer> records(writer);
+        unsigned const values[] = { 1, 2, 3 };
+        records(1U, values, values + 3);
+        records(2U, values, values + 1);
+    }
+
+    bool success = true;
+    record_merger::block_t const block(payload.data(), payload.data() + payload.size());
+    success &= check(record_merger::valid(block), "whole records are accepted");
+    success &= check(!record_merger::valid(record_merger::block_t(block.first, block.second - 1)), "a truncated record is rejected");
+
+    // the count of the first record's values is after its key, aligned
+    std::vector<char> corrupt(payload);
+    std::uint64_t const count = std::uint64_t(1) << 60;
+    std::memcpy(corrupt.data() + mapreduce::detail::align_to(sizeof(unsigned), sizeof(std::uint64_t)), &count, sizeof(count));
+    success &= check(!record_merger::valid(record_merger::block_t(corrupt.data(), corrupt.data() + corrupt.size())), "a count that runs past the end is rejected");
+    return success;
+}
+
+} // namespace distributed_test
+
+int main()
+{
+    bool success = true;
+    success &= distributed_test::test_loopback_job();
+    success &= distributed_test::test_message_bounds();
+    success &= distributed_test::test_message_size();
+    success &= distributed_test::test_partition_bounds();
+
+    std::cout << (success? "\nPassed" : "\nFailed") << std::endl;
+    return success? 0 : 1;
+}
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
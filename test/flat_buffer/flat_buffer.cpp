@@ -0,0 +1,227 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+// runs a job of many distinct keys with flat_buffer, ordered and unordered,
+// and checks its results against those of in_memory, and that an ordered
+// store reduces its keys in order. with an argument of "benchmark", runs 20
+// million emits over a million keys from 200 map tasks into 4 partitions,
+// and prints the times of in_memory, hashed_in_memory and flat_buffer.
+// returns zero if the checks pass
+
+#include "mapreduce.hpp"
+#include <cstring>
+#include <iostream>
+#include <map>
+
+namespace flat_buffer_test {
+
+unsigned const num_map_keys = 200;
+unsigned long  num_emits    = 1000000;
+unsigned       num_keys     = 100000;
+
+template<typename MapTask>
+class number_source : mapreduce::detail::noncopyable
+{
+  public:
+    number_source()
+      : sequence_(0)
+    {
+    }
+
+    bool const setup_key(typename MapTask::key_type &key)
+    {
+        key = sequence_++;
+        return key < num_map_keys;
+    }
+
+    bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value)
+    {
+        value = key;
+        return true;
+    }
+
+  private:
+    std::atomic<unsigned> sequence_;
+};
+
+// emits keys chosen by a linear congruential generator seeded by the map key
+struct map_task : public mapreduce::map_task<unsigned, unsigned>
+{
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &/*key*/, value_type const &value) const
+    {
+        std::uint64_t x = value * 2654435761ULL + 1;
+        for (unsigned long emit=0; emit<num_emits/num_map_keys; ++emit)
+        {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            runtime.emit_intermediate(unsigned((x >> 33) % num_keys), value % 7 + 1);
+        }
+    }
+};
+
+struct reduce_task : public mapreduce::reduce_task<unsigned, unsigned>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, key_type const &key, It it, It ite) const
+    {
+        unsigned total = 0;
+        for (; it!=ite; ++it)
+            total += *it;
+        runtime.emit(key, total);
+    }
+};
+
+typedef mapreduce::intermediates::reduce_null_output<map_task, reduce_task> null_output;
+
+typedef
+mapreduce::intermediates::flat_buffer<
+    map_task, reduce_task, unsigned, mapreduce::hash_partitioner, std::less<unsigned>, null_output, false>
+unordered_flat_buffer;
+
+bool const check(bool const condition, char const * const message)
+{
+    if (!condition)
+        std::cerr << "\nFailed: " << message;
+    return condition;
+}
+
+template<typename Store>
+std::map<unsigned, unsigned> const run(char const * const name, bool const print_times)
+{
+    typedef
+    mapreduce::job<map_task,
+                   reduce_task,
+                   mapreduce::null_combiner,
+                   number_source<map_task>,
+                   Store>
+    job;
+
+    mapreduce::specification spec;
+    spec.map_tasks    = 4;
+    spec.reduce_tasks = 4;
+
+    typename job::datasource_type datasource;
+    job j(datasource, spec);
+    mapreduce::results result;
+    j.template run<mapreduce::schedule_policy::cpu_parallel<job> >(result);
+
+    if (print_times)
+    {
+        std::cout << "\n" << name
+                  << ": job " << result.job_runtime.count() << "s"
+                  << ", map " << result.map_runtime.count() << "s"
+                  << ", shuffle " << result.shuffle_runtime.count() << "s"
+                  << ", reduce " << result.reduce_runtime.count() << "s";
+    }
+
+    std::map<unsigned, unsigned> results;
+    for (auto it=j.begin_results(); it!=j.end_results(); ++it)
+        results[it->first] += it->second;
+    return results;
+}
+
+template<typename Store>
+bool const results_in_key_order(void)
+{
+    typedef
+    mapreduce::job<map_task,
+                   reduce_task,
+                   mapreduce::null_combiner,
+                   number_source<map_task>,
+                   Store>
+    job;
+
+    mapreduce::specification spec;
+    spec.reduce_tasks = 4;
+    typename job::datasource_type datasource;
+    job j(datasource, spec);
+    mapreduce::results result;
+    j.template run<mapreduce::schedule_policy::sequential<job> >(result);
+
+    auto it = j.begin_results();
+    if (it == j.end_results())
+        return false;
+    for (auto previous=it++; it!=j.end_results(); previous=it++)
+    {
+        if (!(previous->first < it->first))
+            return false;
+    }
+    return true;
+}
+
+// the stores of map tasks, merged into one and reduced a partition at a time
+bool const reduces_in_key_order(void)
+{
+    size_t const num_partitions = 4;
+    mapreduce::intermediates::flat_buffer<map_task, reduce_task> store(num_partitions);
+    for (unsigned key=0; key<num_map_keys; ++key)
+    {
+        mapreduce::intermediates::flat_buffer<map_task, reduce_task> task_store(num_partitions);
+        for (unsigned emit=0; emit<100; ++emit)
+            task_store.insert((key * 7919 + emit * 104729) % 5000, 1U);
+        store.merge_from(task_store);
+    }
+
+    bool ordered = true;
+    unsigned total = 0;
+    for (size_t partition=0; partition<num_partitions; ++partition)
+    {
+        bool first = true;
+        unsigned previous = 0;
+        auto reduce = [&](unsigned const &key, unsigned const *it, unsigned const *ite) {
+            ordered &= (first || previous < key);
+            first    = false;
+            previous = key;
+            total   += unsigned(ite - it);
+        };
+        store.run_intermediate_results_shuffle(partition);
+        store.reduce(partition, reduce);
+    }
+    return check(ordered, "an ordered store reduces its keys in order")
+        && check(total == num_map_keys * 100, "every value is reduced");
+}
+
+} // namespace flat_buffer_test
+
+int main(int argc, char **argv)
+{
+    using namespace flat_buffer_test;
+    using namespace mapreduce::intermediates;
+
+    bool const benchmark = (argc > 1 && strcmp(argv[1], "benchmark") == 0);
+    if (benchmark)
+    {
+        num_emits = 20000000;
+        num_keys  = 1000000;
+        run<hashed_in_memory<map_task, reduce_task> >("hashed_in_memory", true);
+    }
+
+    auto const expected = run<in_memory<map_task, reduce_task> >("in_memory", benchmark);
+    bool success = check(expected.size() > num_keys / 2, "in_memory emits the keys");
+    success &= check(run<flat_buffer<map_task, reduce_task> >("flat_buffer", benchmark) == expected, "flat_buffer's results match in_memory's");
+    success &= check(run<unordered_flat_buffer>("unordered flat_buffer", benchmark) == expected, "unordered flat_buffer's results match in_memory's");
+    success &= check(results_in_key_order<flat_buffer<map_task, reduce_task> >(), "flat_buffer's results are in key order");
+    success &= check(results_in_key_order<unordered_flat_buffer>(), "unordered flat_buffer's results are in key order");
+    success &= reduces_in_key_order();
+
+    std::cout << (success? "\nPassed" : "\nFailed") << std::endl;
+    return success? 0 : 1;
+}
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,149 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+// runs a job with a hybrid store and a small memory budget through
+// cpu_parallel, and checks that the memory held by the map tasks' stores is
+// kept within the budget and that the results are those of a job that is
+// held in memory. returns zero if the checks pass
+
+#include "mapreduce.hpp"
+#include <iostream>
+#include <map>
+
+namespace hybrid_test {
+
+unsigned const num_map_keys   = 64;
+unsigned const values_per_key = 4096;
+unsigned const num_keys       = 5000;
+
+std::atomic<std::uintmax_t> peak_memory_in_use(0);
+
+template<typename MapTask>
+class number_source : mapreduce::detail::noncopyable
+{
+  public:
+    number_source() : sequence_(0)
+    {
+    }
+
+    bool const setup_key(typename MapTask::key_type &key)
+    {
+        key = sequence_++;
+        return key < num_map_keys;
+    }
+
+    bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value)
+    {
+        value = key * values_per_key;
+        return true;
+    }
+
+  private:
+    std::atomic<unsigned> sequence_;
+};
+
+struct map_task : public mapreduce::map_task<unsigned, unsigned>
+{
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &/*key*/, value_type const &value) const
+    {
+        for (unsigned loop=0; loop<values_per_key; ++loop)
+        {
+            runtime.emit_intermediate((value + loop) % num_keys, 1U);
+
+            std::uintmax_t const in_use = runtime.intermediate_store().memory_in_use();
+            std::uintmax_t peak = peak_memory_in_use;
+            while (in_use > peak  &&  !peak_memory_in_use.compare_exchange_weak(peak, in_use))
+                ;
+        }
+    }
+};
+
+struct reduce_task : public mapreduce::reduce_task<unsigned, unsigned>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, key_type const &key, It it, It ite) const
+    {
+        unsigned total = 0;
+        for (; it!=ite; ++it)
+            total += *it;
+        runtime.emit(key, total);
+    }
+};
+
+typedef
+mapreduce::job<map_task,
+               reduce_task,
+               mapreduce::null_combiner,
+               number_source<map_task>,
+               mapreduce::intermediates::hybrid<map_task, reduce_task> >
+job;
+
+bool const check(bool const condition, char const * const message)
+{
+    if (!condition)
+        std::cerr << "\nFailed: " << message;
+    return condition;
+}
+
+} // namespace hybrid_test
+
+int main()
+{
+    using namespace hybrid_test;
+
+    std::uintmax_t const budget = 64 * 1024;
+
+    mapreduce::specification spec;
+    spec.memory_budget = budget;
+    spec.reduce_tasks  = 4;
+
+    job::datasource_type datasource;
+    job j(datasource, spec);
+    mapreduce::results result;
+    j.run<mapreduce::schedule_policy::cpu_parallel<job> >(result);
+
+    std::map<unsigned, unsigned> expected;
+    for (unsigned key=0; key<num_map_keys; ++key)
+    {
+        for (unsigned loop=0; loop<values_per_key; ++loop)
+            ++expected[(key * values_per_key + loop) % num_keys];
+    }
+
+    std::map<unsigned, unsigned> results;
+    for (auto it=j.begin_results(); it!=j.end_results(); ++it)
+        results[it->first] += it->second;
+
+    // a store can be over the budget by what it inserts before it writes out
+    // a partition, so the peak is allowed one partition of a map task's keys
+    // for each thread
+    std::uintmax_t const slack = std::thread::hardware_concurrency() * num_keys * 64;
+
+    bool success = true;
+    success &= check(peak_memory_in_use > 0, "the memory of map tasks' stores is counted");
+    success &= check(peak_memory_in_use <= budget + slack, "map tasks' stores are kept within the budget");
+    success &= check(result.counters.map_keys_completed == num_map_keys, "every map key is completed");
+    success &= check(results == expected, "results are those of a job held in memory");
+
+    std::cout << "\nPeak memory in use " << peak_memory_in_use << " of a budget of " << budget;
+    std::cout << (success? "\nPassed" : "\nFailed") << std::endl;
+    return success? 0 : 1;
+}
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,172 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+// runs an incremental job over a directory of files as its input changes,
+// and checks that each run maps only what it has to, and that every line of
+// the input is counted once: when nothing has changed, when a file is added,
+// when a file is appended to and when the segment size is changed. returns
+// zero if the checks pass
+
+#include "mapreduce.hpp"
+#include <fstream>
+#include <iostream>
+#include <map>
+
+namespace incremental_test {
+
+// counts the lines of the segments of files
+struct map_task : public mapreduce::map_task<std::string, std::pair<char const *, std::uintmax_t> >
+{
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &/*key*/, value_type const &value) const
+    {
+        char const *begin = value.first;
+        char const *const end = value.first + value.second;
+        while (begin != end)
+        {
+            char const *line = begin;
+            while (begin != end  &&  *begin != '\n'  &&  *begin != '\r')
+                ++begin;
+            if (begin != line)
+                runtime.emit_intermediate(std::string(line, begin), 1U);
+            while (begin != end  &&  (*begin == '\n'  ||  *begin == '\r'))
+                ++begin;
+        }
+    }
+};
+
+struct reduce_task : public mapreduce::reduce_task<std::string, unsigned>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, key_type const &key, It it, It ite) const
+    {
+        unsigned total = 0;
+        for (; it!=ite; ++it)
+            total += *it;
+        runtime.emit(key, total);
+    }
+};
+
+typedef
+mapreduce::job<map_task,
+               reduce_task,
+               mapreduce::null_combiner,
+               mapreduce::datasource::directory_iterator<map_task> >
+job;
+
+bool const check(bool const condition, char const * const message)
+{
+    if (!condition)
+        std::cerr << "\nFailed: " << message;
+    return condition;
+}
+
+void write_lines(boost::filesystem::path const &filename, char const * const prefix, unsigned const count, std::ios_base::openmode const mode=std::ios_base::trunc)
+{
+    std::ofstream file(filename.string().c_str(), std::ios_base::binary | std::ios_base::out | mode);
+    for (unsigned loop=0; loop<count; ++loop)
+        file << prefix << " " << loop << "\n";
+}
+
+// run the job, and check that the results hold 'expected' lines, each
+// counted once
+bool const run(mapreduce::specification const &spec, size_t const expected, mapreduce::results &result)
+{
+    job::datasource_type datasource(spec);
+    job j(datasource, spec);
+    j.run<mapreduce::schedule_policy::cpu_parallel<job> >(result);
+
+    std::map<std::string, unsigned> lines;
+    for (auto it=j.begin_results(); it!=j.end_results(); ++it)
+        lines[it->first] += it->second;
+
+    bool success = check(lines.size() == expected, "every line is reduced");
+    for (auto const &line : lines)
+    {
+        if (!check(line.second == 1, "each line is counted once"))
+        {
+            success = false;
+            break;
+        }
+    }
+    return success;
+}
+
+bool const test_incremental(boost::filesystem::path const &directory)
+{
+    boost::filesystem::path const input = directory / "input";
+    boost::filesystem::create_directories(input);
+    write_lines(input / "first.txt", "first", 100);
+
+    mapreduce::specification spec;
+    spec.input_directory       = input.string();
+    spec.max_file_segment_size = 150;
+    spec.checkpoint_directory  = (directory / "checkpoint").string();
+    spec.incremental           = true;
+
+    bool success = true;
+    mapreduce::results first;
+    success &= run(spec, 100, first);
+    success &= check(first.counters.map_keys_executed > 1, "the file is mapped in segments");
+
+    mapreduce::results unchanged;
+    success &= run(spec, 100, unchanged);
+    success &= check(unchanged.counters.map_keys_executed == 0, "nothing is mapped when the input is unchanged");
+
+    // only the segments of the new file are mapped
+    write_lines(input / "second.txt", "second", 50);
+    mapreduce::results added;
+    success &= run(spec, 150, added);
+    success &= check(added.counters.map_keys_executed > 0, "the added file is mapped");
+    success &= check(added.counters.map_keys_executed < first.counters.map_keys_executed, "the first file is not mapped again");
+
+    // a file that has been combined has changed, so everything is run again
+    write_lines(input / "first.txt", "appended", 20, std::ios_base::app);
+    mapreduce::results appended;
+    success &= run(spec, 170, appended);
+    success &= check(appended.counters.map_keys_executed > added.counters.map_keys_executed, "every file is mapped when one has changed");
+
+    // larger segments would overlap the ones that were combined
+    spec.max_file_segment_size = 200;
+    mapreduce::results resized;
+    success &= run(spec, 170, resized);
+    success &= check(resized.counters.map_keys_restored == 0, "nothing is restored when the segment size changes");
+
+    mapreduce::results resized_unchanged;
+    success &= run(spec, 170, resized_unchanged);
+    success &= check(resized_unchanged.counters.map_keys_executed == 0, "nothing is mapped when the input is unchanged");
+    return success;
+}
+
+} // namespace incremental_test
+
+int main()
+{
+    boost::filesystem::path const directory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("incremental_%%%%-%%%%");
+
+    bool success = incremental_test::test_incremental(directory);
+
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(directory, ec);
+
+    std::cout << (success? "\nPassed" : "\nFailed") << std::endl;
+    return success? 0 : 1;
+}
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
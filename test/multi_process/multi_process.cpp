@@ -0,0 +1,175 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+// runs jobs with the multi_process schedule policy: one that runs to
+// completion, and one where a worker process crashes on its first attempt
+// at a map key, and checks that every key is counted once. on platforms
+// other than Linux the policy runs as cpu_parallel and no worker crashes.
+// returns zero if the checks pass
+
+#include "mapreduce.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+namespace multi_process_test {
+
+unsigned const num_keys     = 100;
+unsigned const num_counters = 10;
+unsigned const crash_key    = 42;
+
+// a worker that maps crash_key when this file does not exist creates it
+// and crashes, so the key is run again by another worker, which finds it
+std::string crash_marker;
+
+template<typename MapTask>
+class number_source : mapreduce::detail::noncopyable
+{
+  public:
+    number_source()
+      : sequence_(0)
+    {
+    }
+
+    bool const setup_key(typename MapTask::key_type &key)
+    {
+        key = sequence_++;
+        return key < num_keys;
+    }
+
+    bool const get_data(typename MapTask::key_type const &key, typename MapTask::value_type &value)
+    {
+        value = key;
+        return true;
+    }
+
+  private:
+    unsigned sequence_;
+};
+
+struct map_task : public mapreduce::map_task<unsigned, unsigned>
+{
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &key, value_type const &value) const
+    {
+#if defined(__linux__)
+        if (key == crash_key  &&  !crash_marker.empty()  &&  !boost::filesystem::exists(crash_marker))
+        {
+            std::ofstream(crash_marker.c_str());
+            std::abort();
+        }
+#endif
+        runtime.emit_intermediate(value % num_counters, 1U);
+    }
+};
+
+struct reduce_task : public mapreduce::reduce_task<unsigned, unsigned>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, key_type const &key, It it, It ite) const
+    {
+        unsigned total = 0;
+        for (; it!=ite; ++it)
+            total += *it;
+        runtime.emit(key, total);
+    }
+};
+
+typedef
+mapreduce::job<map_task,
+               reduce_task,
+               mapreduce::null_combiner,
+               number_source<map_task> >
+job;
+
+bool const check(bool const condition, char const * const message)
+{
+    if (!condition)
+        std::cerr << "\nFailed: " << message;
+    return condition;
+}
+
+// run a job in three worker processes, and check that each counter has
+// counted the keys that map to it once
+bool const run(mapreduce::results &result)
+{
+    mapreduce::specification spec;
+    spec.processes    = 3;
+    spec.reduce_tasks = 2;
+
+    job::datasource_type datasource;
+    job j(datasource, spec);
+    j.run<mapreduce::schedule_policy::multi_process<job> >(result);
+
+    std::map<unsigned, unsigned> counters;
+    for (auto it=j.begin_results(); it!=j.end_results(); ++it)
+        counters[it->first] += it->second;
+
+    bool success = true;
+    success &= check(counters.size() == num_counters, "every counter has a result");
+    for (auto const &counter : counters)
+        success &= check(counter.second == num_keys / num_counters, "every key is counted once");
+    success &= check(result.counters.map_keys_completed == num_keys, "every map key is completed");
+    success &= check(result.counters.map_key_errors == 0, "no map key fails");
+    success &= check(!result.cancelled, "the job is not cancelled");
+    return success;
+}
+
+bool const test_complete(void)
+{
+    crash_marker.clear();
+
+    mapreduce::results result;
+    bool success = run(result);
+    success &= check(result.counters.failed_map_processes == 0, "no worker fails");
+    return success;
+}
+
+bool const test_crashed_worker(boost::filesystem::path const &directory)
+{
+    boost::filesystem::create_directories(directory);
+    crash_marker = (directory / "crashed").string();
+
+    mapreduce::results result;
+    bool success = run(result);
+#if defined(__linux__)
+    success &= check(boost::filesystem::exists(crash_marker), "a worker crashes");
+    success &= check(result.counters.failed_map_processes == 1, "the crashed worker is counted");
+#endif
+    return success;
+}
+
+} // namespace multi_process_test
+
+int main()
+{
+    boost::filesystem::path const directory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("multi_process_%%%%-%%%%");
+
+    bool success = multi_process_test::test_complete();
+    success &= multi_process_test::test_crashed_worker(directory);
+
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(directory, ec);
+
+    std::cout << (success? "\nPassed" : "\nFailed") << std::endl;
+    return success? 0 : 1;
+}
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
@@ -0,0 +1,139 @@
+// Copyright (c) 2009-2016 Craig Henderson
+// https://github.com/cdmh/mapreduce
+
+// runs a job with speculative execution over the segments of a memory mapped
+// file, with the map task of the first segment held back so that it is re-run
+// while it is still running, and checks that every line of the file is
+// counted once. returns zero if the checks pass
+
+#include "mapreduce.hpp"
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <thread>
+
+namespace speculative_test {
+
+unsigned const num_lines = 300;
+
+std::atomic<bool> held_back(false);
+
+// counts the lines of the segments of files
+struct map_task : public mapreduce::map_task<std::string, std::pair<char const *, std::uintmax_t> >
+{
+    template<typename Runtime>
+    void operator()(Runtime &runtime, key_type const &/*key*/, value_type const &value) const
+    {
+        if (!held_back.exchange(true))
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+        char const *begin = value.first;
+        char const *const end = value.first + value.second;
+        while (begin != end)
+        {
+            char const *line = begin;
+            while (begin != end  &&  *begin != '\n'  &&  *begin != '\r')
+                ++begin;
+            if (begin != line)
+                runtime.emit_intermediate(std::string(line, begin), 1U);
+            while (begin != end  &&  (*begin == '\n'  ||  *begin == '\r'))
+                ++begin;
+        }
+    }
+};
+
+struct reduce_task : public mapreduce::reduce_task<std::string, unsigned>
+{
+    template<typename Runtime, typename It>
+    void operator()(Runtime &runtime, key_type const &key, It it, It ite) const
+    {
+        unsigned total = 0;
+        for (; it!=ite; ++it)
+            total += *it;
+        runtime.emit(key, total);
+    }
+};
+
+typedef
+mapreduce::job<map_task,
+               reduce_task,
+               mapreduce::null_combiner,
+               mapreduce::datasource::directory_iterator<map_task> >
+job;
+
+bool const check(bool const condition, char const * const message)
+{
+    if (!condition)
+        std::cerr << "\nFailed: " << message;
+    return condition;
+}
+
+bool const test_file_segments(boost::filesystem::path const &directory)
+{
+    boost::filesystem::create_directories(directory);
+    {
+        std::ofstream file((directory / "lines.txt").string().c_str(), std::ios_base::binary);
+        for (unsigned loop=0; loop<num_lines; ++loop)
+            file << "line " << loop << "\n";
+    }
+
+    mapreduce::specification spec;
+    spec.input_directory       = directory.string();
+    spec.max_file_segment_size = 256;
+    spec.map_tasks             = 4;
+    spec.speculative_execution = true;
+
+    // a pool of its own, so that there are idle threads to re-run the
+    // held back segment on a machine with a single core
+    job::datasource_type datasource(spec);
+    job j(datasource, spec);
+    mapreduce::results result;
+    mapreduce::schedule_policy::cpu_parallel<job> schedule(std::make_shared<mapreduce::thread_pool>(4));
+    j.run(schedule, result);
+
+    std::map<std::string, unsigned> lines;
+    for (auto it=j.begin_results(); it!=j.end_results(); ++it)
+        lines[it->first] += it->second;
+
+    bool success = true;
+    success &= check(result.counters.map_keys_completed > 1, "the file is mapped in segments");
+    success &= check(result.counters.speculative_wins > 0, "the held back segment is re-run");
+    success &= check(result.counters.map_key_errors == 0, "no segment fails");
+    success &= check(lines.size() == num_lines, "every line is counted");
+    for (auto const &line : lines)
+        success &= check(line.second == 1, "each line is counted once");
+    return success;
+}
+
+} // namespace speculative_test
+
+int main()
+{
+    boost::filesystem::path const directory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("speculative_%%%%-%%%%");
+
+    bool success = speculative_test::test_file_segments(directory);
+
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(directory, ec);
+
+    std::cout << (success? "\nPassed" : "\nFailed") << std::endl;
+    return success? 0 : 1;
+}
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.